@@ -0,0 +1,58 @@
+#include "adpcm.h"
+
+static const int16_t s_step[89] = {
+        7,     8,     9,    10,    11,    12,    13,    14,    16,    17,
+       19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+       50,    55,    60,    66,    73,    80,    88,    97,   107,   118,
+      130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+      337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+      876,   963,  1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+     2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+     5894,  6484,  7132,  7845,  8630,  9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static const int8_t s_index_adj[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+static uint8_t encode_one(adpcm_state_t *st, int16_t s)
+{
+    int step = s_step[st->index];
+    int diff = (int)s - st->pred;
+    uint8_t code = 0;
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+    // Same successive approximation as the decoder, so pred tracks what it rebuilds.
+    int delta = step >> 3;
+    if (diff >= step) { code |= 4; diff -= step; delta += step; }
+    step >>= 1;
+    if (diff >= step) { code |= 2; diff -= step; delta += step; }
+    step >>= 1;
+    if (diff >= step) { code |= 1; delta += step; }
+
+    int pred = (code & 8) ? st->pred - delta : st->pred + delta;
+    st->pred = (int16_t)(pred > 32767 ? 32767 : pred < -32768 ? -32768 : pred);
+    int index = st->index + s_index_adj[code & 7];
+    st->index = (uint8_t)(index < 0 ? 0 : index > 88 ? 88 : index);
+    return code;
+}
+
+void adpcm_warmup(adpcm_state_t *st, const int16_t *pcm, size_t n)
+{
+    st->index = 0;
+    if (n == 0) return;
+    st->pred = pcm[0];
+    for (size_t i = 1; i < n; i++) (void)encode_one(st, pcm[i]);
+}
+
+size_t adpcm_encode(adpcm_state_t *st, const int16_t *pcm, size_t n, uint8_t *out)
+{
+    size_t nb = 0;
+    for (size_t i = 0; i < n; i += 2) {
+        uint8_t b = encode_one(st, pcm[i]);
+        if (i + 1 < n) b |= (uint8_t)(encode_one(st, pcm[i + 1]) << 4);
+        out[nb++] = b;
+    }
+    return nb;
+}
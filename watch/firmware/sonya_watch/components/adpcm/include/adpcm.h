@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * IMA-ADPCM (DVI4) encoder, 4 bits per sample, nibbles packed low nibble first.
+ * Bit-exact with the standard decoder (tools/adpcm/ima_adpcm.py).
+ */
+
+typedef struct {
+    int16_t pred;       // last reconstructed sample
+    uint8_t index;      // step table index, 0..88
+} adpcm_state_t;
+
+/*
+ * Run the encoder over pcm[0..n) and keep only the adapted step index; pred starts
+ * at pcm[0]. Lets a frame start mid-stream with a step size that fits the signal,
+ * while staying a pure function of the samples before it.
+ */
+void adpcm_warmup(adpcm_state_t *st, const int16_t *pcm, size_t n);
+
+/* Encode n samples into (n + 1) / 2 bytes at out; an odd tail leaves the high nibble 0. */
+size_t adpcm_encode(adpcm_state_t *st, const int16_t *pcm, size_t n, uint8_t *out);
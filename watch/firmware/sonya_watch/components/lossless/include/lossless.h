@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Lossless block coder for 16-bit PCM: FLAC-style fixed polynomial prediction
+ * (order 0..4, picked per block) and Rice-coded residuals in 256-sample partitions.
+ * Every block carries its own warm-up samples, so blocks decode independently.
+ * Decoder: tools/lossless/lossless.py.
+ *
+ * Block: [order:u8][warm-up: order x s16][bitstream, MSB first]
+ *   per partition: k:5, then each zigzag residual as unary(u >> k) + k low bits;
+ *   k = LOSSLESS_ESCAPE: residuals as LOSSLESS_RAW_BITS-bit zigzag values instead.
+ */
+
+#define LOSSLESS_BLOCK      4096    // samples per block (the last one may be shorter)
+#define LOSSLESS_PART       256     // samples per Rice partition
+#define LOSSLESS_MAX_ORDER  4
+#define LOSSLESS_ESCAPE     31
+#define LOSSLESS_RAW_BITS   21      // |order-4 residual| < 2^19, zigzag < 2^20
+
+// Worst case encoded size of an n-sample block (every partition escaped).
+#define LOSSLESS_MAX_BYTES(n) \
+    (1 + 2 * LOSSLESS_MAX_ORDER + (((n) / LOSSLESS_PART + 1) * 5 + (n) * LOSSLESS_RAW_BITS) / 8 + 1)
+
+/* Encode pcm[0..n) (n <= LOSSLESS_BLOCK) into out; returns bytes written, 0 if out_cap is too small. */
+size_t lossless_encode(const int16_t *pcm, size_t n, uint8_t *out, size_t out_cap);
@@ -0,0 +1,134 @@
+#include "lossless.h"
+#include <stdbool.h>
+
+typedef struct {
+    uint8_t *buf;
+    size_t   cap;
+    size_t   pos;       // bytes completed
+    uint32_t acc;       // pending bits, right-aligned
+    int      nacc;
+    bool     overflow;
+} bitw_t;
+
+static void put_bits(bitw_t *w, uint32_t v, int n)
+{
+    while (n > 0) {
+        int take = n > 16 ? 16 : n;
+        n -= take;
+        w->acc = (w->acc << take) | ((v >> n) & ((1U << take) - 1U));
+        w->nacc += take;
+        while (w->nacc >= 8) {
+            w->nacc -= 8;
+            if (w->pos < w->cap) w->buf[w->pos++] = (uint8_t)(w->acc >> w->nacc);
+            else w->overflow = true;
+        }
+    }
+}
+
+static void put_unary(bitw_t *w, uint32_t q)
+{
+    while (q >= 16) {
+        put_bits(w, 0, 16);
+        q -= 16;
+    }
+    put_bits(w, 1, (int)q + 1);
+}
+
+static int32_t residual(const int16_t *x, size_t i, int order)
+{
+    switch (order) {
+    case 0:  return x[i];
+    case 1:  return (int32_t)x[i] - x[i - 1];
+    case 2:  return (int32_t)x[i] - 2 * x[i - 1] + x[i - 2];
+    case 3:  return (int32_t)x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+    default: return (int32_t)x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+    }
+}
+
+static uint32_t zigzag(int32_t r)
+{
+    return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+static int pick_order(const int16_t *x, size_t n)
+{
+    int best = 0;
+    uint64_t best_sum = UINT64_MAX;
+    for (int o = 0; o <= LOSSLESS_MAX_ORDER && (size_t)o < n; o++) {
+        uint64_t sum = 0;
+        for (size_t i = LOSSLESS_MAX_ORDER < n ? LOSSLESS_MAX_ORDER : n; i < n; i++) {
+            int32_t r = residual(x, i, o);
+            sum += (uint32_t)(r < 0 ? -r : r);
+        }
+        if (sum < best_sum) {
+            best_sum = sum;
+            best = o;
+        }
+    }
+    return best;
+}
+
+/* Bits for residuals [i0, i1) with parameter k. */
+static uint64_t rice_cost(const int16_t *x, size_t i0, size_t i1, int order, int k)
+{
+    uint64_t bits = (uint64_t)(i1 - i0) * (uint64_t)(k + 1);
+    for (size_t i = i0; i < i1; i++) bits += zigzag(residual(x, i, order)) >> k;
+    return bits;
+}
+
+static void encode_partition(bitw_t *w, const int16_t *x, size_t i0, size_t i1, int order)
+{
+    size_t cnt = i1 - i0;
+    uint64_t sum = 0;
+    for (size_t i = i0; i < i1; i++) sum += zigzag(residual(x, i, order));
+
+    int k0 = 0;
+    if (cnt) {
+        uint64_t mean = sum / cnt;
+        while (k0 < 20 && (1ULL << (k0 + 1)) <= mean) k0++;
+    }
+    int k = k0;
+    uint64_t cost = rice_cost(x, i0, i1, order, k0);
+    for (int kk = k0 - 1; kk <= k0 + 1; kk += 2) {
+        if (kk < 0 || kk > 20) continue;
+        uint64_t c = rice_cost(x, i0, i1, order, kk);
+        if (c < cost) {
+            cost = c;
+            k = kk;
+        }
+    }
+
+    if (cost > (uint64_t)cnt * LOSSLESS_RAW_BITS) {
+        put_bits(w, LOSSLESS_ESCAPE, 5);
+        for (size_t i = i0; i < i1; i++) put_bits(w, zigzag(residual(x, i, order)), LOSSLESS_RAW_BITS);
+        return;
+    }
+    put_bits(w, (uint32_t)k, 5);
+    for (size_t i = i0; i < i1; i++) {
+        uint32_t u = zigzag(residual(x, i, order));
+        put_unary(w, u >> k);
+        if (k) put_bits(w, u & ((1U << k) - 1U), k);
+    }
+}
+
+size_t lossless_encode(const int16_t *pcm, size_t n, uint8_t *out, size_t out_cap)
+{
+    if (!pcm || !out || n == 0 || n > LOSSLESS_BLOCK) return 0;
+    int order = pick_order(pcm, n);
+    size_t hdr = 1 + 2 * (size_t)order;
+    if (out_cap < hdr) return 0;
+
+    out[0] = (uint8_t)order;
+    for (int i = 0; i < order; i++) {
+        out[1 + 2 * i] = (uint8_t)((uint16_t)pcm[i] & 0xFF);
+        out[2 + 2 * i] = (uint8_t)((uint16_t)pcm[i] >> 8);
+    }
+
+    bitw_t w = { .buf = out + hdr, .cap = out_cap - hdr };
+    for (size_t p0 = 0; p0 < n; p0 += LOSSLESS_PART) {
+        size_t p1 = p0 + LOSSLESS_PART < n ? p0 + LOSSLESS_PART : n;
+        encode_partition(&w, pcm, p0 < (size_t)order ? (size_t)order : p0, p1, order);
+    }
+    if (w.nacc) put_bits(&w, 0, 8 - w.nacc);
+    return w.overflow ? 0 : hdr + w.pos;
+}
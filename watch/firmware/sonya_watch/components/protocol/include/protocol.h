@@ -2,24 +2,158 @@
  * @file protocol.h
  * @brief Binary protocol over BLE GATT
  *
- * FRAME: [type:uint8][seq:uint16][len:uint16][payload]
+ * FRAME v1: [type:uint8][seq:uint16][len:uint16][payload]
+ * FRAME v2: [sid:3|type:5][seq:uint32][len:uint16]([hcrc:uint8])[payload]  (after SESS, see below)
  */
 
 #pragma once
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 #define PROTO_FRAME_HEADER_SIZE 5
 
+/* Protocol version in EVT_CAPS; bumped when frames or commands change incompatibly */
+#define PROTO_VERSION 2
+
+/*
+ * v2 TX header, used once the phone asks for it with SESS (PROTO_SESS_F_V2). Byte 0
+ * packs the stream id (top 3 bits) with the frame type (TX types stay below 0x20);
+ * seq counts per stream, so a gap is a loss on that stream alone. With
+ * PROTO_SESS_F_HCRC a CRC-8 of the first 7 bytes follows. In v2, AUDIO_DATA drops its
+ * [rec_id][off] prefix: the offset is base + (seq - seq0) * frame from the last
+ * EVT_STREAM on the same stream. RX commands keep the v1 header.
+ */
+#define PROTO_V2_HEADER_SIZE 7
+#define PROTO_V2_TYPE_MASK   0x1F
+#define PROTO_V2_SID_SHIFT   5
+
+/* Stream ids: one per TX class, plus the CoC channel */
+#define PROTO_SID_CTRL  0
+#define PROTO_SID_LIVE  1
+#define PROTO_SID_BULK  2
+#define PROTO_SID_TELEM 3
+#define PROTO_SID_COC   4
+#define PROTO_SID_COUNT 5
+
 /* Frame types */
 #define PROTO_EVT_WAKE      0x01
 #define PROTO_EVT_REC_START 0x02
 #define PROTO_EVT_REC_END   0x03
+// Pending recording, sent when the phone subscribes to TX:
+// [rec_id:u16][total:u32][crc:u32][flags:u8][sr:u16]; crc is 0 until committed
+#define PROTO_EVT_REC_INFO  0x04
+#define PROTO_REC_INFO_F_COMMITTED 0x01
+#define PROTO_REC_INFO_F_LIVE      0x02   /* still recording; RESUME continues the live stream */
+// Reply to HELLO: [ver:u8][codecs:u8][max_payload:u16][att_mtu:u16][coc_payload:u16]
+// [store_bytes:u32][features:u16][sr:u16]; codecs bit i = PROTO_CODEC i supported,
+// coc_payload is 0 while no CoC channel is open.
+#define PROTO_EVT_CAPS      0x05
+#define PROTO_FEAT_XGET     0x0001
+#define PROTO_FEAT_RESUME   0x0002
+#define PROTO_FEAT_COC      0x0004   /* CoC server built in (CONFIG_BLE_COC_ENABLE) */
+#define PROTO_FEAT_BENCH    0x0008
+#define PROTO_FEAT_LIVE     0x0010
+#define PROTO_FEAT_SESS_PULL 0x0020  /* SESS mode PROTO_SESS_PULL */
+#define PROTO_FEAT_BIN_CMD  0x0040   /* binary RX commands (PROTO_BCMD_BASE + proto_cmd_t) */
+#define PROTO_FEAT_NACK     0x0100   /* NACK range lists */
+#define PROTO_FEAT_FEC      0x0200   /* live XOR parity (FEC command) */
+#define PROTO_FEAT_BATCH    0x0400   /* EVT_BATCH (SESS flag PROTO_SESS_F_BATCH) */
+#define PROTO_FEAT_STATUS   0x0800   /* EVT_STATUS (SESS flag PROTO_SESS_F_STATUS), TX read */
+// Reply to a binary RX command: [req:u16][op:u8][status:u8][text]; req is the command's seq,
+// op its type, text the ASCII reply the same command gets in EVT_ERROR (may be empty).
+#define PROTO_EVT_REPLY     0x06
+// v2 only, on the stream it describes: the next AUDIO_DATA frames of rec_id on this stream
+// start at PCM offset base + (seq - seq0) * frame: [rec_id:u16][base:u32][seq0:u32][frame:u16]
+#define PROTO_EVT_STREAM    0x07
+// After SESS with PROTO_SESS_F_BATCH: small events coalesced into one notification,
+// n x [type:u8][len:u8][payload], each record exactly the frame it replaces.
+#define PROTO_EVT_BATCH     0x08
+// Device status, after SESS with PROTO_SESS_F_STATUS in place of the BATT text in EVT_ERROR
+// (PING, BATT, every 60 s); also the value of a TX characteristic read, refreshed every second.
+// Little-endian, PROTO_STATUS_LEN bytes; fields are only appended, ver counts the layout:
+//   [ver:u8][flags:u8][batt_pct:u8][tx_phy:u8][batt_mv:u16][vbus_mv:u16]
+//   [heap_free:u32][heap_min:u32][psram_free:u32][rec_bytes:u32][pool_free:u16][pool_total:u16]
+//   [att_mtu:u16][itvl:u16][txq ctrl,live,bulk,telem:4 x u8][tx_failed:u32][tx_dropped:u32][uptime_s:u32]
+// batt_pct 0xFF = unknown; battery fields are from the last PMU read (PROTO_STATUS_F_PMU_ERR if
+// it failed); heap_* internal RAM; pool_* rec_store blocks; itvl in 1.25 ms units (0 = no link);
+// txq frames waiting per TX class; tx_* notifications failed / dropped from the queues since boot.
+#define PROTO_EVT_STATUS    0x09
+#define PROTO_STATUS_VERSION 1
+#define PROTO_STATUS_LEN    48
+#define PROTO_STATUS_F_CHARGING  0x01
+#define PROTO_STATUS_F_VBUS      0x02
+#define PROTO_STATUS_F_BATTERY   0x04   /* battery present */
+#define PROTO_STATUS_F_RECORDING 0x08
+#define PROTO_STATUS_F_MIC       0x10   /* capture running */
+#define PROTO_STATUS_F_PMU_ERR   0x20
+#define PROTO_STATUS_F_NO_MIC    0x40   /* booted without a microphone; REC disabled */
+#define PROTO_FEAT_V2_HDR   0x0080
 #define PROTO_AUDIO_CHUNK   0x10
 #define PROTO_EVT_ERROR     0x11
 // Audio data sent in response to GET requests (payload contains offset)
 #define PROTO_AUDIO_DATA    0x12
+// Windowed transfer (XGET): [rec_id:u16][fseq:u16][off:u32][pcm]
+#define PROTO_AUDIO_WIN     0x13
+// GET/live audio in IMA-ADPCM sessions: [rec_id:u16][off:u32][pred:s16][index:u8][flags:u8][nibbles]
+// off is the PCM byte offset of sample 0 (= pred); the nibbles code samples 1..N-1.
+#define PROTO_AUDIO_ADPCM   0x14
+#define PROTO_ADPCM_F_PAD   0x01   /* high nibble of the last byte is padding */
+// Live audio in Opus sessions, one 20 ms packet: [rec_id:u16][off:u32][samples:u16][opus]
+// samples < 320 only for the zero-padded last packet of a recording.
+#define PROTO_AUDIO_OPUS    0x15
+// GET audio in lossless sessions, one chunk of an encoded 4096-sample block (components/lossless):
+// [rec_id:u16][off:u32][samples:u16][blk_len:u16][chunk_off:u16][block bytes]
+// off is the PCM byte offset of the block start (a multiple of 8192).
+#define PROTO_AUDIO_LOSSLESS 0x16
+// Live XOR parity (FEC command, PCM live over GATT): [rec_id:u16][off:u32][frame:u16][k:u8][xor]
+// xor is the XOR of the PCM of the k live AUDIO_DATA frames covering [off, off + k * frame),
+// so any one of them can be rebuilt from the other k - 1. Sent right after the last of them.
+#define PROTO_AUDIO_FEC     0x17
+// Synthetic benchmark (BENCH): [bseq:u32][off:u32][pattern]; pattern byte at stream offset x is x % 251
+#define PROTO_BENCH_DATA    0x1F
+#define PROTO_BENCH_PERIOD  251
+
+#define PROTO_AUDIO_DATA_HDR 6  /* rec_id + offset */
+#define PROTO_AUDIO_WIN_HDR  8  /* rec_id + fseq + offset */
+#define PROTO_BENCH_DATA_HDR 8  /* bseq + offset */
+#define PROTO_AUDIO_ADPCM_HDR 10 /* rec_id + offset + pred + index + flags */
+#define PROTO_AUDIO_OPUS_HDR  8  /* rec_id + offset + samples */
+#define PROTO_AUDIO_LOSSLESS_HDR 12 /* rec_id + offset + samples + blk_len + chunk_off */
+#define PROTO_AUDIO_FEC_HDR   9  /* rec_id + offset + frame + k */
+
+/* FEC command mode: off, auto (k follows the loss estimate), or a fixed group size k */
+#define PROTO_FEC_OFF   0
+#define PROTO_FEC_AUTO  1
+#define PROTO_FEC_K_MIN 2
+#define PROTO_FEC_K_MAX 32
+
+/* Audio codec of a session (REC_START byte 4; REC_END byte 12 when not PCM) */
+#define PROTO_CODEC_PCM16     0
+#define PROTO_CODEC_IMA_ADPCM 1
+#define PROTO_CODEC_OPUS      2   /* live only; GET sends PCM */
+#define PROTO_CODEC_LOSSLESS  3   /* live sends a block once it is complete */
+
+/*
+ * Session picked by the phone with SESS after HELLO. Until then ver is 0 and every
+ * frame keeps its pre-HELLO layout. Once negotiated, EVT_REC_START appends
+ * [ver:u8][frame:u16][mode:u8] and EVT_REC_END always carries the codec byte.
+ */
+#define PROTO_SESS_LIVE 0   /* stream audio while recording, GET the rest */
+#define PROTO_SESS_PULL 1   /* no live stream; the phone GETs after REC_END */
+#define PROTO_SESS_MODE_MASK 0x0F
+#define PROTO_SESS_F_STATUS  0x10   /* EVT_STATUS instead of the BATT text */
+#define PROTO_SESS_F_BATCH   0x20   /* coalesce small events into EVT_BATCH */
+#define PROTO_SESS_F_HCRC    0x40   /* with F_V2: header CRC-8 */
+#define PROTO_SESS_F_V2      0x80   /* v2 TX header */
+
+typedef struct {
+    uint8_t  ver;      /* negotiated protocol version, 0 = no HELLO/SESS */
+    uint8_t  codec;    /* PROTO_CODEC_* */
+    uint16_t frame;    /* audio frame payload cap in bytes, 0 = as large as the link allows */
+    uint8_t  mode;     /* PROTO_SESS_* mode, | PROTO_SESS_F_* flags */
+} proto_session_t;
 
 typedef struct {
     uint8_t  type;
@@ -54,7 +188,32 @@ size_t proto_build_frame(uint8_t *buf, size_t buf_size,
 size_t proto_parse_header(const uint8_t *buf, size_t buf_len,
                           uint8_t *out_type, uint16_t *out_seq, uint16_t *out_len);
 
-/* ASCII command types from RX (v0 test mode) */
+/** v2 header fields */
+typedef struct {
+    uint8_t  type;
+    uint8_t  sid;
+    uint32_t seq;
+    uint16_t len;
+} proto_hdr_v2_t;
+
+/** CRC-8 (poly 0x07, init 0) as used for the v2 header check byte */
+uint8_t proto_crc8(const uint8_t *data, size_t len);
+
+/**
+ * @brief Write a v2 frame header
+ * @param buf Output, at least PROTO_V2_HEADER_SIZE (+1 with hcrc) bytes
+ * @return Header size, or 0 if type or sid do not fit
+ */
+size_t proto_build_header_v2(uint8_t *buf, size_t buf_size, uint8_t type, uint8_t sid,
+                             uint32_t seq, uint16_t payload_len, bool hcrc);
+
+/**
+ * @brief Parse a v2 frame header
+ * @return Total frame size (header+payload), or 0 if incomplete or the header CRC fails
+ */
+size_t proto_parse_header_v2(const uint8_t *buf, size_t buf_len, bool hcrc, proto_hdr_v2_t *out);
+
+/* Command types from RX, ASCII (v0 test mode) or binary; the binary op is PROTO_BCMD_BASE + value, so append only */
 typedef enum {
     PROTO_CMD_NONE = 0,
     PROTO_CMD_PING,
@@ -63,20 +222,119 @@ typedef enum {
     PROTO_CMD_BATT,
     PROTO_CMD_GET,
     PROTO_CMD_DONE,
+    PROTO_CMD_XGET,
+    PROTO_CMD_XACK,
+    PROTO_CMD_STATS,
+    PROTO_CMD_RESUME,
+    PROTO_CMD_BENCH,
+    PROTO_CMD_CODEC,
+    PROTO_CMD_HELLO,
+    PROTO_CMD_SESS,
+    PROTO_CMD_NACK,
+    PROTO_CMD_FEC,
+    PROTO_CMD_COUNT
 } proto_cmd_t;
 
+/* Longest ASCII command parsed; a longer write is rejected as a whole, never cut. */
+#define PROTO_ASCII_CMD_MAX 512
+
+/* NACK: one missing byte range of a recording; at most PROTO_NACK_MAX per command */
+#define PROTO_NACK_MAX 32
+
+typedef struct {
+    uint32_t off;
+    uint32_t len;
+} proto_range_t;
+
+/* Binary NACK payload forms (byte after rec_id) */
+#define PROTO_NACK_RANGES 0   /* n x [off:u32][len:u32] */
+#define PROTO_NACK_BITMAP 1   /* [base:u32][unit:u16][bitmap]: bit i (LSB first) = [base + i*unit, +unit) */
+
+/* Parsed command arguments (fields are set only for the commands that use them) */
+typedef struct {
+    int      rec_sec;   /* SETREC: 1..10 */
+    uint16_t rec_id;    /* GET, DONE, XGET, XACK, RESUME, NACK */
+    uint32_t offset;    /* GET, XGET: byte offset; RESUME: bytes the phone already has */
+    uint32_t len;       /* GET: requested length (ASCII: up to 65535) */
+    uint16_t ack_cum;   /* XACK: every frame with fseq < ack_cum received */
+    uint32_t ack_sack;  /* XACK: bit i set => frame ack_cum + 1 + i received */
+    uint16_t bench_sec;      /* BENCH: duration, 0 = until bench_bytes */
+    uint32_t bench_bytes;    /* BENCH: pattern bytes to send, 0 = until bench_sec */
+    uint16_t bench_frame;    /* BENCH: pattern bytes per frame, 0 = as many as fit */
+    uint16_t bench_gap_ms;   /* BENCH: frame pacing, 0 = back-to-back */
+    uint8_t  bench_inflight; /* BENCH: notifications in flight, 0 = BLE_TX_INFLIGHT_MAX */
+    uint8_t  codec;          /* CODEC, SESS: PROTO_CODEC_* */
+    uint8_t  ver;            /* HELLO: phone's protocol version (1 if omitted) */
+    uint16_t frame;          /* SESS: audio frame payload cap, 0 = link maximum */
+    uint8_t  mode;           /* SESS: PROTO_SESS_* */
+    uint8_t  fec_mode;       /* FEC: PROTO_FEC_OFF, PROTO_FEC_AUTO or a fixed k */
+    uint32_t loss_ppm;       /* FEC: loss the phone observes on live frames, 0 = no report */
+    uint8_t  n_ranges;       /* NACK: entries in ranges (extra ones are dropped) */
+    proto_range_t ranges[PROTO_NACK_MAX];
+} proto_rx_args_t;
+
+/* Status byte of EVT_REPLY */
+#define PROTO_ST_OK          0
+#define PROTO_ST_UNKNOWN     1   /* unknown op or malformed payload */
+#define PROTO_ST_NO_REC      2
+#define PROTO_ST_EOF         3
+#define PROTO_ST_BUSY        4   /* recording not committed yet */
+#define PROTO_ST_UNSUPPORTED 5
+
+/*
+ * Binary RX commands use the TX framing, [type:u8][seq:u16][len:u16][payload], with
+ * type = PROTO_BCMD_BASE + proto_cmd_t and seq as a request id echoed in EVT_REPLY.
+ * One write may carry several frames; they run in order. All fields little-endian:
+ *
+ *   0x81 PING, 0x82 REC, 0x84 BATT, 0x89 STATS    (no payload)
+ *   0x83 SETREC  [sec:u8]
+ *   0x85 GET     [rec_id:u16][off:u32][len:u32]
+ *   0x86 DONE    [rec_id:u16]
+ *   0x87 XGET    [rec_id:u16][off:u32]
+ *   0x88 XACK    [rec_id:u16][cum:u16][sack:u32]        (no EVT_REPLY)
+ *   0x8A RESUME  [rec_id:u16][hwm:u32]
+ *   0x8B BENCH   [sec:u16][bytes:u32][frame:u16][gap_ms:u16][inflight:u8]
+ *   0x8C CODEC   [codec:u8]
+ *   0x8D HELLO   [ver:u8]                               (payload optional)
+ *   0x8E SESS    [codec:u8][frame:u16][mode:u8]
+ *   0x8F NACK    [rec_id:u16][form:u8] + n x [off:u32][len:u32]     (PROTO_NACK_RANGES)
+ *                                      or [base:u32][unit:u16][bitmap] (PROTO_NACK_BITMAP)
+ *   0x90 FEC     [mode:u8][loss_ppm:u32]                (loss_ppm optional)
+ *
+ * ASCII commands never start with a byte >= 0x80, so the first byte tells them apart.
+ */
+#define PROTO_BCMD_BASE 0x80
+
+/**
+ * @brief Parse one binary command frame from RX
+ * @param buf RX bytes starting at a frame header
+ * @param len Bytes available
+ * @param out Output arguments (may be NULL)
+ * @param out_req Output request id (frame seq)
+ * @param out_used Bytes consumed; 0 if the frame is incomplete
+ * @return Parsed command, PROTO_CMD_NONE for an unknown op or short payload
+ */
+proto_cmd_t proto_parse_rx_bin(const uint8_t *buf, size_t len, proto_rx_args_t *out,
+                               uint16_t *out_req, size_t *out_used);
+
 /**
  * @brief Parse ASCII command from RX buffer
+ *
+ *   PING | BATT | REC | STATS | SETREC:<n> | DONE:<id> | CODEC:PCM|ADPCM|OPUS|LOSSLESS
+ *   GET:<id>:<off>:<len>     pull a byte window as AUDIO_DATA
+ *   XGET:<id>:<off>          windowed transfer of [off, end) as AUDIO_WIN
+ *   XACK:<id>:<cum>:<sack>   cumulative ack + 32-bit SACK bitmap (hex)
+ *   RESUME:<id>:<hwm>        continue rec <id> from byte <hwm> after a reconnect
+ *   NACK:<id>:<off>+<len>[,<off>+<len>...]  resend these ranges as AUDIO_DATA
+ *   FEC:<mode>[:<loss_ppm>]  live XOR parity: 0 off, 1 auto, 2..32 fixed group size
+ *   HELLO[:<ver>]            ask for EVT_CAPS
+ *   SESS:<codec>:<frame>:<mode>  pick the session (numeric PROTO_CODEC_* / PROTO_SESS_*)
+ *   BENCH[:<sec>[:<bytes>[:<frame>[:<gap_ms>[:<inflight>]]]]]
+ *                            synthetic BENCH_DATA stream; omitted or 0 = default
+ *
  * @param buf Raw bytes from RX characteristic
  * @param len Length
- * @param out_rec_sec Output: new rec seconds for SETREC (1..10)
- * @param out_rec_id Output: rec id for GET/DONE
- * @param out_offset Output: offset for GET
- * @param out_len Output: requested length for GET
+ * @param out Output arguments (may be NULL)
  * @return Parsed command type
  */
-proto_cmd_t proto_parse_rx_cmd(const uint8_t *buf, size_t len,
-                               int *out_rec_sec,
-                               uint16_t *out_rec_id,
-                               uint32_t *out_offset,
-                               uint16_t *out_len);
+proto_cmd_t proto_parse_rx_cmd(const uint8_t *buf, size_t len, proto_rx_args_t *out);
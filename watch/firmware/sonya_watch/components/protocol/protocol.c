@@ -42,28 +42,85 @@ size_t proto_parse_header(const uint8_t *buf, size_t buf_len,
     return total;
 }
 
-proto_cmd_t proto_parse_rx_cmd(const uint8_t *buf, size_t len,
-                               int *out_rec_sec,
-                               uint16_t *out_rec_id,
-                               uint32_t *out_offset,
-                               uint16_t *out_len)
+uint8_t proto_crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (uint8_t)(crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1);
+        }
+    }
+    return crc;
+}
+
+size_t proto_build_header_v2(uint8_t *buf, size_t buf_size, uint8_t type, uint8_t sid,
+                             uint32_t seq, uint16_t payload_len, bool hcrc)
+{
+    size_t n = PROTO_V2_HEADER_SIZE + (hcrc ? 1 : 0);
+    if (buf == NULL || buf_size < n || type > PROTO_V2_TYPE_MASK || sid >= PROTO_SID_COUNT) {
+        return 0;
+    }
+    buf[0] = (uint8_t)((sid << PROTO_V2_SID_SHIFT) | type);
+    buf[1] = (uint8_t)(seq & 0xFF);
+    buf[2] = (uint8_t)((seq >> 8) & 0xFF);
+    buf[3] = (uint8_t)((seq >> 16) & 0xFF);
+    buf[4] = (uint8_t)((seq >> 24) & 0xFF);
+    buf[5] = (uint8_t)(payload_len & 0xFF);
+    buf[6] = (uint8_t)(payload_len >> 8);
+    if (hcrc) buf[7] = proto_crc8(buf, PROTO_V2_HEADER_SIZE);
+    return n;
+}
+
+size_t proto_parse_header_v2(const uint8_t *buf, size_t buf_len, bool hcrc, proto_hdr_v2_t *out)
+{
+    size_t hlen = PROTO_V2_HEADER_SIZE + (hcrc ? 1 : 0);
+    if (buf == NULL || buf_len < hlen) {
+        return 0;
+    }
+    if (hcrc && proto_crc8(buf, PROTO_V2_HEADER_SIZE) != buf[PROTO_V2_HEADER_SIZE]) {
+        return 0;
+    }
+    uint16_t plen = (uint16_t)buf[5] | ((uint16_t)buf[6] << 8);
+    if (buf_len < hlen + plen) {
+        return 0;
+    }
+    if (out) {
+        out->type = buf[0] & PROTO_V2_TYPE_MASK;
+        out->sid = buf[0] >> PROTO_V2_SID_SHIFT;
+        out->seq = (uint32_t)buf[1] | ((uint32_t)buf[2] << 8) |
+                   ((uint32_t)buf[3] << 16) | ((uint32_t)buf[4] << 24);
+        out->len = plen;
+    }
+    return hlen + plen;
+}
+
+proto_cmd_t proto_parse_rx_cmd(const uint8_t *buf, size_t len, proto_rx_args_t *out)
 {
     if (!buf || len == 0) return PROTO_CMD_NONE;
 
-    char cmd[32];
-    size_t n = len < sizeof(cmd) - 1 ? len : sizeof(cmd) - 1;
+    proto_rx_args_t tmp;
+    if (!out) out = &tmp;
+    memset(out, 0, sizeof(*out));
+
+    // NACK range lists are the longest ASCII commands. A cut one would parse as
+    // valid but shorter numbers, so anything that does not fit is unknown.
+    char cmd[PROTO_ASCII_CMD_MAX + 1];
+    if (len > PROTO_ASCII_CMD_MAX) return PROTO_CMD_NONE;
+    size_t n = len;
     memcpy(cmd, buf, n);
     cmd[n] = '\0';
 
     if (n >= 4 && memcmp(cmd, "PING", 4) == 0) return PROTO_CMD_PING;
     if (n >= 4 && memcmp(cmd, "BATT", 4) == 0) return PROTO_CMD_BATT;
+    if (n >= 5 && memcmp(cmd, "STATS", 5) == 0) return PROTO_CMD_STATS;
     /* Accept "REC" with optional trailing newline/whitespace from BLE apps */
     if (n >= 3 && memcmp(cmd, "REC", 3) == 0) return PROTO_CMD_REC;
 
     if (n >= 8 && memcmp(cmd, "SETREC:", 7) == 0) {
         int v = atoi(cmd + 7);
         if (v >= 1 && v <= 10) {
-            if (out_rec_sec) *out_rec_sec = v;
+            out->rec_sec = v;
             return PROTO_CMD_SETREC;
         }
     }
@@ -80,19 +137,278 @@ proto_cmd_t proto_parse_rx_cmd(const uint8_t *buf, size_t len,
         p = end + 1;
         unsigned long l = strtoul(p, &end, 10);
         if (l == 0 || l > 65535UL) return PROTO_CMD_NONE;
-        if (out_rec_id) *out_rec_id = (uint16_t)rec_id;
-        if (out_offset) *out_offset = (uint32_t)off;
-        if (out_len) *out_len = (uint16_t)l;
+        out->rec_id = (uint16_t)rec_id;
+        out->offset = (uint32_t)off;
+        out->len = (uint32_t)l;
         return PROTO_CMD_GET;
     }
 
+    // XGET:<recId>:<offset>
+    if (n >= 5 && memcmp(cmd, "XGET:", 5) == 0) {
+        const char *p = cmd + 5;
+        char *end = NULL;
+        unsigned long rec_id = strtoul(p, &end, 10);
+        if (!end || *end != ':') return PROTO_CMD_NONE;
+        p = end + 1;
+        unsigned long off = strtoul(p, &end, 10);
+        if (end == p) return PROTO_CMD_NONE;
+        out->rec_id = (uint16_t)rec_id;
+        out->offset = (uint32_t)off;
+        return PROTO_CMD_XGET;
+    }
+
+    // RESUME:<recId>:<hwm>
+    if (n >= 7 && memcmp(cmd, "RESUME:", 7) == 0) {
+        const char *p = cmd + 7;
+        char *end = NULL;
+        unsigned long rec_id = strtoul(p, &end, 10);
+        if (!end || *end != ':') return PROTO_CMD_NONE;
+        p = end + 1;
+        unsigned long hwm = strtoul(p, &end, 10);
+        if (end == p) return PROTO_CMD_NONE;
+        out->rec_id = (uint16_t)rec_id;
+        out->offset = (uint32_t)hwm;
+        return PROTO_CMD_RESUME;
+    }
+
+    // NACK:<recId>:<off>+<len>[,<off>+<len>...]
+    if (n >= 5 && memcmp(cmd, "NACK:", 5) == 0) {
+        const char *p = cmd + 5;
+        char *end = NULL;
+        unsigned long rec_id = strtoul(p, &end, 10);
+        if (!end || *end != ':') return PROTO_CMD_NONE;
+        p = end;
+        while ((*p == ':' || *p == ',') && out->n_ranges < PROTO_NACK_MAX) {
+            unsigned long off = strtoul(p + 1, &end, 10);
+            if (end == p + 1 || *end != '+') return PROTO_CMD_NONE;
+            p = end + 1;
+            unsigned long rlen = strtoul(p, &end, 10);
+            if (end == p) return PROTO_CMD_NONE;
+            p = end;
+            if (rlen == 0) continue;
+            out->ranges[out->n_ranges++] = (proto_range_t){ (uint32_t)off, (uint32_t)rlen };
+        }
+        if (out->n_ranges == 0) return PROTO_CMD_NONE;
+        out->rec_id = (uint16_t)rec_id;
+        return PROTO_CMD_NACK;
+    }
+
+    // FEC:<mode>[:<lossPpm>]
+    if (n >= 5 && memcmp(cmd, "FEC:", 4) == 0) {
+        char *end = NULL;
+        unsigned long mode = strtoul(cmd + 4, &end, 10);
+        if (end == cmd + 4 || mode > PROTO_FEC_K_MAX) return PROTO_CMD_NONE;
+        unsigned long ppm = 0;
+        if (*end == ':') ppm = strtoul(end + 1, NULL, 10);
+        out->fec_mode = (uint8_t)mode;
+        out->loss_ppm = (uint32_t)(ppm > 1000000UL ? 1000000UL : ppm);
+        return PROTO_CMD_FEC;
+    }
+
+    // CODEC:<PCM|ADPCM|OPUS|LOSSLESS>
+    if (n >= 6 && memcmp(cmd, "CODEC:", 6) == 0) {
+        if (n >= 11 && memcmp(cmd + 6, "ADPCM", 5) == 0) {
+            out->codec = PROTO_CODEC_IMA_ADPCM;
+        } else if (n >= 10 && memcmp(cmd + 6, "OPUS", 4) == 0) {
+            out->codec = PROTO_CODEC_OPUS;
+        } else if (n >= 14 && memcmp(cmd + 6, "LOSSLESS", 8) == 0) {
+            out->codec = PROTO_CODEC_LOSSLESS;
+        } else if (n >= 9 && memcmp(cmd + 6, "PCM", 3) == 0) {
+            out->codec = PROTO_CODEC_PCM16;
+        } else {
+            return PROTO_CMD_NONE;
+        }
+        return PROTO_CMD_CODEC;
+    }
+
+    // HELLO[:<ver>]
+    if (n >= 5 && memcmp(cmd, "HELLO", 5) == 0) {
+        unsigned long ver = 1;
+        if (cmd[5] == ':') {
+            char *end = NULL;
+            ver = strtoul(cmd + 6, &end, 10);
+            if (end == cmd + 6) return PROTO_CMD_NONE;
+        }
+        out->ver = (uint8_t)(ver > 0xFF ? 0xFF : ver);
+        return PROTO_CMD_HELLO;
+    }
+
+    // SESS:<codec>:<frame>:<mode>
+    if (n >= 5 && memcmp(cmd, "SESS:", 5) == 0) {
+        unsigned long v[3];
+        const char *p = cmd + 4;
+        for (int i = 0; i < 3; i++) {
+            char *end = NULL;
+            if (*p != ':') return PROTO_CMD_NONE;
+            v[i] = strtoul(p + 1, &end, 10);
+            if (end == p + 1) return PROTO_CMD_NONE;
+            p = end;
+        }
+        if (v[0] > 0xFF || v[1] > 0xFFFF || v[2] > 0xFF) return PROTO_CMD_NONE;
+        out->codec = (uint8_t)v[0];
+        out->frame = (uint16_t)v[1];
+        out->mode  = (uint8_t)v[2];
+        return PROTO_CMD_SESS;
+    }
+
+    // BENCH[:<sec>[:<bytes>[:<frame>[:<gapMs>[:<inflight>]]]]]
+    if (n >= 5 && memcmp(cmd, "BENCH", 5) == 0) {
+        unsigned long v[5] = { 0 };
+        const char *p = cmd + 5;
+        for (int i = 0; i < 5 && *p == ':'; i++) {
+            char *end = NULL;
+            v[i] = strtoul(p + 1, &end, 10);
+            if (end == p + 1) return PROTO_CMD_NONE;
+            p = end;
+        }
+        out->bench_sec      = (uint16_t)(v[0] > 600 ? 600 : v[0]);
+        out->bench_bytes    = (uint32_t)v[1];
+        out->bench_frame    = (uint16_t)(v[2] > 0xFFFF ? 0xFFFF : v[2]);
+        out->bench_gap_ms   = (uint16_t)(v[3] > 1000 ? 1000 : v[3]);
+        out->bench_inflight = (uint8_t)(v[4] > 0xFF ? 0xFF : v[4]);
+        return PROTO_CMD_BENCH;
+    }
+
+    // XACK:<recId>:<cum>:<sackHex>
+    if (n >= 5 && memcmp(cmd, "XACK:", 5) == 0) {
+        const char *p = cmd + 5;
+        char *end = NULL;
+        unsigned long rec_id = strtoul(p, &end, 10);
+        if (!end || *end != ':') return PROTO_CMD_NONE;
+        p = end + 1;
+        unsigned long cum = strtoul(p, &end, 10);
+        if (!end || *end != ':' || cum > 65535UL) return PROTO_CMD_NONE;
+        p = end + 1;
+        unsigned long sack = strtoul(p, &end, 16);
+        out->rec_id = (uint16_t)rec_id;
+        out->ack_cum = (uint16_t)cum;
+        out->ack_sack = (uint32_t)sack;
+        return PROTO_CMD_XACK;
+    }
+
     // DONE:<recId>
     if (n >= 5 && memcmp(cmd, "DONE:", 5) == 0) {
         const char *p = cmd + 5;
         char *end = NULL;
         unsigned long rec_id = strtoul(p, &end, 10);
-        if (out_rec_id) *out_rec_id = (uint16_t)rec_id;
+        out->rec_id = (uint16_t)rec_id;
         return PROTO_CMD_DONE;
     }
     return PROTO_CMD_NONE;
 }
+
+static uint16_t rd16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* NACK payload after [rec_id][form]: either form becomes out->ranges; past PROTO_NACK_MAX is dropped. */
+static bool parse_nack_ranges(const uint8_t *p, uint16_t plen, uint8_t form, proto_rx_args_t *out)
+{
+    if (form == PROTO_NACK_RANGES) {
+        for (uint16_t i = 0; i + 8 <= plen && out->n_ranges < PROTO_NACK_MAX; i += 8) {
+            uint32_t rlen = rd32(p + i + 4);
+            if (rlen) out->ranges[out->n_ranges++] = (proto_range_t){ rd32(p + i), rlen };
+        }
+        return out->n_ranges > 0;
+    }
+    if (form != PROTO_NACK_BITMAP || plen < 6) return false;
+    uint32_t base = rd32(p);
+    uint16_t unit = rd16(p + 4);
+    if (unit == 0) return false;
+    uint32_t nbits = (uint32_t)(plen - 6) * 8;
+    for (uint32_t i = 0; i < nbits && out->n_ranges < PROTO_NACK_MAX; i++) {
+        if (!(p[6 + i / 8] & (1U << (i % 8)))) continue;
+        uint32_t j = i + 1;
+        while (j < nbits && (p[6 + j / 8] & (1U << (j % 8)))) j++;
+        out->ranges[out->n_ranges++] = (proto_range_t){ base + i * unit, (j - i) * unit };
+        i = j;
+    }
+    return out->n_ranges > 0;
+}
+
+proto_cmd_t proto_parse_rx_bin(const uint8_t *buf, size_t len, proto_rx_args_t *out,
+                               uint16_t *out_req, size_t *out_used)
+{
+    uint8_t type = 0;
+    uint16_t req = 0, plen = 0;
+    size_t used = proto_parse_header(buf, len, &type, &req, &plen);
+    if (out_used) *out_used = used;
+    if (out_req) *out_req = req;
+    if (used == 0 || type < PROTO_BCMD_BASE) return PROTO_CMD_NONE;
+
+    proto_rx_args_t tmp;
+    if (!out) out = &tmp;
+    memset(out, 0, sizeof(*out));
+    const uint8_t *p = buf + PROTO_FRAME_HEADER_SIZE;
+    proto_cmd_t cmd = (proto_cmd_t)(type - PROTO_BCMD_BASE);
+
+    switch (cmd) {
+    case PROTO_CMD_PING:
+    case PROTO_CMD_REC:
+    case PROTO_CMD_BATT:
+    case PROTO_CMD_STATS:
+        return cmd;
+    case PROTO_CMD_SETREC:
+        if (plen < 1 || p[0] < 1 || p[0] > 10) return PROTO_CMD_NONE;
+        out->rec_sec = p[0];
+        return cmd;
+    case PROTO_CMD_GET:
+        if (plen < 10) return PROTO_CMD_NONE;
+        out->rec_id = rd16(p);
+        out->offset = rd32(p + 2);
+        out->len = rd32(p + 6);
+        return out->len ? cmd : PROTO_CMD_NONE;
+    case PROTO_CMD_DONE:
+        if (plen < 2) return PROTO_CMD_NONE;
+        out->rec_id = rd16(p);
+        return cmd;
+    case PROTO_CMD_XGET:
+    case PROTO_CMD_RESUME:
+        if (plen < 6) return PROTO_CMD_NONE;
+        out->rec_id = rd16(p);
+        out->offset = rd32(p + 2);
+        return cmd;
+    case PROTO_CMD_XACK:
+        if (plen < 8) return PROTO_CMD_NONE;
+        out->rec_id = rd16(p);
+        out->ack_cum = rd16(p + 2);
+        out->ack_sack = rd32(p + 4);
+        return cmd;
+    case PROTO_CMD_BENCH:
+        if (plen < 11) return PROTO_CMD_NONE;
+        out->bench_sec      = rd16(p) > 600 ? 600 : rd16(p);
+        out->bench_bytes    = rd32(p + 2);
+        out->bench_frame    = rd16(p + 6);
+        out->bench_gap_ms   = rd16(p + 8) > 1000 ? 1000 : rd16(p + 8);
+        out->bench_inflight = p[10];
+        return cmd;
+    case PROTO_CMD_CODEC:
+        if (plen < 1) return PROTO_CMD_NONE;
+        out->codec = p[0];
+        return cmd;
+    case PROTO_CMD_HELLO:
+        out->ver = plen >= 1 ? p[0] : 1;
+        return cmd;
+    case PROTO_CMD_SESS:
+        if (plen < 4) return PROTO_CMD_NONE;
+        out->codec = p[0];
+        out->frame = rd16(p + 1);
+        out->mode  = p[3];
+        return cmd;
+    case PROTO_CMD_NACK:
+        if (plen < 3) return PROTO_CMD_NONE;
+        out->rec_id = rd16(p);
+        return parse_nack_ranges(p + 3, (uint16_t)(plen - 3), p[2], out) ? cmd : PROTO_CMD_NONE;
+    case PROTO_CMD_FEC:
+        if (plen < 1 || p[0] > PROTO_FEC_K_MAX) return PROTO_CMD_NONE;
+        out->fec_mode = p[0];
+        out->loss_ppm = plen >= 5 ? rd32(p + 1) : 0;
+        if (out->loss_ppm > 1000000) out->loss_ppm = 1000000;
+        return cmd;
+    default:
+        return PROTO_CMD_NONE;
+    }
+}
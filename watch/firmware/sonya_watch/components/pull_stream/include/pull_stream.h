@@ -1,12 +1,73 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "esp_err.h"
+#include "protocol.h"
 
 esp_err_t pull_stream_init(void);
 
 void pull_stream_start_live(uint16_t rec_id);
 void pull_stream_stop_live(void);
 
-void pull_stream_handle_get(uint16_t rec_id, uint32_t off, uint16_t want_len);
+/*
+ * Session codec for AUDIO_DATA (GET, live): PROTO_CODEC_PCM16, PROTO_CODEC_IMA_ADPCM
+ * (AUDIO_ADPCM frames, offsets stay in PCM bytes) or PROTO_CODEC_OPUS (live only,
+ * AUDIO_OPUS; GET stays PCM). XGET always sends PCM. Unsupported codecs are ignored.
+ */
+void    pull_stream_set_codec(uint8_t codec);
+uint8_t pull_stream_codec(void);
+
+/*
+ * HELLO/SESS: send_caps() answers HELLO with EVT_CAPS; set_session() applies the phone's
+ * pick (codec, frame cap, live or pull) and returns false if it is not supported.
+ * reset_session() restores the pre-HELLO defaults for a new connection.
+ */
+void pull_stream_send_caps(uint8_t phone_ver);
+bool pull_stream_set_session(const proto_session_t *sess);
+void pull_stream_reset_session(void);
+void pull_stream_get_session(proto_session_t *out);
+
+/*
+ * Command handlers return a PROTO_ST_* status (PROTO_ST_OK once the job is queued);
+ * the caller reports failures to the phone.
+ */
+int  pull_stream_handle_get(uint16_t rec_id, uint32_t off, uint32_t want_len);
 void pull_stream_handle_done(uint16_t rec_id);
+
+// Windowed selective-repeat transfer of a committed recording (AUDIO_WIN frames).
+int  pull_stream_handle_xget(uint16_t rec_id, uint32_t off);
+void pull_stream_handle_xack(uint16_t rec_id, uint16_t cum, uint32_t sack);
+
+/*
+ * Reconnect: announce() sends EVT_REC_INFO for a recording the phone may not have in
+ * full; handle_resume() continues it from the phone's high-water mark (live stream or
+ * a GET of the rest once committed).
+ */
+void pull_stream_announce(void);
+int  pull_stream_handle_resume(uint16_t rec_id, uint32_t hwm);
+
+/*
+ * NACK: resend several missing ranges as one job, sorted by offset and merged, as
+ * AUDIO_DATA on the bulk class. During live the ranges go out between live frames.
+ */
+int  pull_stream_handle_nack(uint16_t rec_id, const proto_range_t *ranges, int n);
+
+/*
+ * Live FEC: an AUDIO_FEC parity frame after every k PCM live frames over GATT, so the
+ * phone rebuilds a single lost frame without a NACK. mode PROTO_FEC_AUTO sizes k from
+ * the loss estimate (loss_ppm from the phone, if non-zero, and live bytes it NACKs).
+ * Off until set, and again on a new connection. Returns the group size now in use, 0 = off.
+ */
+uint8_t pull_stream_set_fec(uint8_t mode, uint32_t loss_ppm);
+
+// Synthetic throughput test: BENCH_DATA frames through the normal notify path, no mic or rec_store.
+typedef struct {
+    uint16_t sec;       // 0 = until bytes (both 0: 10 s)
+    uint32_t bytes;     // 0 = until sec
+    uint16_t frame;     // pattern bytes per frame, 0 = as many as the MTU allows
+    uint16_t gap_ms;    // pacing between frames, 0 = back-to-back
+    uint8_t  inflight;  // notifications in flight, 0 = BLE_TX_INFLIGHT_MAX
+} pull_stream_bench_t;
+
+int  pull_stream_handle_bench(const pull_stream_bench_t *cfg);
@@ -0,0 +1,259 @@
+/**
+ * @file live_opus.c
+ * @brief Opus (esp_audio_codec, fixed point) for the live stream
+ *
+ * One 20 ms packet per AUDIO_OPUS frame. The encoder runs on its own task pinned
+ * to CONFIG_LIVE_OPUS_CORE, away from the NimBLE host, and only while a live
+ * stream is active. The bitrate follows the LIVE send queue: it drops while
+ * frames pile up there and creeps back once the queue has stayed empty.
+ */
+
+#include "live_opus.h"
+#include "rec_store.h"
+#include "sonya_ble.h"
+#include "protocol.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "live_opus";
+
+#if CONFIG_LIVE_OPUS_ENABLE
+
+#include "esp_opus_enc.h"
+
+#if CONFIG_LIVE_OPUS_BITRATE_MIN > CONFIG_LIVE_OPUS_BITRATE_MAX
+#error "LIVE_OPUS_BITRATE_MIN must not exceed LIVE_OPUS_BITRATE_MAX"
+#endif
+
+#define OPUS_Q_HIGH      2      // LIVE frames queued: the link is falling behind
+#define OPUS_CALM_FRAMES 25     // packets with an empty queue before stepping up (500 ms)
+#define OPUS_STEP_DOWN   2000
+#define OPUS_STEP_UP     1000
+// Largest packet: CBR at the top bitrate, 20 ms.
+#define OPUS_PACKET_MAX  (CONFIG_LIVE_OPUS_BITRATE_MAX / 400)
+
+typedef struct {
+    uint32_t packets;
+    uint32_t bytes;
+    uint32_t enc_us;
+    uint32_t enc_max_us;
+    uint32_t enc_fail;
+    uint32_t steps_down;
+    uint32_t steps_up;
+    int      bitrate_min;
+} opus_stats_t;
+
+static void *s_enc;
+static int s_in_size;
+static int s_out_size;
+static uint8_t *s_in;
+static uint8_t *s_out;
+static int s_bitrate;
+static int s_calm;
+static opus_stats_t s_st;
+
+/* Last encoded packet, kept until it is queued: a retry must not feed the encoder twice. */
+static bool     s_pend;
+static uint32_t s_pend_off;
+static uint16_t s_pend_samples;
+static uint32_t s_pend_bytes;
+
+static TaskHandle_t s_task;
+static TaskHandle_t s_waiter;
+static void (*s_loop)(void);
+
+static void enc_close(void)
+{
+    if (s_enc) esp_opus_enc_close(s_enc);
+    s_enc = NULL;
+    free(s_in);
+    free(s_out);
+    s_in = NULL;
+    s_out = NULL;
+}
+
+static bool enc_open(void)
+{
+    esp_opus_enc_config_t cfg = ESP_OPUS_ENC_CONFIG_DEFAULT();
+    cfg.sample_rate      = CONFIG_AUDIO_SR;
+    cfg.channel          = ESP_AUDIO_MONO;
+    cfg.bits_per_sample  = ESP_AUDIO_BIT16;
+    cfg.bitrate          = CONFIG_LIVE_OPUS_BITRATE_MAX;
+    cfg.frame_duration   = ESP_OPUS_ENC_FRAME_DURATION_20_MS;
+    cfg.application_mode = ESP_OPUS_ENC_APPLICATION_VOIP;   // SILK at wideband rates
+    cfg.complexity       = CONFIG_LIVE_OPUS_COMPLEXITY;
+    cfg.enable_fec       = false;
+    cfg.enable_dtx       = false;
+    cfg.enable_vbr       = false;
+
+    esp_audio_err_t rc = esp_opus_enc_open(&cfg, sizeof(cfg), &s_enc);
+    if (rc != ESP_AUDIO_ERR_OK) {
+        ESP_LOGE(TAG, "enc open rc=%d", (int)rc);
+        s_enc = NULL;
+        return false;
+    }
+    if (esp_opus_enc_get_frame_size(s_enc, &s_in_size, &s_out_size) != ESP_AUDIO_ERR_OK) {
+        s_in_size = 0;
+    }
+    s_in = s_in_size > 0 ? malloc((size_t)s_in_size) : NULL;
+    s_out = s_out_size > 0 ? malloc((size_t)s_out_size) : NULL;
+    if (!s_in || !s_out) {
+        ESP_LOGE(TAG, "no buffers (in=%d out=%d)", s_in_size, s_out_size);
+        enc_close();
+        return false;
+    }
+    s_bitrate = CONFIG_LIVE_OPUS_BITRATE_MAX;
+    s_calm = 0;
+    s_pend = false;
+    memset(&s_st, 0, sizeof(s_st));
+    s_st.bitrate_min = s_bitrate;
+    return true;
+}
+
+static void adapt_bitrate(void)
+{
+    int depth = sonya_ble_tx_queue_depth(SONYA_TX_LIVE);
+    int br = s_bitrate;
+    if (depth >= OPUS_Q_HIGH) {
+        s_calm = 0;
+        br -= OPUS_STEP_DOWN;
+    } else if (depth == 0 && ++s_calm >= OPUS_CALM_FRAMES) {
+        s_calm = 0;
+        br += OPUS_STEP_UP;
+    }
+    if (br < CONFIG_LIVE_OPUS_BITRATE_MIN) br = CONFIG_LIVE_OPUS_BITRATE_MIN;
+    if (br > CONFIG_LIVE_OPUS_BITRATE_MAX) br = CONFIG_LIVE_OPUS_BITRATE_MAX;
+    if (br == s_bitrate || esp_opus_enc_set_bitrate(s_enc, br) != ESP_AUDIO_ERR_OK) return;
+    if (br < s_bitrate) s_st.steps_down++;
+    else s_st.steps_up++;
+    s_bitrate = br;
+    if (br < s_st.bitrate_min) s_st.bitrate_min = br;
+}
+
+static void opus_task(void *arg)
+{
+    (void)arg;
+    s_task = xTaskGetCurrentTaskHandle();
+    s_loop();
+    s_task = NULL;
+    xTaskNotifyGive(s_waiter);
+    vTaskDelete(NULL);
+}
+
+bool live_opus_run(void (*loop)(void))
+{
+    if (!loop) return false;
+    uint16_t room = sonya_ble_max_payload();
+    if (PROTO_AUDIO_OPUS_HDR + OPUS_PACKET_MAX > room) {
+        ESP_LOGW(TAG, "%d-byte packets do not fit a %u-byte frame, live goes as PCM",
+                 OPUS_PACKET_MAX, (unsigned)room);
+        return false;
+    }
+    if (!enc_open()) return false;
+    s_loop = loop;
+    s_waiter = xTaskGetCurrentTaskHandle();
+    if (xTaskCreatePinnedToCore(opus_task, "live_opus", CONFIG_LIVE_OPUS_STACK, NULL, 5, NULL,
+                                CONFIG_LIVE_OPUS_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "task create failed (stack %d)", CONFIG_LIVE_OPUS_STACK);
+        enc_close();
+        return false;
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    ESP_LOGI(TAG, "packets=%lu avg=%luB enc avg=%luus max=%luus fail=%lu bitrate=%d..%d steps down=%lu up=%lu",
+             (unsigned long)s_st.packets,
+             (unsigned long)(s_st.packets ? s_st.bytes / s_st.packets : 0),
+             (unsigned long)(s_st.packets ? s_st.enc_us / s_st.packets : 0),
+             (unsigned long)s_st.enc_max_us, (unsigned long)s_st.enc_fail,
+             s_st.bitrate_min, CONFIG_LIVE_OPUS_BITRATE_MAX,
+             (unsigned long)s_st.steps_down, (unsigned long)s_st.steps_up);
+    enc_close();
+    return true;
+}
+
+bool live_opus_active(void)
+{
+    return s_enc && s_task && xTaskGetCurrentTaskHandle() == s_task;
+}
+
+int live_opus_frame_pcm(void)
+{
+    return s_in_size;
+}
+
+int live_opus_send(uint16_t rec_id, uint32_t off, int pcm_len)
+{
+    if (!s_pend || s_pend_off != off) {
+        if (pcm_len > s_in_size) pcm_len = s_in_size;
+        int got = rec_store_read_rec(rec_id, off, s_in, (size_t)pcm_len);
+        if (got < 0) return -1;
+        got &= ~1;
+        if (got == 0) return 0;
+        // Only the tail of a recording is short; Opus needs whole frames.
+        if (got < s_in_size) memset(s_in + got, 0, (size_t)(s_in_size - got));
+
+        adapt_bitrate();
+        esp_audio_enc_in_frame_t in = { .buffer = s_in, .len = (uint32_t)s_in_size };
+        esp_audio_enc_out_frame_t out = { .buffer = s_out, .len = (uint32_t)s_out_size };
+        int64_t t0 = esp_timer_get_time();
+        esp_audio_err_t rc = esp_opus_enc_process(s_enc, &in, &out);
+        uint32_t us = (uint32_t)(esp_timer_get_time() - t0);
+        s_st.enc_us += us;
+        if (us > s_st.enc_max_us) s_st.enc_max_us = us;
+        if (rc != ESP_AUDIO_ERR_OK) {
+            // Skip the packet; the phone can GET the gap as PCM.
+            s_st.enc_fail++;
+            return got;
+        }
+        s_pend = true;
+        s_pend_off = off;
+        s_pend_samples = (uint16_t)(got / 2);
+        s_pend_bytes = out.encoded_bytes;
+    }
+
+    uint8_t hdr[PROTO_AUDIO_OPUS_HDR] = {
+        (uint8_t)(rec_id & 0xFF), (uint8_t)(rec_id >> 8),
+        (uint8_t)(off & 0xFF), (uint8_t)((off >> 8) & 0xFF),
+        (uint8_t)((off >> 16) & 0xFF), (uint8_t)((off >> 24) & 0xFF),
+        (uint8_t)(s_pend_samples & 0xFF), (uint8_t)(s_pend_samples >> 8),
+    };
+    sonya_ble_seg_t seg[2] = { { hdr, sizeof(hdr) }, { s_out, (uint16_t)s_pend_bytes } };
+    int rc = sonya_ble_send_frame_segs(SONYA_TX_LIVE, PROTO_AUDIO_OPUS, seg, 2);
+    if (rc == -1 && sonya_ble_is_connected()) {
+        // Refused, not busy (larger than the frame payload): retrying would never succeed.
+        ESP_LOGE(TAG, "packet of %lu bytes refused, live stops", (unsigned long)s_pend_bytes);
+        s_pend = false;
+        return -1;
+    }
+    if (rc != 0) return -2;   // queue full, or the link dropped: live_loop waits and retries
+    s_pend = false;
+    s_st.packets++;
+    s_st.bytes += s_pend_bytes;
+    return (int)s_pend_samples * 2;
+}
+
+#else /* !CONFIG_LIVE_OPUS_ENABLE */
+
+bool live_opus_run(void (*loop)(void))
+{
+    (void)loop;
+    ESP_LOGW(TAG, "Opus disabled (LIVE_OPUS_ENABLE)");
+    return false;
+}
+
+bool live_opus_active(void) { return false; }
+
+int live_opus_frame_pcm(void) { return 0; }
+
+int live_opus_send(uint16_t rec_id, uint32_t off, int pcm_len)
+{
+    (void)rec_id; (void)off; (void)pcm_len;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+/**
+ * Internal: Opus encoding of the live stream (CODEC:OPUS) for pull_stream.
+ * live_opus_run() opens the encoder and runs pull_stream's live loop on
+ * CONFIG_LIVE_OPUS_CORE; inside it, live_opus_send() replaces send_audio_frame().
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// false (loop not run) if Opus is disabled or the encoder/task could not be set up.
+bool live_opus_run(void (*loop)(void));
+// True on the task live_opus_run() started.
+bool live_opus_active(void);
+// PCM bytes per packet (20 ms).
+int  live_opus_frame_pcm(void);
+// Encode and queue one packet from [off, off + pcm_len); send_store_frame() return convention.
+int  live_opus_send(uint16_t rec_id, uint32_t off, int pcm_len);
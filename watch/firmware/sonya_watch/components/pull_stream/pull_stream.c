@@ -2,44 +2,701 @@
 #include "rec_store.h"
 #include "sonya_ble.h"
 #include "protocol.h"
+#include "adpcm.h"
+#include "lossless.h"
+#include "live_opus.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "sdkconfig.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static const char *TAG = "pull_stream";
 
-#define AUDIO_FRAME_MAX 242
 #define STREAM_STACK    8192
 #define QUEUE_LEN       4
+#define ACK_QUEUE_LEN   8
+
+/* Windowed transfer (XGET/XACK) */
+#define XFER_SLOTS      64
+#define XFER_WIN_MIN    4
+/* Random BLE drops are expected; shrink the window only once loss is persistent. */
+#define XFER_LOSS_BACKOFF_PPM 100000
+#define XFER_RTO_INIT_MS 300
+#define XFER_RTO_MIN_MS  60
+#define XFER_RTO_MAX_MS  2000
+#define XFER_IDLE_MS     5000
+#define XFER_BUSY_MS     30      // TX queue full: wait this long before the frame is tried again
+#define XFER_FRAMES_MAX  0xFFFF  // fseq is u16 on the wire; a longer XGET is served in part
+#define BULK_IDLE_MS     400     // no GET/XGET for this long -> BULK conn params give way to LINGER
+#define BENCH_DEFAULT_SEC 10
+/* ADPCM frames: nibble bytes per frame (caps CoC SDUs) and samples of step-size warm-up */
+#define ADPCM_NIB_MAX    512
+#define ADPCM_WARMUP     32
+#define LIVE_RESUME_WAIT_MS 1500 // after a reconnect, wait this long for RESUME before going on
+#define TX_ROOM_WAIT_MS  2000    // wait for TX mbufs before pinning rec_store blocks
+#define SESS_FRAME_MIN   64      // smallest SESS frame cap honoured
+#define ANCHOR_REPEAT    128     // v2: re-send EVT_STREAM this often in case one was lost
+/* Live FEC: auto k aims for FEC_TARGET_PPM expected losses per group; the loss estimate
+ * folds in live bytes NACKed per FEC_SAMPLE_BYTES of live audio sent. */
+#define FEC_K_AUTO_MIN   4
+#define FEC_TARGET_PPM   100000
+#define FEC_SAMPLE_BYTES 65536
+
+#if CONFIG_XFER_WIN_MAX > XFER_SLOTS
+#error "XFER_WIN_MAX must not exceed XFER_SLOTS"
+#endif
+
+typedef enum {
+    JOB_GET = 0,
+    JOB_XFER,
+    JOB_BENCH,
+    JOB_NACK,               /* ranges wait in s_nack_queue */
+} job_kind_t;
 
 typedef struct {
+    job_kind_t kind;
     uint16_t rec_id;
     uint32_t off;
-    uint16_t want_len;
-} get_req_t;
+    uint32_t want_len;      /* GET: up to 65535; RESUME: the rest of the recording */
+} job_t;
+
+typedef struct {
+    uint16_t rec_id;
+    uint16_t cum;
+    uint32_t sack;
+} xack_t;
+
+/* NACK job: sorted, disjoint ranges, served front to back */
+typedef struct {
+    uint16_t rec_id;
+    uint8_t  n;
+    uint8_t  cur;           /* range being sent */
+    proto_range_t r[PROTO_NACK_MAX];
+} nack_t;
+
+#define SLOT_ACKED 0x01
+#define SLOT_LOST  0x02
+#define SLOT_RETX  0x04
+
+typedef struct {
+    uint16_t rec_id;
+    uint16_t frame_pcm;     /* fixed for the whole transfer: fseq maps to off0 + fseq * frame_pcm */
+    uint32_t off0;
+    uint32_t end;
+    uint16_t n_frames;
+    uint16_t base;          /* oldest unacked frame */
+    uint16_t next;          /* next never-sent frame */
+    uint16_t win;           /* credit: max frames in [base, next) */
+    uint16_t ai_credit;     /* acked frames toward the next +1 */
+    uint16_t recover;       /* losses below this fseq belong to the current loss round */
+    uint32_t tx_counter;
+    uint32_t tx_stamp[XFER_SLOTS];
+    uint32_t sent_ms[XFER_SLOTS];
+    uint8_t  flags[XFER_SLOTS];
+    uint32_t srtt_ms;
+    uint32_t rto_ms;
+    uint32_t loss_ppm;      /* EWMA of per-ACK loss fraction */
+    uint32_t tx_frames;
+    uint32_t retx_frames;
+    uint32_t loss_rounds;
+} xfer_t;
 
 static QueueHandle_t s_queue;
+static QueueHandle_t s_ack_queue;
+static QueueHandle_t s_nack_queue;        // depth 1: the latest NACK not yet picked up
+static nack_t        s_nack;              // the one stream_task is serving
+static bool          s_nack_busy;
 static TaskHandle_t  s_task;
 
+static uint32_t s_cpu_idle0, s_cpu_t0, s_task_rt0;
+
 static volatile uint16_t s_live_id;
 static volatile bool     s_live_active;
 static volatile bool     s_live_stop;
+static volatile bool     s_live_resume;    // RESUME arrived for the live recording
+static volatile uint32_t s_live_resume_off;
+static pull_stream_bench_t s_bench;
+/* BENCH_DATA payloads are slices of this; any offset has a full notification after it. */
+static uint8_t           s_bench_pat[PROTO_BENCH_PERIOD + 512];
+static volatile uint8_t  s_codec = PROTO_CODEC_PCM16;
+static volatile uint16_t s_frame_max;      // SESS frame cap, 0 = link maximum
+static uint8_t           s_sess_ver;       // 0 until SESS
+static uint8_t           s_sess_mode = PROTO_SESS_LIVE;
+static volatile bool     s_v2;             // v2 headers: AUDIO_DATA without [rec_id][off]
+
+/* v2 implicit offsets: the last EVT_STREAM sent on each stream. */
+typedef struct {
+    bool     valid;
+    uint16_t rec_id;
+    uint16_t frame;
+    uint16_t since;     // frames sent against this anchor
+    uint32_t base;
+    uint32_t seq0;
+} stream_anchor_t;
+static stream_anchor_t   s_anchor[PROTO_SID_COUNT];
+static int16_t          *s_ll_pcm;         // lossless: one block of PCM and its encoding, on first use
+static uint8_t          *s_ll_out;
+static uint16_t          s_ll_rec;
+static uint32_t          s_ll_b0 = UINT32_MAX;
+static size_t            s_ll_n, s_ll_len;
+static int16_t           s_adpcm_pcm[ADPCM_WARMUP + 1 + 2 * ADPCM_NIB_MAX];
+static uint8_t           s_adpcm_nib[ADPCM_NIB_MAX];
+/* Live FEC: the group being covered and the loss estimate that sizes it */
+typedef struct {
+    uint16_t rec_id;
+    uint16_t frame;
+    uint32_t off;
+    uint8_t  k;
+    uint8_t  n;          /* frames of the group sent so far */
+} fec_group_t;
+static volatile uint8_t  s_fec_mode;       // PROTO_FEC_OFF / AUTO / fixed k
+static volatile uint32_t s_fec_loss_ppm;
+static volatile uint32_t s_fec_nack_bytes; // live bytes NACKed since the last sample
+static uint32_t          s_fec_live_bytes;
+static fec_group_t       s_fec;
+static uint8_t           s_fec_par[SONYA_BLE_PAYLOAD_MAX];
+static uint32_t          s_fec_sent, s_fec_fail;
+static bool              s_bulk_phase;     // BULK conn params requested, not yet handed to LINGER
+static uint32_t          s_bulk_last_ms;
+
+/* ---- frame sizing ---- */
+
+/* Audio frame payload on a transport: the notification or CoC SDU, capped by the session frame. */
+static int link_room(bool coc)
+{
+    int n = coc ? (int)sonya_ble_coc_max_payload() : (int)sonya_ble_max_payload();
+    int cap = s_frame_max;
+    return cap && n > cap ? cap : n;
+}
+
+/* PCM bytes that fill one notification after a `hdr`-byte header; kept even (whole samples). */
+static int frame_pcm_len(uint16_t hdr)
+{
+    int n = link_room(false) - (int)hdr;
+    return n > 0 ? (n & ~1) : 0;
+}
+
+/* PCM bytes one AUDIO_ADPCM frame covers when the frame may be `room` bytes. */
+static int adpcm_frame_pcm(int room)
+{
+    int nb = room - PROTO_AUDIO_ADPCM_HDR;
+    if (nb < 0) return 0;
+    if (nb > ADPCM_NIB_MAX) nb = ADPCM_NIB_MAX;
+    return 2 * (1 + 2 * nb);
+}
+
+/* AUDIO_DATA prefix: [rec_id][off], or nothing with v2 headers (the offset follows from seq). */
+static uint16_t audio_data_hdr(void)
+{
+    return s_v2 ? 0 : PROTO_AUDIO_DATA_HDR;
+}
+
+/* PCM per audio frame on the active transport: one CoC SDU or one notification. */
+static int data_frame_pcm(void)
+{
+    if (s_codec == PROTO_CODEC_IMA_ADPCM) {
+        int n = sonya_ble_coc_is_open() ? adpcm_frame_pcm(link_room(true)) : 0;
+        return n > 0 ? n : adpcm_frame_pcm(link_room(false));
+    }
+    if (s_codec == PROTO_CODEC_LOSSLESS) return LOSSLESS_BLOCK * 2;   // a block spans several frames
+    if (sonya_ble_coc_is_open()) {
+        int n = (link_room(true) - audio_data_hdr()) & ~1;
+        if (n > 0) return n;
+    }
+    return frame_pcm_len(audio_data_hdr());
+}
+
+/* ---- frame send straight from rec_store ---- */
+
+static void store_unpin(void *arg)
+{
+    for (int n = *(int *)arg; n > 0; n--) rec_store_peek_end();
+}
+
+/*
+ * Send `hdr` + [off, off + len) of rec_id as one frame. The PCM is not staged: the
+ * frame is assembled in the NimBLE mbuf from rec_store's blocks (at most two spans,
+ * since a frame is far smaller than a block). The peek references are dropped as soon
+ * as the bytes are copied, before any wait on the TX queue or CoC credits, so a
+ * rec_store_clear() never spins behind a stalled link; the wait for mbufs happens
+ * before the peek. Returns PCM bytes sent, 0 if nothing is readable yet, -1 if rec_id
+ * is gone, -2 if the send failed.
+ */
+static int send_store_frame(sonya_tx_class_t cls, uint8_t type, const uint8_t *hdr, uint16_t hlen,
+                            uint16_t rec_id, uint32_t off, int len, bool coc)
+{
+    if (sonya_ble_tx_wait_room(TX_ROOM_WAIT_MS)) return -2;
+
+    sonya_ble_seg_t seg[3];
+    int nseg = 0;
+    if (hlen) seg[nseg++] = (sonya_ble_seg_t){ hdr, hlen };
+    int first = nseg;
+    int got = 0;
+    while (got < len && nseg < 3) {
+        const uint8_t *p;
+        int n = rec_store_peek_rec(rec_id, off + (uint32_t)got, (size_t)(len - got), &p);
+        if (n <= 0) {
+            if (n < 0 && got == 0) return -1;
+            break;
+        }
+        seg[nseg].data = p;
+        seg[nseg].len = (uint16_t)n;
+        nseg++;
+        got += n;
+    }
+    if (got == 0) return 0;
+
+    int pinned = nseg - first;
+    int rc = coc ? sonya_ble_coc_send_frame_segs_pinned(type, seg, nseg, store_unpin, &pinned)
+                 : sonya_ble_send_frame_segs_pinned(cls, type, seg, nseg, store_unpin, &pinned);
+    return rc ? -2 : got;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v & 0xFF);
+    p[1] = (uint8_t)((v >> 8)  & 0xFF);
+    p[2] = (uint8_t)((v >> 16) & 0xFF);
+    p[3] = (uint8_t)((v >> 24) & 0xFF);
+}
+
+/*
+ * One AUDIO_ADPCM frame for up to pcm_len PCM bytes from off. Each frame stands alone:
+ * sample 0 goes as-is and the step index comes from a warm-up over the samples just
+ * before it, so a re-sent window encodes to the same bytes. Same return convention as
+ * send_store_frame() (PCM bytes covered from off).
+ */
+static int send_adpcm_frame(sonya_tx_class_t cls, uint16_t rec_id, uint32_t off, int pcm_len, bool coc)
+{
+    int max = adpcm_frame_pcm(link_room(coc)) / 2;
+    if (max <= 0) return -2;
+    uint32_t s0 = off / 2;      // an odd offset starts at the sample holding it
+    int n = (int)(off - s0 * 2 + (uint32_t)pcm_len + 1) / 2;
+    if (n > max) n = max;
+    if (n <= 0) return 0;
+
+    uint32_t w = s0 < ADPCM_WARMUP ? s0 : ADPCM_WARMUP;
+    int got = rec_store_read_rec(rec_id, (s0 - w) * 2, (uint8_t *)s_adpcm_pcm, (w + (uint32_t)n) * 2);
+    if (got < 0) return -1;
+    if (got / 2 <= (int)w) return 0;
+    n = got / 2 - (int)w;
+
+    adpcm_state_t st;
+    adpcm_warmup(&st, s_adpcm_pcm, w);
+    st.pred = s_adpcm_pcm[w];
+    uint8_t hdr[PROTO_AUDIO_ADPCM_HDR] = { (uint8_t)(rec_id & 0xFF), (uint8_t)(rec_id >> 8) };
+    put_le32(hdr + 2, s0 * 2);
+    hdr[6] = (uint8_t)((uint16_t)st.pred & 0xFF);
+    hdr[7] = (uint8_t)((uint16_t)st.pred >> 8);
+    hdr[8] = st.index;
+    hdr[9] = (uint8_t)((n - 1) & 1 ? PROTO_ADPCM_F_PAD : 0);
+    size_t nb = adpcm_encode(&st, s_adpcm_pcm + w + 1, (size_t)n - 1, s_adpcm_nib);
+
+    sonya_ble_seg_t seg[2] = { { hdr, sizeof(hdr) }, { s_adpcm_nib, (uint16_t)nb } };
+    int rc = coc ? sonya_ble_coc_send_frame_segs(PROTO_AUDIO_ADPCM, seg, 2)
+                 : sonya_ble_send_frame_segs(cls, PROTO_AUDIO_ADPCM, seg, 2);
+    return rc ? -2 : (int)(s0 * 2 + (uint32_t)n * 2 - off);
+}
+
+/*
+ * The lossless block holding PCM byte off, encoded into s_ll_out. Blocks start at
+ * multiples of LOSSLESS_BLOCK samples, so any offset maps to one block and a re-sent
+ * block encodes to the same bytes. The last encoding is kept for retries and the CoC
+ * fallback. Returns samples in the block, 0 if nothing past off is readable yet, -1 if
+ * rec_id is gone, -2 if out of memory.
+ */
+static int lossless_block_at(uint16_t rec_id, uint32_t off, uint32_t *b0_out)
+{
+    if (!s_ll_pcm) {
+        s_ll_pcm = malloc(LOSSLESS_BLOCK * sizeof(int16_t));
+        s_ll_out = malloc(LOSSLESS_MAX_BYTES(LOSSLESS_BLOCK));
+        if (!s_ll_pcm || !s_ll_out) {
+            free(s_ll_pcm);
+            free(s_ll_out);
+            s_ll_pcm = NULL;
+            s_ll_out = NULL;
+            return -2;
+        }
+    }
+    uint32_t b0 = off / (LOSSLESS_BLOCK * 2) * (LOSSLESS_BLOCK * 2);
+    *b0_out = b0;
+    int got = rec_store_read_rec(rec_id, b0, (uint8_t *)s_ll_pcm, LOSSLESS_BLOCK * 2);
+    if (got < 0) return -1;
+    size_t n = (size_t)got / 2;
+    if (b0 + n * 2 <= off) return 0;
+    if (rec_id != s_ll_rec || b0 != s_ll_b0 || n != s_ll_n) {
+        s_ll_len = lossless_encode(s_ll_pcm, n, s_ll_out, LOSSLESS_MAX_BYTES(LOSSLESS_BLOCK));
+        s_ll_rec = rec_id;
+        s_ll_b0 = b0;
+        s_ll_n = n;
+    }
+    return (int)n;
+}
+
+/*
+ * The lossless block holding off as AUDIO_LOSSLESS frames (chunks of one notification
+ * or SDU). The whole block goes even when the caller asked for less, so GET windows
+ * round out to block boundaries. Same return convention as send_store_frame().
+ */
+static int send_lossless_block(sonya_tx_class_t cls, uint16_t rec_id, uint32_t off, bool coc)
+{
+    uint32_t b0;
+    int n = lossless_block_at(rec_id, off, &b0);
+    if (n <= 0) return n;
+    int room = link_room(coc) - PROTO_AUDIO_LOSSLESS_HDR;
+    if (room <= 0 || s_ll_len == 0) return -2;
+
+    uint8_t hdr[PROTO_AUDIO_LOSSLESS_HDR] = { (uint8_t)(rec_id & 0xFF), (uint8_t)(rec_id >> 8) };
+    put_le32(hdr + 2, b0);
+    hdr[6] = (uint8_t)(n & 0xFF);
+    hdr[7] = (uint8_t)(n >> 8);
+    hdr[8] = (uint8_t)(s_ll_len & 0xFF);
+    hdr[9] = (uint8_t)(s_ll_len >> 8);
+    for (size_t pos = 0; pos < s_ll_len; pos += (size_t)room) {
+        size_t len = s_ll_len - pos < (size_t)room ? s_ll_len - pos : (size_t)room;
+        hdr[10] = (uint8_t)(pos & 0xFF);
+        hdr[11] = (uint8_t)(pos >> 8);
+        sonya_ble_seg_t seg[2] = { { hdr, sizeof(hdr) }, { s_ll_out + pos, (uint16_t)len } };
+        int rc = coc ? sonya_ble_coc_send_frame_segs(PROTO_AUDIO_LOSSLESS, seg, 2)
+                     : sonya_ble_send_frame_segs(cls, PROTO_AUDIO_LOSSLESS, seg, 2);
+        if (rc) return -2;
+    }
+    return (int)(b0 + (uint32_t)n * 2 - off);
+}
+
+/*
+ * v2: make sure the phone can place the next AUDIO_DATA frame (PCM [off, off + len) on
+ * cls, or CoC). If it does not continue the last anchor of that stream (another frame
+ * took a seq, a short frame, a jump, a new frame size) an EVT_STREAM goes first on the
+ * same stream, so it arrives before the data. Returns 0, or -2 if that send failed.
+ */
+static int stream_anchor(sonya_tx_class_t cls, bool coc, uint16_t rec_id, uint32_t off, int len)
+{
+    uint8_t sid = coc ? PROTO_SID_COC : (uint8_t)cls;
+    stream_anchor_t *a = &s_anchor[sid];
+    uint32_t seq = sonya_ble_stream_seq(sid);
+    if (a->valid && a->rec_id == rec_id && a->frame == (uint16_t)len && a->since < ANCHOR_REPEAT &&
+        off == a->base + (seq - a->seq0) * a->frame) {
+        a->since++;
+        return 0;
+    }
+    uint8_t p[2 + 4 + 4 + 2] = { (uint8_t)(rec_id & 0xFF), (uint8_t)(rec_id >> 8) };
+    put_le32(p + 2, off);
+    put_le32(p + 6, seq + 1);   // this event takes seq, the data seq + 1
+    p[10] = (uint8_t)(len & 0xFF);
+    p[11] = (uint8_t)(len >> 8);
+    sonya_ble_seg_t seg = { p, sizeof(p) };
+    int rc = coc ? sonya_ble_coc_send_frame_segs(PROTO_EVT_STREAM, &seg, 1)
+                 : sonya_ble_send_frame_segs(cls, PROTO_EVT_STREAM, &seg, 1);
+    a->valid = rc == 0;
+    if (rc) return -2;
+    a->rec_id = rec_id;
+    a->frame = (uint16_t)len;
+    a->since = 1;
+    a->base = off;
+    a->seq0 = seq + 1;
+    return 0;
+}
+
+/* AUDIO_DATA in v2: bare PCM behind an EVT_STREAM anchor. Same return convention as send_store_frame(). */
+static int send_data_v2(sonya_tx_class_t cls, uint16_t rec_id, uint32_t off, int pcm_len, bool coc)
+{
+    // Size the frame by what is readable now, so the anchor announces the real length.
+    if (rec_id != rec_store_cur_id()) return -1;
+    int len = rec_store_total_bytes() - (int)off;
+    if (len > pcm_len) len = pcm_len;
+    if (len <= 0) return 0;
+    if (stream_anchor(cls, coc, rec_id, off, len)) return -2;
+    return send_store_frame(cls, PROTO_AUDIO_DATA, NULL, 0, rec_id, off, len, coc);
+}
+
+/* One audio frame of up to pcm_len bytes in the session codec; same return convention as send_store_frame(). */
+static int send_audio_frame(sonya_tx_class_t cls, uint16_t rec_id, uint32_t off, int pcm_len)
+{
+    if (s_codec == PROTO_CODEC_IMA_ADPCM) {
+        if (sonya_ble_coc_is_open()) {
+            int rc = send_adpcm_frame(cls, rec_id, off, pcm_len, true);
+            if (rc != -2 || sonya_ble_coc_is_open()) return rc;
+        }
+        return send_adpcm_frame(cls, rec_id, off, pcm_len, false);
+    }
+    if (s_codec == PROTO_CODEC_LOSSLESS) {
+        if (sonya_ble_coc_is_open()) {
+            int rc = send_lossless_block(cls, rec_id, off, true);
+            if (rc != -2 || sonya_ble_coc_is_open()) return rc;
+        }
+        return send_lossless_block(cls, rec_id, off, false);
+    }
+
+    if (s_v2) {
+        if (sonya_ble_coc_is_open()) {
+            int rc = send_data_v2(cls, rec_id, off, pcm_len, true);
+            if (rc != -2 || sonya_ble_coc_is_open()) return rc;
+        }
+        int n = frame_pcm_len(0);
+        if (n <= 0) return -2;
+        return send_data_v2(cls, rec_id, off, pcm_len < n ? pcm_len : n, false);
+    }
+
+    uint8_t hdr[PROTO_AUDIO_DATA_HDR] = { (uint8_t)(rec_id & 0xFF), (uint8_t)(rec_id >> 8) };
+    put_le32(hdr + 2, off);
+
+    if (sonya_ble_coc_is_open()) {
+        int rc = send_store_frame(cls, PROTO_AUDIO_DATA, hdr, sizeof(hdr), rec_id, off, pcm_len, true);
+        if (rc != -2 || sonya_ble_coc_is_open()) return rc;
+        /* The channel closed under us: fall through to a notification-sized frame. */
+    }
+    int n = frame_pcm_len(PROTO_AUDIO_DATA_HDR);
+    if (n <= 0) return -2;
+    return send_store_frame(cls, PROTO_AUDIO_DATA, hdr, sizeof(hdr), rec_id, off,
+                            pcm_len < n ? pcm_len : n, false);
+}
+
+/* ---- link stats (frames per connection event) ---- */
+
+/* Idle-task run time summed over cores, this module's task run time, and the run-time clock (us). */
+static bool cpu_sample(uint32_t *idle, uint32_t *self, uint32_t *now)
+{
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    UBaseType_t n = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t *st = malloc(n * sizeof(*st));
+    if (!st) return false;
+    uint32_t total = 0;
+    n = uxTaskGetSystemState(st, n, &total);
+    uint32_t sum = 0;
+    *self = 0;
+    for (UBaseType_t i = 0; i < n; i++) {
+        if (strncmp(st[i].pcTaskName, "IDLE", 4) == 0) sum += st[i].ulRunTimeCounter;
+        if (st[i].xHandle == s_task) *self = st[i].ulRunTimeCounter;
+    }
+    free(st);
+    *idle = sum;
+    *now = total;
+    return n > 0;
+#else
+    (void)idle; (void)self; (void)now;
+    return false;
+#endif
+}
+
+static void link_begin(void)
+{
+    sonya_ble_reset_tx_stats();
+    if (!s_live_active) {
+        (void)sonya_ble_set_link_phase(SONYA_LINK_BULK);
+        s_bulk_phase = true;
+    }
+    sonya_ble_request_fast_link();
+    if (!cpu_sample(&s_cpu_idle0, &s_task_rt0, &s_cpu_t0)) s_cpu_t0 = 0;
+}
 
-/* ---- send one AUDIO_DATA frame ---- */
+/*
+ * Since link_begin(): busy share of both cores in percent, and this task's CPU time
+ * per KB sent (build + copy + hand-off to the host; blocking waits are not counted).
+ * Both -1 without run-time stats.
+ */
+static void cpu_usage(uint32_t bytes, int *busy_pct, int32_t *task_us_per_kb)
+{
+    uint32_t idle, self, now;
+    *busy_pct = -1;
+    *task_us_per_kb = -1;
+    if (!s_cpu_t0 || !cpu_sample(&idle, &self, &now)) return;
+    uint64_t span = (uint64_t)(now - s_cpu_t0) * portNUM_PROCESSORS;
+    if (!span) return;
+    uint64_t idle_d = idle - s_cpu_idle0;
+    *busy_pct = idle_d >= span ? 0 : (int)(100 - idle_d * 100 / span);
+    if (bytes) *task_us_per_kb = (int32_t)((uint64_t)(self - s_task_rt0) * 1024U / bytes);
+}
 
-static int send_audio_frame(uint16_t rec_id, uint32_t off, const uint8_t *pcm, int pcm_len)
+static void log_link_stats(const char *what, uint32_t dt_ms, uint32_t bytes)
 {
-    uint8_t payload[2 + 4 + AUDIO_FRAME_MAX];
-    payload[0] = (uint8_t)(rec_id & 0xFF);
-    payload[1] = (uint8_t)(rec_id >> 8);
-    payload[2] = (uint8_t)(off & 0xFF);
-    payload[3] = (uint8_t)((off >> 8)  & 0xFF);
-    payload[4] = (uint8_t)((off >> 16) & 0xFF);
-    payload[5] = (uint8_t)((off >> 24) & 0xFF);
-    memcpy(payload + 6, pcm, (size_t)pcm_len);
-    return sonya_ble_send_frame(PROTO_AUDIO_DATA, payload, (uint16_t)(6 + pcm_len));
+    sonya_ble_tx_stats_t st;
+    sonya_ble_link_info_t li;
+    sonya_ble_get_tx_stats(&st);
+    sonya_ble_get_link_info(&li);
+    uint32_t itvl_us = li.itvl_us;
+    uint32_t events = itvl_us ? (uint32_t)((uint64_t)dt_ms * 1000U / itvl_us) : 0;
+    uint32_t fpe_x100 = events ? st.frames_sent * 100U / events : 0;
+    ESP_LOGI(TAG, "%s link: frames=%lu fpe=%lu.%02lu itvl=%luus enomem=%lu waits(credit=%lu mbuf=%lu) msys_min=%u inflight=%u",
+             what, (unsigned long)st.frames_sent,
+             (unsigned long)(fpe_x100 / 100), (unsigned long)(fpe_x100 % 100),
+             (unsigned long)itvl_us, (unsigned long)st.enomem,
+             (unsigned long)st.credit_waits, (unsigned long)st.mbuf_waits,
+             (unsigned)st.msys_free_min, (unsigned)st.inflight_max);
+    int busy;
+    int32_t us_per_kb;
+    cpu_usage(bytes, &busy, &us_per_kb);
+    ESP_LOGI(TAG, "%s link: via=%s phy tx=%u rx=%u octets tx=%u rx=%u mtu=%u cpu=%d%% task=%ldus/KB",
+             what, sonya_ble_coc_is_open() ? "coc" : "gatt",
+             (unsigned)li.tx_phy, (unsigned)li.rx_phy,
+             (unsigned)li.tx_octets, (unsigned)li.rx_octets, (unsigned)li.att_mtu,
+             busy, (long)us_per_kb);
+}
+
+/* ---- live FEC: XOR parity every k frames (runs in stream_task) ---- */
+
+/* Parity goes with PCM live over GATT; CoC SDUs are not lost one by one. */
+static bool fec_active(void)
+{
+    return s_fec_mode != PROTO_FEC_OFF && s_codec == PROTO_CODEC_PCM16 && !sonya_ble_coc_is_open();
+}
+
+static uint8_t fec_k(void)
+{
+    if (s_fec_mode >= PROTO_FEC_K_MIN) return s_fec_mode;
+    uint32_t ppm = s_fec_loss_ppm;
+    // k + 1 frames per group at loss p: keep (k + 1) * p near FEC_TARGET_PPM.
+    uint32_t k = ppm ? FEC_TARGET_PPM / ppm : PROTO_FEC_K_MAX + 1;
+    k = k > 1 ? k - 1 : 0;
+    if (k < FEC_K_AUTO_MIN) k = FEC_K_AUTO_MIN;
+    if (k > PROTO_FEC_K_MAX) k = PROTO_FEC_K_MAX;
+    return (uint8_t)k;
+}
+
+/* Auto mode: fold the NACKed share of the last FEC_SAMPLE_BYTES of live audio into the estimate. */
+static void fec_loss_sample(int sent)
+{
+    s_fec_live_bytes += (uint32_t)sent;
+    if (s_fec_live_bytes < FEC_SAMPLE_BYTES) return;
+    uint32_t nacked = s_fec_nack_bytes;
+    s_fec_nack_bytes = 0;
+    if (nacked > s_fec_live_bytes) nacked = s_fec_live_bytes;
+    uint32_t sample = (uint32_t)((uint64_t)nacked * 1000000U / s_fec_live_bytes);
+    s_fec_loss_ppm = (3 * s_fec_loss_ppm + sample) / 4;
+    s_fec_live_bytes = 0;
+}
+
+/*
+ * XOR of the group's PCM, read back from rec_store, as one AUDIO_FEC frame on the live
+ * class. Each span is released right after it is folded into s_fec_par, so nothing is
+ * pinned by the time the send can block.
+ */
+static void fec_send_parity(const fec_group_t *g)
+{
+    memset(s_fec_par, 0, g->frame);
+    for (uint32_t i = 0; i < g->k; i++) {
+        uint32_t base = g->off + i * g->frame;
+        int pos = 0;
+        while (pos < g->frame) {
+            const uint8_t *p;
+            int n = rec_store_peek_rec(g->rec_id, base + (uint32_t)pos, (size_t)(g->frame - pos), &p);
+            if (n <= 0) return;
+            for (int j = 0; j < n; j++) s_fec_par[pos + j] ^= p[j];
+            rec_store_peek_end();
+            pos += n;
+        }
+    }
+    uint8_t hdr[PROTO_AUDIO_FEC_HDR] = { (uint8_t)(g->rec_id & 0xFF), (uint8_t)(g->rec_id >> 8) };
+    put_le32(hdr + 2, g->off);
+    hdr[6] = (uint8_t)(g->frame & 0xFF);
+    hdr[7] = (uint8_t)(g->frame >> 8);
+    hdr[8] = g->k;
+    sonya_ble_seg_t seg[2] = { { hdr, sizeof(hdr) }, { s_fec_par, g->frame } };
+    if (sonya_ble_send_frame_segs(SONYA_TX_LIVE, PROTO_AUDIO_FEC, seg, 2) == 0) s_fec_sent++;
+    else s_fec_fail++;
+}
+
+/*
+ * A live frame of len PCM bytes at off went out. Groups are k back-to-back frames of
+ * the same full size; a short or out-of-line frame starts over without parity.
+ */
+static void fec_live_frame(uint16_t rec_id, uint32_t off, int len, int frame)
+{
+    fec_group_t *g = &s_fec;
+    if (s_fec_mode == PROTO_FEC_AUTO) fec_loss_sample(len);
+    if (!fec_active() || len != frame || len > (int)sizeof(s_fec_par)) {
+        g->n = 0;
+        return;
+    }
+    if (g->n && (g->rec_id != rec_id || g->frame != len || off != g->off + (uint32_t)g->n * g->frame)) {
+        g->n = 0;
+    }
+    if (g->n == 0) {
+        g->rec_id = rec_id;
+        g->off = off;
+        g->frame = (uint16_t)len;
+        g->k = fec_k();
+    }
+    if (++g->n < g->k) return;
+    g->n = 0;
+    fec_send_parity(g);
+}
+
+/* ---- NACK: several missing ranges as one job (runs in stream_task) ---- */
+
+/* Take a pending NACK; it replaces the one in progress. */
+static bool nack_pickup(void)
+{
+    if (xQueueReceive(s_nack_queue, &s_nack, 0) != pdTRUE) return false;
+    s_nack_busy = s_nack.n > 0;
+    return true;
+}
+
+/*
+ * One AUDIO_DATA frame from the front range, on the bulk class. Ranges are sorted, so
+ * rec_store is read forward only. Returns bytes covered, 0 when done, or <0 as
+ * send_audio_frame(); a range the recording no longer has is skipped.
+ */
+static int nack_step(void)
+{
+    while (s_nack_busy) {
+        proto_range_t *r = &s_nack.r[s_nack.cur];
+        uint32_t total = (uint32_t)rec_store_total_bytes();
+        if (r->len == 0 || r->off >= total) {
+            if (++s_nack.cur >= s_nack.n) s_nack_busy = false;
+            continue;
+        }
+        int frame = data_frame_pcm();
+        int chunk = r->len > (uint32_t)frame ? frame : (int)r->len;
+        int rd = send_audio_frame(SONYA_TX_BULK, s_nack.rec_id, r->off, chunk);
+        if (rd == -1) s_nack_busy = false;
+        if (rd <= 0) return rd;
+        // Lossless blocks may start before r->off; only count what lies inside the range.
+        uint32_t adv = (uint32_t)rd >= r->len ? r->len : (uint32_t)rd;
+        r->off += adv;
+        r->len -= adv;
+        return (int)adv;
+    }
+    return 0;
+}
+
+static void nack_run(void)
+{
+    if (!nack_pickup() && !s_nack_busy) return;
+    uint32_t t0 = (uint32_t)esp_log_timestamp();
+    int frames = 0;
+    int bytes_sent = 0;
+    int nr = s_nack.n;
+    link_begin();
+
+    while (s_nack_busy && sonya_ble_is_connected()) {
+        job_t newer;
+        if (xQueuePeek(s_queue, &newer, 0) == pdTRUE) break;
+        nack_pickup();
+        int rd = nack_step();
+        if (rd == -2) {
+            vTaskDelay(pdMS_TO_TICKS(30));
+            rd = nack_step();
+        }
+        if (rd < 0) break;
+        if (rd == 0) {
+            if (s_nack_busy) vTaskDelay(pdMS_TO_TICKS(5));
+            continue;
+        }
+        frames++;
+        bytes_sent += rd;
+    }
+    if (!sonya_ble_is_connected()) s_nack_busy = false;
+
+    uint32_t dt = (uint32_t)esp_log_timestamp() - t0;
+    ESP_LOGI(TAG, "NACK ranges=%d frames=%d bytes=%d dt=%lums%s", nr, frames, bytes_sent,
+             (unsigned long)dt, s_nack_busy ? " (interrupted)" : "");
+    log_link_stats("NACK", dt, (uint32_t)bytes_sent);
 }
 
 /* ---- live streaming (runs in stream_task) ---- */
@@ -50,33 +707,75 @@ static void live_loop(void)
     uint32_t sent = 0;
     uint32_t t0 = (uint32_t)esp_log_timestamp();
     int frames = 0;
-    uint8_t buf[AUDIO_FRAME_MAX];
+    int resumes = 0;
+    bool paused = false;
+    bool opus = live_opus_active();
 
-    ESP_LOGI(TAG, "LIVE start rec_id=%u", (unsigned)rid);
+    ESP_LOGI(TAG, "LIVE start rec_id=%u%s", (unsigned)rid, opus ? " opus" : "");
+    memset(&s_fec, 0, sizeof(s_fec));
+    s_fec_sent = s_fec_fail = 0;
+    s_bulk_phase = false;   // app_main owns the phase while recording
+    link_begin();
+
+    for (;;) {
+        if (!sonya_ble_is_connected()) {
+            /* Keep the position across a link drop; the recording goes on in rec_store. */
+            if (s_live_stop) break;
+            if (!paused) ESP_LOGI(TAG, "LIVE paused at %lu (link down)", (unsigned long)sent);
+            paused = true;
+            vTaskDelay(pdMS_TO_TICKS(50));
+            continue;
+        }
+        if (paused) {
+            /* The phone gets REC_INFO on subscribe and answers with RESUME:<id>:<hwm>. */
+            uint32_t w0 = (uint32_t)esp_log_timestamp();
+            while (!s_live_resume && sonya_ble_is_connected() &&
+                   (uint32_t)esp_log_timestamp() - w0 < LIVE_RESUME_WAIT_MS) {
+                vTaskDelay(pdMS_TO_TICKS(20));
+            }
+            paused = false;
+            resumes++;
+        }
+        if (s_live_resume) {
+            s_live_resume = false;
+            uint32_t hwm = s_live_resume_off;
+            uint32_t have = (uint32_t)rec_store_total_bytes();
+            ESP_LOGI(TAG, "LIVE resume at %lu (was %lu)", (unsigned long)hwm, (unsigned long)sent);
+            sent = hwm < have ? hwm : have;
+        }
 
-    while (sonya_ble_is_connected()) {
         int total = rec_store_total_bytes();
         int avail = total - (int)sent;
 
         bool stopping = s_live_stop;
+        int frame = opus ? live_opus_frame_pcm() : data_frame_pcm();
+        if (!opus && fec_active()) {
+            // Leave room for the parity frame's longer header.
+            int f = frame_pcm_len(PROTO_AUDIO_FEC_HDR);
+            if (f > 0 && f < frame) frame = f;
+        }
 
-        if (avail >= AUDIO_FRAME_MAX || (stopping && avail > 0)) {
-            int chunk = avail > AUDIO_FRAME_MAX ? AUDIO_FRAME_MAX : avail;
-            int rd = rec_store_read(sent, buf, (size_t)chunk);
-            if (rd <= 0) {
+        if (avail >= frame || (stopping && avail > 0)) {
+            int chunk = avail > frame ? frame : avail;
+            int rd = opus ? live_opus_send(rid, sent, chunk)
+                          : send_audio_frame(SONYA_TX_LIVE, rid, sent, chunk);
+            if (rd == -1) break;
+            if (rd == 0) {
                 vTaskDelay(pdMS_TO_TICKS(5));
                 continue;
             }
-            int rc = send_audio_frame(rid, sent, buf, rd);
-            if (rc) {
+            if (rd < 0) {
                 vTaskDelay(pdMS_TO_TICKS(30));
                 continue;
             }
+            if (!opus) fec_live_frame(rid, sent, rd, frame);
             sent += (uint32_t)rd;
             frames++;
-            vTaskDelay(pdMS_TO_TICKS(8));
         } else if (stopping) {
             break;
+        } else if (s_nack_busy || nack_pickup()) {
+            // No new audio yet: fill the gap with NACKed ranges on the bulk class.
+            if (nack_step() <= 0) vTaskDelay(pdMS_TO_TICKS(10));
         } else {
             vTaskDelay(pdMS_TO_TICKS(10));
         }
@@ -84,49 +783,335 @@ static void live_loop(void)
 
     uint32_t dt = (uint32_t)esp_log_timestamp() - t0;
     UBaseType_t hwm = uxTaskGetStackHighWaterMark(s_task);
-    ESP_LOGI(TAG, "LIVE end: frames=%d bytes=%lu dt=%lums stack_free=%u",
-             frames, (unsigned long)sent, (unsigned long)dt, (unsigned)hwm);
+    ESP_LOGI(TAG, "LIVE end: frames=%d bytes=%lu resumes=%d dt=%lums stack_free=%u",
+             frames, (unsigned long)sent, resumes, (unsigned long)dt, (unsigned)hwm);
+    if (s_fec_sent || s_fec_fail) {
+        ESP_LOGI(TAG, "LIVE fec: parity=%lu fail=%lu k=%u loss=%luppm", (unsigned long)s_fec_sent,
+                 (unsigned long)s_fec_fail, (unsigned)fec_k(), (unsigned long)s_fec_loss_ppm);
+    }
+    log_link_stats("LIVE", dt, sent);
 
     s_live_active = false;
+    // The rest of a NACK runs as a job. handle_nack() posts the ranges before it looks at
+    // s_live_active, so one that raced with the end of live is seen here.
+    if (s_nack_busy || uxQueueMessagesWaiting(s_nack_queue)) {
+        job_t req = { .kind = JOB_NACK, .rec_id = rid };
+        xQueueSend(s_queue, &req, 0);
+    }
 }
 
 /* ---- pull window (responds to GET, runs in stream_task) ---- */
 
-static void pull_window(const get_req_t *req)
+static void pull_window(const job_t *req)
 {
-    uint16_t remaining = req->want_len;
+    uint32_t remaining = req->want_len;
     uint32_t cur = req->off;
     uint32_t t0 = (uint32_t)esp_log_timestamp();
     int frames = 0;
     int bytes_sent = 0;
-    uint8_t buf[AUDIO_FRAME_MAX];
+    link_begin();
 
     while (remaining > 0 && sonya_ble_is_connected()
            && cur < (uint32_t)rec_store_total_bytes()) {
-        get_req_t newer;
+        job_t newer;
         if (xQueuePeek(s_queue, &newer, 0) == pdTRUE) break;
 
-        int chunk = remaining > AUDIO_FRAME_MAX ? AUDIO_FRAME_MAX : remaining;
-        int rd = rec_store_read(cur, buf, (size_t)chunk);
-        if (rd <= 0) break;
-
-        int rc = send_audio_frame(req->rec_id, cur, buf, rd);
-        if (rc) {
+        int frame = data_frame_pcm();
+        int chunk = remaining > (uint32_t)frame ? frame : (int)remaining;
+        int rd = send_audio_frame(SONYA_TX_BULK, req->rec_id, cur, chunk);
+        if (rd == -2) {
             vTaskDelay(pdMS_TO_TICKS(30));
-            rc = send_audio_frame(req->rec_id, cur, buf, rd);
-            if (rc) break;
+            rd = send_audio_frame(SONYA_TX_BULK, req->rec_id, cur, chunk);
         }
+        if (rd <= 0) break;
         frames++;
         bytes_sent += rd;
         cur += (uint32_t)rd;
-        remaining = (uint16_t)(remaining - (uint16_t)rd);
-        vTaskDelay(pdMS_TO_TICKS(8));
+        remaining = (uint32_t)rd >= remaining ? 0 : remaining - (uint32_t)rd;
     }
 
     uint32_t dt = (uint32_t)esp_log_timestamp() - t0;
     ESP_LOGI(TAG, "PULL frames=%d bytes=%d dt=%lums off0=%lu off1=%lu",
              frames, bytes_sent, (unsigned long)dt,
              (unsigned long)req->off, (unsigned long)cur);
+    log_link_stats("PULL", dt, (uint32_t)bytes_sent);
+}
+
+/* ---- windowed selective-repeat transfer (XGET, runs in stream_task) ---- */
+
+static uint32_t now_ms(void) { return (uint32_t)esp_log_timestamp(); }
+
+/* One AUDIO_WIN frame; 0 when queued, else send_store_frame()'s -1 / -2 (0: nothing read -> -1). */
+static int xfer_send(xfer_t *x, uint16_t fseq, bool retx)
+{
+    uint32_t off = x->off0 + (uint32_t)fseq * x->frame_pcm;
+    uint32_t want = x->end - off < x->frame_pcm ? x->end - off : x->frame_pcm;
+    uint8_t hdr[PROTO_AUDIO_WIN_HDR] = {
+        (uint8_t)(x->rec_id & 0xFF), (uint8_t)(x->rec_id >> 8),
+        (uint8_t)(fseq & 0xFF), (uint8_t)(fseq >> 8),
+    };
+    put_le32(hdr + 4, off);
+    int rd = send_store_frame(SONYA_TX_BULK, PROTO_AUDIO_WIN, hdr, sizeof(hdr), x->rec_id, off, (int)want, false);
+    if (rd <= 0) return rd == -2 ? -2 : -1;
+
+    int slot = fseq % XFER_SLOTS;
+    x->sent_ms[slot]  = now_ms();
+    x->tx_stamp[slot] = ++x->tx_counter;
+    x->flags[slot]    = (uint8_t)(retx ? SLOT_RETX : 0);
+    x->tx_frames++;
+    if (retx) x->retx_frames++;
+    return 0;
+}
+
+static void xfer_on_ack(xfer_t *x, const xack_t *a)
+{
+    uint32_t now = now_ms();
+    uint16_t cum = a->cum > x->next ? x->next : a->cum;
+    uint16_t newly = 0;
+
+    for (uint16_t f = x->base; f < cum; f++) {
+        int slot = f % XFER_SLOTS;
+        if (x->flags[slot] & SLOT_ACKED) continue;
+        if (!(x->flags[slot] & SLOT_RETX)) {
+            uint32_t rtt = now - x->sent_ms[slot];
+            x->srtt_ms = x->srtt_ms ? (x->srtt_ms * 7 + rtt) / 8 : rtt;
+        }
+        x->flags[slot] |= SLOT_ACKED;
+        newly++;
+    }
+    if (cum > x->base) x->base = cum;
+
+    /* SACK: bit i => cum + 1 + i received. Remember the newest transmission acked. */
+    uint32_t newest_stamp = 0;
+    for (int i = 0; i < 32; i++) {
+        if (!(a->sack & (1UL << i))) continue;
+        uint32_t f = (uint32_t)cum + 1U + (uint32_t)i;
+        if (f >= x->next) break;
+        int slot = (int)(f % XFER_SLOTS);
+        if (!(x->flags[slot] & SLOT_ACKED)) {
+            x->flags[slot] |= SLOT_ACKED;
+            newly++;
+        }
+        if (x->tx_stamp[slot] > newest_stamp) newest_stamp = x->tx_stamp[slot];
+    }
+
+    /* A hole sent before a frame that has been acked is lost, not in flight. */
+    uint16_t lost = 0;
+    uint16_t first_lost = 0;
+    for (uint16_t f = x->base; f < x->next; f++) {
+        int slot = f % XFER_SLOTS;
+        if (x->flags[slot] & (SLOT_ACKED | SLOT_LOST)) continue;
+        if (x->tx_stamp[slot] < newest_stamp) {
+            if (!lost) first_lost = f;
+            x->flags[slot] |= SLOT_LOST;
+            lost++;
+        }
+    }
+
+    uint32_t sample = (newly + lost) ? (uint32_t)lost * 1000000U / (newly + lost) : 0;
+    x->loss_ppm = (x->loss_ppm * 7 + sample) / 8;
+
+    if (lost && first_lost >= x->recover && x->loss_ppm > XFER_LOSS_BACKOFF_PPM) {
+        uint16_t w = (uint16_t)(x->win - x->win / 4);
+        x->win = w > XFER_WIN_MIN ? w : XFER_WIN_MIN;
+        x->recover = x->next;
+        x->ai_credit = 0;
+        x->loss_rounds++;
+    } else if (!lost && newly) {
+        x->ai_credit += newly;
+        if (x->ai_credit >= x->win) {
+            x->ai_credit = 0;
+            if (x->win < CONFIG_XFER_WIN_MAX) x->win++;
+        }
+    }
+
+    if (x->srtt_ms) {
+        uint32_t rto = x->srtt_ms * 2 + 20;
+        x->rto_ms = rto < XFER_RTO_MIN_MS ? XFER_RTO_MIN_MS
+                  : rto > XFER_RTO_MAX_MS ? XFER_RTO_MAX_MS : rto;
+    }
+}
+
+static void xfer_run(const job_t *job)
+{
+    static xfer_t x;
+    memset(&x, 0, sizeof(x));
+    x.rec_id = job->rec_id;
+    x.off0   = job->off;
+    x.end    = (uint32_t)rec_store_total_bytes();
+    x.frame_pcm = (uint16_t)frame_pcm_len(PROTO_AUDIO_WIN_HDR);
+    if (x.frame_pcm == 0) return;
+    uint32_t frames = (x.end - x.off0 + x.frame_pcm - 1) / x.frame_pcm;
+    if (frames > XFER_FRAMES_MAX) {
+        // Serve what fseq can number; "done" then covers exactly [off0, end) and the phone
+        // continues with XGET from end.
+        frames = XFER_FRAMES_MAX;
+        x.end = x.off0 + frames * x.frame_pcm;
+        ESP_LOGW(TAG, "XGET longer than %u frames, serving up to %lu", (unsigned)XFER_FRAMES_MAX,
+                 (unsigned long)x.end);
+    }
+    x.n_frames = (uint16_t)frames;
+    x.win      = CONFIG_XFER_WIN_INIT < CONFIG_XFER_WIN_MAX ? CONFIG_XFER_WIN_INIT : CONFIG_XFER_WIN_MAX;
+    x.rto_ms   = XFER_RTO_INIT_MS;
+
+    uint32_t t0 = now_ms();
+    uint32_t last_ack = t0;
+    xQueueReset(s_ack_queue);
+    link_begin();
+    ESP_LOGI(TAG, "XFER start rec_id=%u off=%lu frames=%u x %uB win=%u",
+             (unsigned)x.rec_id, (unsigned long)x.off0, (unsigned)x.n_frames,
+             (unsigned)x.frame_pcm, (unsigned)x.win);
+
+    while (x.base < x.n_frames && sonya_ble_is_connected()) {
+        job_t newer;
+        if (xQueuePeek(s_queue, &newer, 0) == pdTRUE) break;
+
+        xack_t a;
+        while (xQueueReceive(s_ack_queue, &a, 0) == pdTRUE) {
+            if (a.rec_id != x.rec_id) continue;
+            xfer_on_ack(&x, &a);
+            last_ack = now_ms();
+        }
+        if (x.base >= x.n_frames) break;
+        if (now_ms() - last_ack > XFER_IDLE_MS) {
+            ESP_LOGW(TAG, "XFER abort: no ACK for %d ms", XFER_IDLE_MS);
+            break;
+        }
+
+        /*
+         * Retransmit holes reported lost, or anything past its RTO. A full TX queue (-2)
+         * only pauses: the frame keeps its state and is tried again next round.
+         */
+        bool timed_out = false;
+        bool busy = false;
+        for (uint16_t f = x.base; f < x.next && !busy; f++) {
+            int slot = f % XFER_SLOTS;
+            uint8_t fl = x.flags[slot];
+            if (fl & SLOT_ACKED) continue;
+            bool rto = (now_ms() - x.sent_ms[slot]) >= x.rto_ms;
+            if (!(fl & SLOT_LOST) && !rto) continue;
+            int rc = xfer_send(&x, f, true);
+            if (rc == -1) goto out;
+            busy = rc == -2;
+            if (!busy && rto && !(fl & SLOT_LOST)) timed_out = true;
+        }
+        if (timed_out) {
+            x.rto_ms = x.rto_ms * 2 > XFER_RTO_MAX_MS ? XFER_RTO_MAX_MS : x.rto_ms * 2;
+            x.win = x.win / 2 > XFER_WIN_MIN ? x.win / 2 : XFER_WIN_MIN;
+            x.recover = x.next;
+        }
+
+        /* New frames within the credit window. */
+        while (!busy && x.next < x.n_frames && (uint16_t)(x.next - x.base) < x.win) {
+            int rc = xfer_send(&x, x.next, false);
+            if (rc == -1) goto out;
+            busy = rc == -2;
+            if (!busy) x.next++;
+        }
+
+        xQueuePeek(s_ack_queue, &a, pdMS_TO_TICKS(busy ? XFER_BUSY_MS : 20));
+    }
+out:;
+    uint32_t dt = now_ms() - t0;
+    uint32_t good = x.base >= x.n_frames ? x.end - x.off0 : (uint32_t)x.base * x.frame_pcm;
+    ESP_LOGI(TAG, "XFER %s: acked=%u/%u tx=%lu retx=%lu loss_rounds=%lu loss=%lu.%lu%% win=%u srtt=%lums dt=%lums goodput=%luB/s",
+             x.base >= x.n_frames ? "done" : "stop",
+             (unsigned)x.base, (unsigned)x.n_frames,
+             (unsigned long)x.tx_frames, (unsigned long)x.retx_frames,
+             (unsigned long)x.loss_rounds,
+             (unsigned long)(x.loss_ppm / 10000), (unsigned long)((x.loss_ppm / 1000) % 10),
+             (unsigned)x.win, (unsigned long)x.srtt_ms, (unsigned long)dt,
+             (unsigned long)(dt ? (uint64_t)good * 1000U / dt : 0));
+    log_link_stats("XFER", dt, good);
+}
+
+/* ---- synthetic benchmark (BENCH, runs in stream_task) ---- */
+
+static void bench_report(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void bench_report(const char *fmt, ...)
+{
+    char msg[64];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    ESP_LOGI(TAG, "%s", msg);
+    sonya_ble_send_evt_error(msg);
+}
+
+/*
+ * Same frame builder, TX queue and notify path as a GET, but the payload is a fixed
+ * pattern: no mic, no rec_store. Measures the radio path alone.
+ */
+static void bench_run(void)
+{
+    pull_stream_bench_t cfg = s_bench;
+    uint32_t limit_ms = cfg.sec ? cfg.sec * 1000U : cfg.bytes ? 0 : BENCH_DEFAULT_SEC * 1000U;
+    int inflight = sonya_ble_set_tx_inflight(cfg.inflight);
+    uint32_t bseq = 0;
+    uint32_t off = 0;
+    uint32_t retries = 0;
+
+    link_begin();
+    uint32_t t0 = now_ms();
+    ESP_LOGI(TAG, "BENCH start sec=%u bytes=%lu frame=%u gap=%ums inflight=%d",
+             (unsigned)cfg.sec, (unsigned long)cfg.bytes, (unsigned)cfg.frame,
+             (unsigned)cfg.gap_ms, inflight);
+
+    while (sonya_ble_is_connected() && !s_live_active) {
+        if (limit_ms && now_ms() - t0 >= limit_ms) break;
+        if (cfg.bytes && off >= cfg.bytes) break;
+        job_t newer;
+        if (xQueuePeek(s_queue, &newer, 0) == pdTRUE) break;
+
+        int len = (int)sonya_ble_max_payload() - PROTO_BENCH_DATA_HDR;
+        if (cfg.frame && cfg.frame < len) len = cfg.frame;
+        if (cfg.bytes && cfg.bytes - off < (uint32_t)len) len = (int)(cfg.bytes - off);
+        if (len <= 0) break;
+
+        uint8_t hdr[PROTO_BENCH_DATA_HDR];
+        put_le32(hdr, bseq);
+        put_le32(hdr + 4, off);
+        sonya_ble_seg_t seg[2] = {
+            { hdr, sizeof(hdr) },
+            { s_bench_pat + off % PROTO_BENCH_PERIOD, (uint16_t)len },
+        };
+        int rc = sonya_ble_send_frame_segs(SONYA_TX_BULK, PROTO_BENCH_DATA, seg, 2);
+        if (rc == -2) {
+            retries++;
+            vTaskDelay(pdMS_TO_TICKS(30));
+            continue;
+        }
+        if (rc) break;
+        bseq++;
+        off += (uint32_t)len;
+
+        if (cfg.gap_ms) {
+            /* Pace against the schedule: gaps under a tick batch up, the average rate holds. */
+            int32_t ahead = (int32_t)(t0 + bseq * cfg.gap_ms - now_ms());
+            if (ahead > 0) vTaskDelay(pdMS_TO_TICKS(ahead) ? pdMS_TO_TICKS(ahead) : 1);
+        }
+    }
+
+    uint32_t dt = now_ms() - t0;
+    sonya_ble_tx_stats_t st;
+    sonya_ble_get_tx_stats(&st);
+    int busy;
+    int32_t us_per_kb;
+    cpu_usage(off, &busy, &us_per_kb);
+    log_link_stats("BENCH", dt, off);
+    (void)sonya_ble_set_tx_inflight(0);
+
+    bench_report("BENCH:n=%lu,B=%lu,ms=%lu",
+                 (unsigned long)bseq, (unsigned long)off, (unsigned long)dt);
+    bench_report("BENCH:fps=%lu,Bps=%lu,cpu=%d%%,task=%ldus/KB",
+                 (unsigned long)(dt ? (uint64_t)bseq * 1000U / dt : 0),
+                 (unsigned long)(dt ? (uint64_t)off * 1000U / dt : 0),
+                 busy, (long)us_per_kb);
+    bench_report("BENCH:retry=%lu,enomem=%lu,qfull=%lu,msys=%u,if=%d",
+                 (unsigned long)retries, (unsigned long)st.enomem,
+                 (unsigned long)st.q_full[SONYA_TX_BULK], (unsigned)st.msys_free_min, inflight);
 }
 
 /* ---- task ---- */
@@ -136,13 +1121,24 @@ static void stream_task(void *arg)
     (void)arg;
     for (;;) {
         if (s_live_active) {
-            live_loop();
+            // Opus encodes on its own core; PCM/ADPCM (or Opus set-up failure) stay here.
+            if (s_codec != PROTO_CODEC_OPUS || !live_opus_run(live_loop)) live_loop();
             continue;
         }
 
-        get_req_t req;
-        if (xQueueReceive(s_queue, &req, pdMS_TO_TICKS(50)) == pdTRUE) {
-            pull_window(&req);
+        job_t job;
+        if (xQueueReceive(s_queue, &job, pdMS_TO_TICKS(50)) == pdTRUE) {
+            if (job.kind == JOB_XFER) xfer_run(&job);
+            else if (job.kind == JOB_BENCH) bench_run();
+            else if (job.kind == JOB_NACK) nack_run();
+            else pull_window(&job);
+            s_bulk_last_ms = (uint32_t)esp_log_timestamp();
+        } else if (s_bulk_phase && !s_live_active &&
+                   (uint32_t)esp_log_timestamp() - s_bulk_last_ms >= BULK_IDLE_MS) {
+            // The phone sends the next GET right after a window; only fall back
+            // once it has gone quiet, so back-to-back windows keep BULK params.
+            s_bulk_phase = false;
+            (void)sonya_ble_set_link_phase(SONYA_LINK_LINGER);
         }
     }
 }
@@ -151,8 +1147,15 @@ static void stream_task(void *arg)
 
 esp_err_t pull_stream_init(void)
 {
-    s_queue = xQueueCreate(QUEUE_LEN, sizeof(get_req_t));
+    s_queue = xQueueCreate(QUEUE_LEN, sizeof(job_t));
     if (!s_queue) return ESP_ERR_NO_MEM;
+    s_ack_queue = xQueueCreate(ACK_QUEUE_LEN, sizeof(xack_t));
+    if (!s_ack_queue) return ESP_ERR_NO_MEM;
+    s_nack_queue = xQueueCreate(1, sizeof(nack_t));
+    if (!s_nack_queue) return ESP_ERR_NO_MEM;
+    for (size_t i = 0; i < sizeof(s_bench_pat); i++) {
+        s_bench_pat[i] = (uint8_t)(i % PROTO_BENCH_PERIOD);
+    }
 
     BaseType_t rc = xTaskCreate(stream_task, "pull_stream", STREAM_STACK, NULL, 5, &s_task);
     if (rc != pdPASS) return ESP_ERR_NO_MEM;
@@ -165,6 +1168,7 @@ void pull_stream_start_live(uint16_t rec_id)
 {
     s_live_id = rec_id;
     s_live_stop = false;
+    s_live_resume = false;
     s_live_active = true;
     ESP_LOGI(TAG, "start_live rec_id=%u", (unsigned)rec_id);
 }
@@ -179,30 +1183,281 @@ void pull_stream_stop_live(void)
     ESP_LOGI(TAG, "stop_live done");
 }
 
-void pull_stream_handle_get(uint16_t rec_id, uint32_t off, uint16_t want_len)
+int pull_stream_handle_get(uint16_t rec_id, uint32_t off, uint32_t want_len)
 {
-    if (!sonya_ble_is_connected()) return;
-    ESP_LOGI(TAG, "RX: GET rec_id=%u off=%lu want_len=%u",
-             (unsigned)rec_id, (unsigned long)off, (unsigned)want_len);
+    if (!sonya_ble_is_connected()) return PROTO_ST_OK;
+    ESP_LOGI(TAG, "RX: GET rec_id=%u off=%lu want_len=%lu",
+             (unsigned)rec_id, (unsigned long)off, (unsigned long)want_len);
 
-    if (rec_id != rec_store_cur_id() || rec_store_total_bytes() <= 0) {
-        sonya_ble_send_evt_error("NO_REC");
-        return;
+    if (rec_id != rec_store_cur_id() || rec_store_total_bytes() <= 0) return PROTO_ST_NO_REC;
+    if (off >= (uint32_t)rec_store_total_bytes()) return PROTO_ST_EOF;
+    job_t req = { .kind = JOB_GET, .rec_id = rec_id, .off = off, .want_len = want_len };
+    xQueueReset(s_queue);
+    xQueueSend(s_queue, &req, 0);
+    return PROTO_ST_OK;
+}
+
+static int range_cmp(const void *a, const void *b)
+{
+    uint32_t x = ((const proto_range_t *)a)->off, y = ((const proto_range_t *)b)->off;
+    return x < y ? -1 : x > y;
+}
+
+int pull_stream_handle_nack(uint16_t rec_id, const proto_range_t *ranges, int n)
+{
+    if (!sonya_ble_is_connected()) return PROTO_ST_OK;
+    uint32_t total = (uint32_t)rec_store_total_bytes();
+    if (rec_id != rec_store_cur_id() || total == 0) return PROTO_ST_NO_REC;
+    if (!ranges || n <= 0) return PROTO_ST_UNKNOWN;
+    if (n > PROTO_NACK_MAX) n = PROTO_NACK_MAX;
+
+    // Sort by offset, clip to what is recorded and merge overlaps: one forward pass over rec_store.
+    nack_t k = { .rec_id = rec_id };
+    memcpy(k.r, ranges, (size_t)n * sizeof(*ranges));
+    qsort(k.r, (size_t)n, sizeof(k.r[0]), range_cmp);
+    uint32_t bytes = 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t off = k.r[i].off;
+        if (off >= total) break;
+        uint32_t end = k.r[i].len > total - off ? total : off + k.r[i].len;
+        proto_range_t *last = k.n ? &k.r[k.n - 1] : NULL;
+        if (last && off <= last->off + last->len) {
+            if (end > last->off + last->len) {
+                bytes += end - (last->off + last->len);
+                last->len = end - last->off;
+            }
+            continue;
+        }
+        k.r[k.n++] = (proto_range_t){ off, end - off };
+        bytes += end - off;
     }
-    if (off >= (uint32_t)rec_store_total_bytes()) {
-        sonya_ble_send_evt_error("EOF");
-        return;
+    ESP_LOGI(TAG, "RX: NACK rec_id=%u ranges=%d->%u bytes=%lu", (unsigned)rec_id, n,
+             (unsigned)k.n, (unsigned long)bytes);
+    if (k.n == 0) return PROTO_ST_EOF;
+
+    sonya_ble_set_loss_recovery();
+    xQueueOverwrite(s_nack_queue, &k);
+    if (s_live_active && rec_id == s_live_id) s_fec_nack_bytes += bytes;
+    if (!(s_live_active && rec_id == s_live_id)) {
+        // Live picks the ranges up itself between frames.
+        job_t req = { .kind = JOB_NACK, .rec_id = rec_id };
+        xQueueReset(s_queue);
+        xQueueSend(s_queue, &req, 0);
+    }
+    return PROTO_ST_OK;
+}
+
+int pull_stream_handle_xget(uint16_t rec_id, uint32_t off)
+{
+    if (!sonya_ble_is_connected()) return PROTO_ST_OK;
+    ESP_LOGI(TAG, "RX: XGET rec_id=%u off=%lu", (unsigned)rec_id, (unsigned long)off);
+
+    if (rec_id != rec_store_cur_id() || !rec_store_is_committed()) return PROTO_ST_NO_REC;
+    if (off >= (uint32_t)rec_store_total_bytes()) return PROTO_ST_EOF;
+    sonya_ble_set_loss_recovery();
+    job_t req = { .kind = JOB_XFER, .rec_id = rec_id, .off = off };
+    xQueueReset(s_queue);
+    xQueueSend(s_queue, &req, 0);
+    return PROTO_ST_OK;
+}
+
+int pull_stream_handle_resume(uint16_t rec_id, uint32_t hwm)
+{
+    if (!sonya_ble_is_connected()) return PROTO_ST_OK;
+    ESP_LOGI(TAG, "RX: RESUME rec_id=%u hwm=%lu", (unsigned)rec_id, (unsigned long)hwm);
+
+    uint32_t total = (uint32_t)rec_store_total_bytes();
+    if (rec_id != rec_store_cur_id() || total == 0) return PROTO_ST_NO_REC;
+    if (s_live_active && rec_id == s_live_id) {
+        s_live_resume_off = hwm;
+        s_live_resume = true;
+        return PROTO_ST_OK;
+    }
+    if (!rec_store_is_committed()) return PROTO_ST_BUSY;
+    if (hwm >= total) return PROTO_ST_EOF;
+    job_t req = { .kind = JOB_GET, .rec_id = rec_id, .off = hwm, .want_len = total - hwm };
+    xQueueReset(s_queue);
+    xQueueSend(s_queue, &req, 0);
+    return PROTO_ST_OK;
+}
+
+void pull_stream_announce(void)
+{
+    uint16_t rid = rec_store_cur_id();
+    uint32_t total = (uint32_t)rec_store_total_bytes();
+    if (total == 0) return;
+
+    bool committed = rec_store_is_committed();
+    uint32_t crc = committed ? rec_store_crc32() : 0;
+    uint16_t sr16 = (uint16_t)CONFIG_AUDIO_SR;
+    uint8_t flags = (uint8_t)((committed ? PROTO_REC_INFO_F_COMMITTED : 0) |
+                              (s_live_active && rid == s_live_id ? PROTO_REC_INFO_F_LIVE : 0));
+
+    uint8_t p[2 + 4 + 4 + 1 + 2] = { (uint8_t)(rid & 0xFF), (uint8_t)(rid >> 8) };
+    put_le32(p + 2, total);
+    put_le32(p + 6, crc);
+    p[10] = flags;
+    p[11] = (uint8_t)(sr16 & 0xFF);
+    p[12] = (uint8_t)(sr16 >> 8);
+    ESP_LOGI(TAG, "REC_INFO rec_id=%u total=%lu flags=0x%02x",
+             (unsigned)rid, (unsigned long)total, (unsigned)flags);
+    sonya_ble_send_frame(PROTO_EVT_REC_INFO, p, (uint16_t)sizeof(p));
+}
+
+static bool codec_supported(uint8_t codec)
+{
+    switch (codec) {
+    case PROTO_CODEC_PCM16:
+    case PROTO_CODEC_IMA_ADPCM:
+    case PROTO_CODEC_LOSSLESS:
+#if CONFIG_LIVE_OPUS_ENABLE
+    case PROTO_CODEC_OPUS:
+#endif
+        return true;
+    default:
+        return false;
     }
-    get_req_t req = { .rec_id = rec_id, .off = off, .want_len = want_len };
+}
+
+void pull_stream_set_codec(uint8_t codec)
+{
+    static const char *const name[] = { "pcm16", "ima-adpcm", "opus", "lossless" };
+    if (!codec_supported(codec)) return;
+    if (codec != s_codec) ESP_LOGI(TAG, "codec %s", name[codec]);
+    s_codec = codec;
+}
+
+uint8_t pull_stream_codec(void)
+{
+    return s_codec;
+}
+
+void pull_stream_send_caps(uint8_t phone_ver)
+{
+    uint8_t codecs = 0;
+    for (uint8_t c = 0; c < 8; c++) {
+        if (codec_supported(c)) codecs |= (uint8_t)(1U << c);
+    }
+    uint16_t features = PROTO_FEAT_XGET | PROTO_FEAT_RESUME | PROTO_FEAT_BENCH |
+                        PROTO_FEAT_LIVE | PROTO_FEAT_SESS_PULL | PROTO_FEAT_BIN_CMD |
+                        PROTO_FEAT_V2_HDR | PROTO_FEAT_NACK | PROTO_FEAT_FEC |
+                        PROTO_FEAT_BATCH | PROTO_FEAT_STATUS;
+#if CONFIG_BLE_COC_ENABLE
+    features |= PROTO_FEAT_COC;
+#endif
+    rec_store_pool_stats_t ps;
+    rec_store_pool_stats(&ps);
+    uint32_t store = (uint32_t)ps.blocks_total * (uint32_t)ps.block_size;
+    uint16_t max = sonya_ble_max_payload();
+    uint16_t mtu = sonya_ble_att_mtu();
+    uint16_t coc = sonya_ble_coc_max_payload();
+    uint16_t sr16 = (uint16_t)CONFIG_AUDIO_SR;
+
+    uint8_t p[1 + 1 + 2 + 2 + 2 + 4 + 2 + 2] = {
+        PROTO_VERSION, codecs,
+        (uint8_t)(max & 0xFF), (uint8_t)(max >> 8),
+        (uint8_t)(mtu & 0xFF), (uint8_t)(mtu >> 8),
+        (uint8_t)(coc & 0xFF), (uint8_t)(coc >> 8),
+    };
+    put_le32(p + 8, store);
+    p[12] = (uint8_t)(features & 0xFF);
+    p[13] = (uint8_t)(features >> 8);
+    p[14] = (uint8_t)(sr16 & 0xFF);
+    p[15] = (uint8_t)(sr16 >> 8);
+    ESP_LOGI(TAG, "HELLO v%u -> CAPS v%u codecs=0x%02x max=%u mtu=%u coc=%u store=%lu feat=0x%04x",
+             (unsigned)phone_ver, PROTO_VERSION, (unsigned)codecs, (unsigned)max, (unsigned)mtu,
+             (unsigned)coc, (unsigned long)store, (unsigned)features);
+    sonya_ble_send_frame(PROTO_EVT_CAPS, p, (uint16_t)sizeof(p));
+}
+
+uint8_t pull_stream_set_fec(uint8_t mode, uint32_t loss_ppm)
+{
+    if (mode > PROTO_FEC_K_MAX) mode = PROTO_FEC_K_MAX;
+    s_fec_mode = mode;
+    if (loss_ppm) s_fec_loss_ppm = loss_ppm;
+    uint8_t k = mode == PROTO_FEC_OFF ? 0 : fec_k();
+    ESP_LOGI(TAG, "FEC mode=%u k=%u loss=%luppm", (unsigned)mode, (unsigned)k,
+             (unsigned long)s_fec_loss_ppm);
+    return k;
+}
+
+static void set_frame_format(bool v2, bool hcrc)
+{
+    sonya_ble_set_frame_format(v2, hcrc);
+    memset(s_anchor, 0, sizeof(s_anchor));
+    s_v2 = v2;
+}
+
+bool pull_stream_set_session(const proto_session_t *sess)
+{
+    uint8_t mode = sess ? (uint8_t)(sess->mode & PROTO_SESS_MODE_MASK) : 0xFF;
+    uint8_t flags = sess ? (uint8_t)(sess->mode & ~PROTO_SESS_MODE_MASK) : 0;
+    if (!sess || !codec_supported(sess->codec) ||
+        (mode != PROTO_SESS_LIVE && mode != PROTO_SESS_PULL) ||
+        (flags & ~(PROTO_SESS_F_V2 | PROTO_SESS_F_HCRC | PROTO_SESS_F_BATCH | PROTO_SESS_F_STATUS)) ||
+        ((flags & (PROTO_SESS_F_V2 | PROTO_SESS_F_HCRC)) == PROTO_SESS_F_HCRC)) {
+        return false;
+    }
+    pull_stream_set_codec(sess->codec);
+    // Below this the frame headers (up to 12 B) would eat most of the payload.
+    s_frame_max = sess->frame && sess->frame < SESS_FRAME_MIN ? SESS_FRAME_MIN : sess->frame;
+    s_sess_mode = sess->mode;
+    s_sess_ver = PROTO_VERSION;
+    set_frame_format((flags & PROTO_SESS_F_V2) != 0, (flags & PROTO_SESS_F_HCRC) != 0);
+    sonya_ble_set_batch((flags & PROTO_SESS_F_BATCH) != 0);
+    ESP_LOGI(TAG, "SESS codec=%u frame=%u mode=%u", (unsigned)s_codec, (unsigned)s_frame_max,
+             (unsigned)s_sess_mode);
+    return true;
+}
+
+void pull_stream_reset_session(void)
+{
+    pull_stream_set_codec(PROTO_CODEC_PCM16);
+    s_frame_max = 0;
+    s_sess_mode = PROTO_SESS_LIVE;
+    s_sess_ver = 0;
+    s_fec_mode = PROTO_FEC_OFF;
+    s_fec_loss_ppm = 0;
+    set_frame_format(false, false);
+    sonya_ble_set_batch(false);
+}
+
+void pull_stream_get_session(proto_session_t *out)
+{
+    out->ver = s_sess_ver;
+    out->codec = s_codec;
+    out->frame = s_frame_max;
+    out->mode = s_sess_mode;
+}
+
+int pull_stream_handle_bench(const pull_stream_bench_t *cfg)
+{
+    if (!sonya_ble_is_connected() || !cfg) return PROTO_ST_OK;
+    if (s_live_active) return PROTO_ST_BUSY;
+    s_bench = *cfg;
+    job_t req = { .kind = JOB_BENCH };
     xQueueReset(s_queue);
     xQueueSend(s_queue, &req, 0);
+    return PROTO_ST_OK;
+}
+
+void pull_stream_handle_xack(uint16_t rec_id, uint16_t cum, uint32_t sack)
+{
+    xack_t a = { .rec_id = rec_id, .cum = cum, .sack = sack };
+    if (xQueueSend(s_ack_queue, &a, 0) != pdTRUE) {
+        /* Cumulative ACKs supersede each other: drop the oldest and keep the newest. */
+        xack_t old;
+        xQueueReceive(s_ack_queue, &old, 0);
+        xQueueSend(s_ack_queue, &a, 0);
+    }
 }
 
 void pull_stream_handle_done(uint16_t rec_id)
 {
     if (rec_id == rec_store_cur_id()) {
-        ESP_LOGI(TAG, "RX: DONE rec_id=%u -> free", (unsigned)rec_id);
         xQueueReset(s_queue);
-        rec_store_clear();
+        xQueueReset(s_nack_queue);
+        bool freed = rec_store_release(rec_id);
+        ESP_LOGI(TAG, "RX: DONE rec_id=%u -> %s", (unsigned)rec_id, freed ? "free" : "busy");
     }
 }
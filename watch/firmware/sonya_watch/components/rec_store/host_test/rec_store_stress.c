@@ -0,0 +1,163 @@
+/**
+ * @file rec_store_stress.c
+ * @brief Host stress test: one writer, several readers, recordings cleared under them
+ *
+ * The writer records back to back (begin clears the previous one) and a releaser
+ * frees committed recordings as DONE would. Readers copy (read_rec) or peek
+ * (peek_rec) random ranges of whatever recording is current and check every byte
+ * against the pattern of that rec_id. A block recycled under a running reader shows
+ * up as bytes of another recording; a lost reader reference as a pool leak.
+ *
+ *     cmake -S . -B build && cmake --build build && ctest --test-dir build
+ */
+
+#include "rec_store.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define READERS     4
+#define RECORDINGS  400
+#define READ_MAX    (3 * 8192)   // spans up to four blocks
+
+static atomic_bool  s_stop;
+static atomic_ulong s_bad;
+static atomic_ulong s_reads;
+static atomic_ulong s_peeks;
+static atomic_ulong s_released;
+
+static uint8_t pattern(uint16_t id, uint32_t off)
+{
+    return (uint8_t)((off * 7u) ^ (off >> 9) ^ (id * 131u));
+}
+
+static bool check(const char *what, uint16_t id, uint32_t off, const uint8_t *p, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (p[i] != pattern(id, off + (uint32_t)i)) {
+            fprintf(stderr, "%s: rec %u off %u: got 0x%02x want 0x%02x\n", what, (unsigned)id,
+                    (unsigned)(off + i), p[i], pattern(id, off + (uint32_t)i));
+            atomic_fetch_add(&s_bad, 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *reader(void *arg)
+{
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    uint8_t *buf = malloc(READ_MAX);
+    while (!atomic_load(&s_stop)) {
+        uint16_t id = rec_store_cur_id();
+        int total = rec_store_total_bytes();
+        if (id == 0 || total <= 0) {
+            sched_yield();
+            continue;
+        }
+        uint32_t off = (uint32_t)rand_r(&seed) % (uint32_t)total;
+        size_t len = 1 + (size_t)rand_r(&seed) % READ_MAX;
+        if (rand_r(&seed) & 1) {
+            int n = rec_store_read_rec(id, off, buf, len);
+            if (n > 0) check("read", id, off, buf, n);
+            atomic_fetch_add(&s_reads, 1);
+        } else {
+            const uint8_t *p = NULL;
+            int n = rec_store_peek_rec(id, off, len, &p);
+            if (n > 0) {
+                check("peek", id, off, p, n);
+                sched_yield();   // hold the reference while the writer moves on
+                check("peek held", id, off, p, n);
+                rec_store_peek_end();
+            }
+            atomic_fetch_add(&s_peeks, 1);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+static void *releaser(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&s_stop)) {
+        uint16_t id = rec_store_cur_id();
+        if (id != 0 && rec_store_is_committed() && rec_store_release(id)) {
+            atomic_fetch_add(&s_released, 1);
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void record(unsigned *seed, size_t cap)
+{
+    uint16_t id = rec_store_begin();
+    size_t total = 1 + (size_t)rand_r(seed) % cap;
+    uint8_t chunk[1024];
+    size_t off = 0;
+    while (off < total) {
+        size_t n = 1 + (size_t)rand_r(seed) % sizeof(chunk);
+        if (n > total - off) n = total - off;
+        if (rand_r(seed) & 1) {
+            for (size_t i = 0; i < n; i++) chunk[i] = pattern(id, (uint32_t)(off + i));
+            if (!rec_store_append(chunk, n)) break;
+        } else {
+            // The capture path: write straight into the tail block, then publish.
+            size_t room = 0;
+            uint8_t *t = rec_store_tail_ptr(&room);
+            if (!t) {
+                if (!rec_store_alloc_block()) break;
+                continue;
+            }
+            if (n > room) n = room;
+            for (size_t i = 0; i < n; i++) t[i] = pattern(id, (uint32_t)(off + i));
+            rec_store_tail_advance(n);
+        }
+        off += n;
+        if ((rand_r(seed) & 7) == 0) sched_yield();
+    }
+    rec_store_commit();
+    // Sometimes leave the committed recording up for the releaser (DONE), sometimes
+    // let the next begin clear it.
+    if (rand_r(seed) & 1) usleep((useconds_t)(rand_r(seed) % 500));
+}
+
+int main(void)
+{
+    if (rec_store_init() != ESP_OK) {
+        fprintf(stderr, "rec_store_init failed\n");
+        return 1;
+    }
+    rec_store_pool_stats_t ps;
+    rec_store_pool_stats(&ps);
+    size_t cap = (size_t)ps.blocks_total * ps.block_size;
+
+    pthread_t rd[READERS], rel;
+    for (int i = 0; i < READERS; i++) pthread_create(&rd[i], NULL, reader, (void *)(uintptr_t)(i + 1));
+    pthread_create(&rel, NULL, releaser, NULL);
+
+    unsigned seed = 12345;
+    for (int r = 0; r < RECORDINGS; r++) record(&seed, cap);
+
+    atomic_store(&s_stop, true);
+    for (int i = 0; i < READERS; i++) pthread_join(rd[i], NULL);
+    pthread_join(rel, NULL);
+
+    rec_store_clear();
+    rec_store_pool_stats(&ps);
+    printf("recordings=%d released=%lu reads=%lu peeks=%lu bad=%lu pool=%u/%u fail=%lu\n",
+           RECORDINGS, atomic_load(&s_released), atomic_load(&s_reads), atomic_load(&s_peeks),
+           atomic_load(&s_bad), (unsigned)ps.blocks_free, (unsigned)ps.blocks_total,
+           (unsigned long)ps.alloc_fail);
+    if (ps.blocks_free != ps.blocks_total) {
+        fprintf(stderr, "pool leak: %u of %u blocks free\n", (unsigned)ps.blocks_free,
+                (unsigned)ps.blocks_total);
+        return 1;
+    }
+    return atomic_load(&s_bad) ? 1 : 0;
+}
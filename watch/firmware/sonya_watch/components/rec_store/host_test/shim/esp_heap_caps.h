@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdlib.h>
+
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_8BIT     (1 << 2)
+
+static inline void *heap_caps_malloc(size_t size, unsigned caps)
+{
+    (void)caps;
+    return malloc(size);
+}
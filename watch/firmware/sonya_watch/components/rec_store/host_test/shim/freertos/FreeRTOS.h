@@ -0,0 +1,16 @@
+#pragma once
+
+/* Host shim: just enough FreeRTOS for rec_store.c, on pthreads. */
+#include <pthread.h>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFu)
+
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux)  pthread_mutex_unlock(mux)
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+
+typedef pthread_mutex_t *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t m = malloc(sizeof(*m));
+    if (m) pthread_mutex_init(m, NULL);
+    return m;
+}
+
+static inline int xSemaphoreTake(SemaphoreHandle_t m, TickType_t ticks)
+{
+    (void)ticks;
+    return pthread_mutex_lock(m) == 0 ? pdTRUE : pdFALSE;
+}
+
+static inline int xSemaphoreGive(SemaphoreHandle_t m)
+{
+    return pthread_mutex_unlock(m) == 0 ? pdTRUE : pdFALSE;
+}
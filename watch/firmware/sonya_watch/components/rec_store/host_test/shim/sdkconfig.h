@@ -0,0 +1,6 @@
+#pragma once
+
+/* Small pool so recordings wrap through it quickly: (2 + 1) s * 32000 B / 8 KiB + 2 = 14 blocks */
+#define CONFIG_REC_MAX_SEC            2
+#define CONFIG_AUDIO_SR               16000
+#define CONFIG_REC_POOL_MARGIN_BLOCKS 2
@@ -3,9 +3,29 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "esp_err.h"
 
+typedef struct {
+    uint16_t blocks_total;
+    uint16_t blocks_free;
+    uint16_t blocks_min_free;   // low watermark since boot
+    uint32_t alloc_fail;        // pool exhausted count
+    size_t   block_size;
+} rec_store_pool_stats_t;
+
+// Reserves the block pool (REC_MAX_SEC worth of blocks + margin). Call once at boot.
+esp_err_t rec_store_init(void);
+void      rec_store_pool_stats(rec_store_pool_stats_t *out);
+
+/*
+ * Threading: one producer task calls begin/alloc_block/tail_ptr/tail_advance/append/commit.
+ * Any task may call total_bytes/read/read_rec concurrently; published bytes are
+ * never recycled while a read is in progress (clear waits for readers to leave).
+ */
 void     rec_store_clear(void);
 uint16_t rec_store_begin(void);
+// Frees rec_id if it is the current, committed recording. Returns true if freed.
+bool     rec_store_release(uint16_t rec_id);
 
 bool     rec_store_append(const uint8_t *data, size_t len);
 bool     rec_store_alloc_block(void);
@@ -16,5 +36,18 @@ int      rec_store_total_bytes(void);
 uint32_t rec_store_crc32(void);
 uint16_t rec_store_commit(void);
 uint16_t rec_store_cur_id(void);
+bool     rec_store_is_committed(void);
 
 int      rec_store_read(uint32_t offset, uint8_t *dst, size_t max_len);
+// Same as rec_store_read, but returns -1 if rec_id is no longer the current recording.
+int      rec_store_read_rec(uint16_t rec_id, uint32_t offset, uint8_t *dst, size_t max_len);
+
+/*
+ * Zero-copy view: points *out at up to max_len published bytes of rec_id at offset,
+ * stopping at a block boundary (call again for the rest). Returns the span length,
+ * 0 at the end of data, or -1 if rec_id is no longer current. On > 0 the caller holds
+ * a read reference that keeps the block alive and must call rec_store_peek_end()
+ * once per successful peek, without calling begin/clear/release in between.
+ */
+int      rec_store_peek_rec(uint16_t rec_id, uint32_t offset, size_t max_len, const uint8_t **out);
+void     rec_store_peek_end(void);
@@ -1,11 +1,19 @@
 #include "rec_store.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include <stdatomic.h>
 #include <string.h>
 
 static const char *TAG = "rec_store";
 
 #define BLOCK_CAP (8 * 1024)
+// REC_MAX_SEC of PCM plus one extra second for the record tail, rounded up to whole blocks.
+#define POOL_AUDIO_BYTES ((CONFIG_REC_MAX_SEC + 1) * CONFIG_AUDIO_SR * 2)
+#define POOL_BLOCKS      ((POOL_AUDIO_BYTES + BLOCK_CAP - 1) / BLOCK_CAP + CONFIG_REC_POOL_MARGIN_BLOCKS)
 
 typedef struct block {
     struct block *next;
@@ -14,12 +22,35 @@ typedef struct block {
     uint8_t data[];
 } block_t;
 
-static block_t *s_head = NULL;
-static block_t *s_tail = NULL;
-static int      s_bytes = 0;
-static uint32_t s_crc32 = 0;
-static uint16_t s_cur_id = 0;
-static uint16_t s_next_id = 1;
+/*
+ * Concurrency model (single producer, any number of readers):
+ *  - The producer (recording task) owns s_tail and block->used. Blocks are always
+ *    filled to BLOCK_CAP before the next one is linked, so readers locate data by
+ *    offset / BLOCK_CAP and never look at ->used.
+ *  - New bytes become visible only via a release-store of s_pub_bytes, after the
+ *    data and any ->next link were written. Readers acquire-load it first.
+ *  - Readers bracket list walks with s_readers. Clearing unlinks the chain, then
+ *    waits for s_readers to drain before returning blocks to the pool, so a block
+ *    is never recycled under a running rec_store_read().
+ *  - begin/commit/clear/release are serialized by s_life_mu (never taken by readers).
+ */
+static _Atomic(block_t *) s_head = NULL;
+static block_t           *s_tail = NULL;
+static _Atomic uint32_t   s_pub_bytes = 0;
+static _Atomic uint16_t   s_cur_id = 0;
+static _Atomic bool       s_committed = false;
+static _Atomic int        s_readers = 0;
+static uint32_t           s_crc32 = 0;
+static uint16_t           s_next_id = 1;
+static SemaphoreHandle_t  s_life_mu = NULL;
+
+/* ---- block pool (reserved once at boot, O(1) alloc/free) ---- */
+static uint8_t     *s_pool_mem = NULL;
+static block_t     *s_free = NULL;
+static uint16_t     s_free_cnt = 0;
+static uint16_t     s_free_min = 0;
+static uint32_t     s_alloc_fail = 0;
+static portMUX_TYPE s_pool_mux = portMUX_INITIALIZER_UNLOCKED;
 
 /* ---- CRC32 ---- */
 static uint32_t s_crc_tbl[256];
@@ -48,9 +79,16 @@ static uint32_t crc_update(uint32_t crc, const uint8_t *d, size_t n)
 /* ---- helpers ---- */
 static block_t *alloc_block(void)
 {
-    size_t sz = sizeof(block_t) + BLOCK_CAP;
-    block_t *b = (block_t *)heap_caps_malloc(sz, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    if (!b) b = (block_t *)heap_caps_malloc(sz, MALLOC_CAP_8BIT);
+    portENTER_CRITICAL(&s_pool_mux);
+    block_t *b = s_free;
+    if (b) {
+        s_free = b->next;
+        s_free_cnt--;
+        if (s_free_cnt < s_free_min) s_free_min = s_free_cnt;
+    } else {
+        s_alloc_fail++;
+    }
+    portEXIT_CRITICAL(&s_pool_mux);
     if (!b) return NULL;
     b->next = NULL;
     b->used = 0;
@@ -58,36 +96,119 @@ static block_t *alloc_block(void)
     return b;
 }
 
-/* ---- public API ---- */
-
-void rec_store_clear(void)
+static void free_chain(block_t *b)
 {
-    for (block_t *b = s_head; b; ) {
+    while (b) {
         block_t *n = b->next;
-        heap_caps_free(b);
+        portENTER_CRITICAL(&s_pool_mux);
+        b->next = s_free;
+        s_free = b;
+        s_free_cnt++;
+        portEXIT_CRITICAL(&s_pool_mux);
         b = n;
     }
-    s_head = s_tail = NULL;
-    s_bytes = 0;
+}
+
+/* ---- public API ---- */
+
+esp_err_t rec_store_init(void)
+{
+    if (s_pool_mem) return ESP_OK;
+
+    s_life_mu = xSemaphoreCreateMutex();
+    if (!s_life_mu) return ESP_ERR_NO_MEM;
+
+    size_t stride = sizeof(block_t) + BLOCK_CAP;
+    size_t total  = stride * (size_t)POOL_BLOCKS;
+    s_pool_mem = (uint8_t *)heap_caps_malloc(total, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!s_pool_mem) {
+        ESP_LOGE(TAG, "pool alloc failed: blocks=%d bytes=%u", POOL_BLOCKS, (unsigned)total);
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = POOL_BLOCKS - 1; i >= 0; i--) {
+        block_t *b = (block_t *)(s_pool_mem + (size_t)i * stride);
+        b->next = s_free;
+        s_free = b;
+    }
+    s_free_cnt = POOL_BLOCKS;
+    s_free_min = POOL_BLOCKS;
+    ESP_LOGI(TAG, "pool ready: blocks=%d x %d B (%u KB, max_sec=%d)",
+             POOL_BLOCKS, BLOCK_CAP, (unsigned)(total / 1024), CONFIG_REC_MAX_SEC);
+    return ESP_OK;
+}
+
+void rec_store_pool_stats(rec_store_pool_stats_t *out)
+{
+    if (!out) return;
+    portENTER_CRITICAL(&s_pool_mux);
+    out->blocks_total    = s_pool_mem ? POOL_BLOCKS : 0;
+    out->blocks_free     = s_free_cnt;
+    out->blocks_min_free = s_free_min;
+    out->alloc_fail      = s_alloc_fail;
+    portEXIT_CRITICAL(&s_pool_mux);
+    out->block_size = BLOCK_CAP;
+}
+
+static void reader_enter(void) { atomic_fetch_add(&s_readers, 1); }
+static void reader_exit(void)  { atomic_fetch_sub(&s_readers, 1); }
+
+static void lock_life(void)   { if (s_life_mu) xSemaphoreTake(s_life_mu, portMAX_DELAY); }
+static void unlock_life(void) { if (s_life_mu) xSemaphoreGive(s_life_mu); }
+
+static void clear_locked(void)
+{
+    atomic_store(&s_cur_id, 0);
+    atomic_store(&s_committed, false);
+    atomic_store(&s_pub_bytes, 0);
+    block_t *chain = atomic_exchange(&s_head, NULL);
+    s_tail = NULL;
     s_crc32 = 0;
-    s_cur_id = 0;
+
+    // Grace period: any reader that entered before the unlink may still hold `chain`.
+    // Exchange and this load are seq_cst, like the readers' increment and head load.
+    while (atomic_load(&s_readers) > 0) {
+        vTaskDelay(1);
+    }
+    free_chain(chain);
+}
+
+void rec_store_clear(void)
+{
+    lock_life();
+    clear_locked();
+    unlock_life();
+}
+
+bool rec_store_release(uint16_t rec_id)
+{
+    lock_life();
+    bool ok = rec_id != 0 && rec_id == atomic_load(&s_cur_id) && atomic_load(&s_committed);
+    if (ok) clear_locked();
+    unlock_life();
+    return ok;
 }
 
 uint16_t rec_store_begin(void)
 {
-    rec_store_clear();
-    s_cur_id = s_next_id++;
+    lock_life();
+    clear_locked();
+    uint16_t id = s_next_id++;
     if (s_next_id == 0) s_next_id = 1;
-    ESP_LOGI(TAG, "begin id=%u", (unsigned)s_cur_id);
-    return s_cur_id;
+    atomic_store(&s_cur_id, id);
+    unlock_life();
+    ESP_LOGI(TAG, "begin id=%u", (unsigned)id);
+    return id;
 }
 
 bool rec_store_alloc_block(void)
 {
     block_t *b = alloc_block();
     if (!b) return false;
-    if (!s_head) s_head = b;
-    if (s_tail) s_tail->next = b;
+    if (s_tail) {
+        s_tail->next = b;
+    } else {
+        atomic_store_explicit(&s_head, b, memory_order_release);
+    }
     s_tail = b;
     return true;
 }
@@ -106,7 +227,8 @@ void rec_store_tail_advance(size_t n)
 {
     if (!s_tail) return;
     s_tail->used += n;
-    s_bytes += (int)n;
+    uint32_t pub = atomic_load_explicit(&s_pub_bytes, memory_order_relaxed);
+    atomic_store_explicit(&s_pub_bytes, pub + (uint32_t)n, memory_order_release);
 }
 
 bool rec_store_append(const uint8_t *data, size_t len)
@@ -119,58 +241,114 @@ bool rec_store_append(const uint8_t *data, size_t len)
         size_t room = s_tail->cap - s_tail->used;
         size_t take = (len - off) < room ? (len - off) : room;
         memcpy(s_tail->data + s_tail->used, data + off, take);
-        s_tail->used += take;
-        s_bytes += (int)take;
+        rec_store_tail_advance(take);
         off += take;
     }
     return true;
 }
 
-int rec_store_total_bytes(void) { return s_bytes; }
+int rec_store_total_bytes(void)
+{
+    return (int)atomic_load_explicit(&s_pub_bytes, memory_order_acquire);
+}
 
 uint32_t rec_store_crc32(void)  { return s_crc32; }
-uint16_t rec_store_cur_id(void) { return s_cur_id; }
+uint16_t rec_store_cur_id(void) { return atomic_load(&s_cur_id); }
+bool     rec_store_is_committed(void) { return atomic_load(&s_committed); }
 
 uint16_t rec_store_commit(void)
 {
+    lock_life();
     uint32_t crc = 0xFFFFFFFFU;
-    for (block_t *b = s_head; b; b = b->next)
+    for (block_t *b = atomic_load(&s_head); b; b = b->next)
         crc = crc_update(crc, b->data, b->used);
     s_crc32 = ~crc;
-    if (s_cur_id == 0) {
-        s_cur_id = s_next_id++;
+    uint16_t id = atomic_load(&s_cur_id);
+    if (id == 0) {
+        id = s_next_id++;
         if (s_next_id == 0) s_next_id = 1;
+        atomic_store(&s_cur_id, id);
     }
+    atomic_store(&s_committed, true);
+    unlock_life();
     ESP_LOGI(TAG, "commit id=%u bytes=%d crc32=0x%08lx",
-             (unsigned)s_cur_id, s_bytes, (unsigned long)s_crc32);
-    return s_cur_id;
+             (unsigned)id, rec_store_total_bytes(), (unsigned long)s_crc32);
+    return id;
 }
 
-int rec_store_read(uint32_t offset, uint8_t *dst, size_t max_len)
+static int read_locked(uint32_t offset, uint8_t *dst, size_t max_len)
 {
-    if (!s_head || offset >= (uint32_t)s_bytes) return 0;
+    uint32_t total = atomic_load_explicit(&s_pub_bytes, memory_order_acquire);
+    // seq_cst, paired with clear_locked(): either clear sees our s_readers increment and
+    // waits, or we see the unlinked (NULL) head. Acquire alone lets both miss.
+    block_t *b = atomic_load(&s_head);
+    if (!b || offset >= total) return 0;
 
-    uint32_t pos = 0;
-    block_t *b = s_head;
-    while (b && (pos + b->used) <= offset) {
-        pos += (uint32_t)b->used;
+    for (uint32_t skip = offset / BLOCK_CAP; skip > 0 && b; skip--)
         b = b->next;
-    }
 
     size_t copied = 0;
     uint32_t cur = offset;
-    while (b && copied < max_len && cur < (uint32_t)s_bytes) {
-        uint32_t in_block = cur - pos;
-        size_t avail = b->used - in_block;
-        size_t need  = max_len - copied;
-        size_t take  = avail < need ? avail : need;
+    while (b && copied < max_len && cur < total) {
+        uint32_t in_block = cur % BLOCK_CAP;
+        size_t avail = BLOCK_CAP - in_block;
+        if (avail > total - cur) avail = total - cur;
+        size_t need = max_len - copied;
+        size_t take = avail < need ? avail : need;
         memcpy(dst + copied, b->data + in_block, take);
         copied += take;
         cur    += (uint32_t)take;
-        if (in_block + take >= b->used) {
-            pos += (uint32_t)b->used;
-            b = b->next;
-        }
+        // Only follow ->next into published data: the producer may be linking it right now.
+        if (cur % BLOCK_CAP == 0 && cur < total) b = b->next;
     }
     return (int)copied;
 }
+
+int rec_store_peek_rec(uint16_t rec_id, uint32_t offset, size_t max_len, const uint8_t **out)
+{
+    reader_enter();
+    if (rec_id == 0 || rec_id != atomic_load(&s_cur_id)) {
+        reader_exit();
+        return -1;
+    }
+    uint32_t total = atomic_load_explicit(&s_pub_bytes, memory_order_acquire);
+    block_t *b = atomic_load(&s_head);   // seq_cst, see read_locked()
+    if (!b || offset >= total || max_len == 0) {
+        reader_exit();
+        return 0;
+    }
+    for (uint32_t skip = offset / BLOCK_CAP; skip > 0 && b; skip--)
+        b = b->next;
+    if (!b) {
+        reader_exit();
+        return 0;
+    }
+    uint32_t in_block = offset % BLOCK_CAP;
+    size_t span = BLOCK_CAP - in_block;
+    if (span > total - offset) span = total - offset;
+    if (span > max_len) span = max_len;
+    *out = b->data + in_block;
+    return (int)span;
+}
+
+void rec_store_peek_end(void)
+{
+    reader_exit();
+}
+
+int rec_store_read(uint32_t offset, uint8_t *dst, size_t max_len)
+{
+    reader_enter();
+    int n = read_locked(offset, dst, max_len);
+    reader_exit();
+    return n;
+}
+
+int rec_store_read_rec(uint16_t rec_id, uint32_t offset, uint8_t *dst, size_t max_len)
+{
+    reader_enter();
+    int n = (rec_id != 0 && rec_id == atomic_load(&s_cur_id))
+            ? read_locked(offset, dst, max_len) : -1;
+    reader_exit();
+    return n;
+}
@@ -13,6 +13,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "protocol.h"
 
 /* SONYA service UUID: 12345678-1234-5678-1234-56789abcdef0 */
 #define SONYA_SVC_UUID  0x12, 0x34, 0x56, 0x78, 0x12, 0x34, 0x56, 0x78, \
@@ -22,17 +23,72 @@
 #define SONYA_TX_UUID   0x12, 0x34, 0x56, 0x78, 0x12, 0x34, 0x56, 0x78, \
                         0x12, 0x34, 0x56, 0x7a, 0x9a, 0xbc, 0xde, 0xf0
 
+/* Largest frame payload at ATT_MTU 512: 512 - 3 (ATT notify) - 5 (frame header). */
+#define SONYA_BLE_PAYLOAD_MAX 504
+
+/*
+ * Longest RX write accepted: the ATT attribute value limit, so a write at ATT_MTU 512
+ * (509 bytes) or a long write always fits. Longer writes are refused with an ATT error.
+ */
+#define SONYA_BLE_RX_MAX 512
+
 typedef void (*sonya_ble_rx_cb_t)(const uint8_t *data, uint16_t len, void *arg);
+typedef void (*sonya_ble_sub_cb_t)(void *arg);
 
 /**
  * @brief Initialize BLE GATT server and start advertising
  * @param device_name Advertising name (e.g. "SONYA-WATCH")
- * @param rx_cb Callback for RX characteristic writes
+ * @param rx_cb Callback for RX characteristic writes; runs on the "ble_rx" worker
+ *              task, one command at a time, never on the NimBLE host task
  * @param rx_arg User arg for rx_cb
  * @return 0 on success, negative on error
  */
 int sonya_ble_init(const char *device_name, sonya_ble_rx_cb_t rx_cb, void *rx_arg);
 
+/**
+ * @brief Called when the phone enables TX notifications (i.e. can receive frames)
+ *
+ * Runs on the "ble_rx" worker, in order with RX commands.
+ */
+void sonya_ble_set_subscribe_cb(sonya_ble_sub_cb_t cb, void *arg);
+
+/*
+ * Status beacon: manufacturer-specific data in the scan response, so the phone can
+ * read battery and pending-recording state from a scan and connect only when there
+ * is something to fetch. Company 0xFFFF (no assigned id). Payload after the company
+ * id, little-endian, 11 bytes:
+ *   [ver=1][batt_pct][flags][rec_pending][rec_bytes u32][fw_build u16][err_flags]
+ */
+#define SONYA_BEACON_COMPANY_ID 0xFFFF
+#define SONYA_BEACON_VERSION    1
+
+#define SONYA_BEACON_F_CHARGING  0x01
+#define SONYA_BEACON_F_VBUS      0x02
+#define SONYA_BEACON_F_RECORDING 0x04
+#define SONYA_BEACON_F_COMMITTED 0x08   // rec_bytes is a finished recording
+
+#define SONYA_BEACON_E_PMU   0x01
+#define SONYA_BEACON_E_NOMEM 0x02
+#define SONYA_BEACON_E_AUDIO 0x04
+#define SONYA_BEACON_E_NOMIC 0x08
+
+typedef struct {
+    uint8_t  batt_pct;      // 0..100, 0xFF = unknown
+    uint8_t  flags;         // SONYA_BEACON_F_*
+    uint8_t  rec_pending;   // recordings not yet released with DONE
+    uint32_t rec_bytes;
+    uint16_t fw_build;
+    uint8_t  err_flags;     // SONYA_BEACON_E_*
+} sonya_ble_beacon_t;
+
+/**
+ * @brief Update the status beacon
+ *
+ * Only a change is pushed to the controller, and in place: advertising is not
+ * restarted. Safe from any task; may be called before a connection or sync.
+ */
+void sonya_ble_set_beacon(const sonya_ble_beacon_t *b);
+
 /**
  * @brief Send data via TX notify (queued, respects CHUNK_SIZE)
  * @param data Data to send
@@ -49,6 +105,55 @@ int sonya_ble_tx_send(const uint8_t *data, size_t len);
  */
 int sonya_ble_send_frame(uint8_t type, const uint8_t *payload, uint16_t plen);
 
+/**
+ * TX priority classes. Each has its own queue; the sender task always serves the
+ * lowest-numbered non-empty class first and drops frames older than the class deadline.
+ */
+typedef enum {
+    SONYA_TX_CTRL = 0,   // events and command replies: never block the caller
+    SONYA_TX_LIVE,       // live audio during recording
+    SONYA_TX_BULK,       // GET/XGET pulls
+    SONYA_TX_TELEM,      // periodic status: latest wins, never blocks
+    SONYA_TX_CLASS_COUNT
+} sonya_tx_class_t;
+
+/** One piece of a frame payload; segments are concatenated in order. */
+typedef struct {
+    const void *data;
+    uint16_t len;
+} sonya_ble_seg_t;
+
+/**
+ * @brief Queue one frame whose payload is the concatenation of segs[0..nseg)
+ *
+ * Header and segments are copied once, directly into the notification mbuf, so the
+ * caller can pass PCM straight from rec_store; segs may be reused on return.
+ * CTRL/TELEM return immediately; LIVE/BULK block up to 2 s on a full queue (backpressure).
+ * At most 4 segments.
+ * @return 0 if queued, -1 if not connected or too large, -2 if the queue stayed full
+ */
+int sonya_ble_send_frame_segs(sonya_tx_class_t cls, uint8_t type,
+                              const sonya_ble_seg_t *segs, int nseg);
+
+/*
+ * For segments that pin their memory (rec_store peek references): unpin(arg) runs
+ * exactly once, right after the segments are copied into the frame or the send is
+ * given up, and before any wait for queue room. Nothing waits for mbufs while the
+ * segments are pinned: if msys is short the frame is dropped (-2). Call
+ * sonya_ble_tx_wait_room() before pinning so that stays rare.
+ */
+typedef void (*sonya_ble_unpin_cb_t)(void *arg);
+
+int sonya_ble_send_frame_segs_pinned(sonya_tx_class_t cls, uint8_t type,
+                                     const sonya_ble_seg_t *segs, int nseg,
+                                     sonya_ble_unpin_cb_t unpin, void *arg);
+
+/**
+ * @brief Wait until msys is above the TX reserve, so a data frame can be built at once
+ * @return 0 when there is room, -1 if not connected, -2 after wait_ms
+ */
+int sonya_ble_tx_wait_room(uint32_t wait_ms);
+
 /**
  * @brief Check if a client is connected
  */
@@ -58,16 +163,196 @@ bool sonya_ble_is_connected(void);
  * @brief Send protocol events (convenience helpers)
  */
 int sonya_ble_send_evt_wake(void);
-int sonya_ble_send_evt_rec_start(void);
+int sonya_ble_send_evt_rec_start(const proto_session_t *sess);
 int sonya_ble_send_evt_rec_end(void);
 int sonya_ble_send_evt_error(const char *msg);
+/** Status text (EVT_ERROR frame) on the telemetry class: dropped rather than queued behind audio */
+int sonya_ble_send_telemetry(const char *msg);
+
+/*
+ * Device status (PROTO_EVT_STATUS payload, up to PROTO_STATUS_LEN bytes). set_status()
+ * only replaces the cached copy a read of the TX characteristic returns; send_status()
+ * also sends it as EVT_STATUS on cls (SONYA_TX_CTRL or SONYA_TX_TELEM). Safe from any task.
+ */
+void sonya_ble_set_status(const uint8_t *p, uint16_t len);
+int  sonya_ble_send_status(sonya_tx_class_t cls, const uint8_t *p, uint16_t len);
 
 /**
- * @brief Switch BLE connection params between active and power-save profiles.
- * @param enable true = power-save (higher interval/latency), false = active
- * @return 0 on success, negative on error
+ * Pipeline phases, each with its own connection parameters (main/Kconfig,
+ * "BLE connection profiles").
+ */
+typedef enum {
+    SONYA_LINK_IDLE = 0,     // connected, nothing to send: long interval + latency
+    SONYA_LINK_ARMED,        // wake trigger seen, capture about to start
+    SONYA_LINK_STREAMING,    // recording with live audio
+    SONYA_LINK_BULK,         // GET / XGET drain
+    SONYA_LINK_LINGER,       // after a transfer; decays to IDLE on its own
+    SONYA_LINK_PHASE_COUNT
+} sonya_link_phase_t;
+
+/**
+ * @brief Enter a pipeline phase and request its connection parameters
+ *
+ * Cheap to call repeatedly: the same phase, or a phase with identical parameters,
+ * sends nothing. Remembered while disconnected and applied on the next connect.
+ * @return 0 if requested (or nothing to do), -1 if the host refused the request
+ */
+int sonya_ble_set_link_phase(sonya_link_phase_t phase);
+
+sonya_link_phase_t sonya_ble_get_link_phase(void);
+
+/** Connection parameters actually in effect, as reported by BLE_GAP_EVENT_CONN_UPDATE */
+typedef struct {
+    uint8_t  phase;           // wanted phase
+    uint8_t  applied;         // phase whose update completed (SONYA_LINK_PHASE_COUNT = none yet)
+    uint16_t latency;
+    uint32_t itvl_us;
+    uint32_t timeout_ms;
+    uint32_t requests;
+    uint32_t updates_ok;
+    uint32_t updates_failed;  // refused by the host or rejected by the central
+    uint32_t switch_ms;       // last request -> CONN_UPDATE
+    uint32_t switch_max_ms;
+    uint32_t reconnects;      // connects that followed a disconnect since boot
+    uint32_t reconnect_ms;    // last disconnect -> connect
+    uint32_t reconnect_max_ms;
+} sonya_ble_conn_stats_t;
+
+void sonya_ble_get_conn_stats(sonya_ble_conn_stats_t *out);
+
+/**
+ * @brief Legacy two-profile switch: true = IDLE, false = STREAMING
  */
 int sonya_ble_set_conn_power_save(bool enable);
 
+typedef struct {
+    uint32_t frames_sent;     // accepted by ble_gatts_notify_custom
+    uint32_t frames_done;     // NOTIFY_TX status == 0
+    uint32_t frames_failed;   // NOTIFY_TX status != 0
+    uint32_t enomem;          // ENOMEM/EBUSY from the host
+    uint32_t credit_waits;    // sender blocked on a full in-flight window
+    uint32_t mbuf_waits;      // sender blocked on msys below reserve
+    uint16_t inflight_max;
+    uint16_t msys_free_min;   // msys low-water mark since last reset
+    uint32_t q_dropped[SONYA_TX_CLASS_COUNT];     // expired in queue, replaced, or lost on error
+    uint32_t q_full[SONYA_TX_CLASS_COUNT];        // rejected: queue full / no mbuf
+    uint16_t q_wait_max_ms[SONYA_TX_CLASS_COUNT]; // longest time a frame sat queued
+    uint32_t batches;         // EVT_BATCH frames since boot (kept across reset)
+    uint32_t batched;         // records carried in them
+} sonya_ble_tx_stats_t;
+
+void sonya_ble_get_tx_stats(sonya_ble_tx_stats_t *out);
+void sonya_ble_reset_tx_stats(void);
+
+/** Frames waiting in one TX class queue (built, not yet handed to the host). */
+int sonya_ble_tx_queue_depth(sonya_tx_class_t cls);
+
+/**
+ * @brief Limit notifications in flight to n (1..BLE_TX_INFLIGHT_MAX; 0 = the maximum)
+ *
+ * Meant for benchmarking; call from the producer task, not concurrently.
+ * @return Limit in effect (lower than asked only if in-flight frames did not drain)
+ */
+int sonya_ble_set_tx_inflight(int n);
+
+typedef struct {
+    uint32_t cmds;            // writes handed to rx_cb
+    uint32_t dropped;         // rejected: RX queue full
+    uint32_t wait_max_us;     // longest receive -> dispatch delay
+    uint16_t depth_max;       // RX queue high-water mark
+    uint16_t queued;          // waiting right now
+} sonya_ble_rx_stats_t;
+
+void sonya_ble_get_rx_stats(sonya_ble_rx_stats_t *out);
+
+/**
+ * @brief esp_timer time at which the command now in rx_cb was received
+ *
+ * Lets the handler measure receive -> reply latency. 0 outside rx_cb.
+ */
+int64_t sonya_ble_rx_time_us(void);
+
+/**
+ * @brief Current connection interval in microseconds (0 if not connected)
+ */
+uint32_t sonya_ble_conn_itvl_us(void);
+
+/**
+ * @brief Negotiated ATT MTU of the current connection (23 until the exchange completes)
+ */
+uint16_t sonya_ble_att_mtu(void);
+
+/**
+ * @brief Largest frame payload that fits one notification at the current MTU
+ *
+ * Frames built for the data path should fill exactly this much; anything larger
+ * is rejected by sonya_ble_send_frame() instead of being truncated by the host.
+ */
+uint16_t sonya_ble_max_payload(void);
+
+/**
+ * Frame header format for the rest of the connection: v1 (default after connect) or the
+ * v2 header with per-stream 32-bit seq, optionally with a header CRC-8. Stream ids are
+ * the TX class (PROTO_SID_CTRL..TELEM) and PROTO_SID_COC for the CoC channel.
+ * Changing the format restarts every stream at seq 0.
+ */
+void     sonya_ble_set_frame_format(bool v2, bool hcrc);
+uint16_t sonya_ble_frame_hdr_size(void);
+// v2: seq the next frame on stream sid will carry.
+uint32_t sonya_ble_stream_seq(uint8_t sid);
+
+/*
+ * Coalesce small control and telemetry frames into EVT_BATCH for the rest of the
+ * connection (SESS flag PROTO_SESS_F_BATCH); off again on connect. Turning it off
+ * flushes what is pending.
+ */
+void     sonya_ble_set_batch(bool on);
+
+/*
+ * The phone recovers lost audio (it sent NACK or XGET): from now until the link drops
+ * LIVE and BULK frames may expire in the TX queue. Before that they are never dropped.
+ */
+void     sonya_ble_set_loss_recovery(void);
+
+typedef struct {
+    uint8_t  tx_phy;          // BLE_GAP_LE_PHY_1M / _2M / _CODED
+    uint8_t  rx_phy;
+    uint16_t tx_octets;       // LL payload per packet (27 until DLE completes)
+    uint16_t rx_octets;
+    uint16_t att_mtu;
+    uint32_t itvl_us;
+} sonya_ble_link_info_t;
+
+/**
+ * @brief Ask for 2M PHY and the maximum LL data length before a bulk transfer
+ *
+ * Issued once per connection; later calls are no-ops. Results are reported
+ * asynchronously and visible through sonya_ble_get_link_info().
+ */
+void sonya_ble_request_fast_link(void);
+
+void sonya_ble_get_link_info(sonya_ble_link_info_t *out);
+
+/**
+ * @brief L2CAP CoC bulk channel (CONFIG_BLE_COC_ENABLE)
+ *
+ * The phone opts in by connecting to CONFIG_BLE_COC_PSM. While open, each frame
+ * goes out as one SDU with the usual [type][seq][len] header; the CoC seq counter
+ * is separate from the GATT one.
+ */
+bool sonya_ble_coc_is_open(void);
+
+/** Largest frame payload per SDU (0 when the channel is closed) */
+uint16_t sonya_ble_coc_max_payload(void);
+
+/**
+ * @brief Send one frame (payload = concatenated segments) as a single SDU
+ * @return 0 on success, -1 if closed or too large, -2 on timeout/error
+ */
+int sonya_ble_coc_send_frame_segs(uint8_t type, const sonya_ble_seg_t *segs, int nseg);
+/** Same with pinned segments (see sonya_ble_send_frame_segs_pinned) */
+int sonya_ble_coc_send_frame_segs_pinned(uint8_t type, const sonya_ble_seg_t *segs, int nseg,
+                                         sonya_ble_unpin_cb_t unpin, void *arg);
+
 // Legacy v0 helper used by current app_main; kept for compatibility.
 // Prefer sonya_ble_send_frame for custom protocol types.
@@ -4,11 +4,14 @@
  */
 
 #include "sonya_ble.h"
+#include "sonya_ble_coc.h"
 #include "protocol.h"
 #include "esp_log.h"
 #include "sonya_diaglog.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
 #include "nimble/nimble_port.h"
 #include "nimble/nimble_port_freertos.h"
 #include "host/ble_hs.h"
@@ -17,10 +20,16 @@
 #include "services/gap/ble_svc_gap.h"
 #include "services/gatt/ble_svc_gatt.h"
 #include "os/os_mbuf.h"
+#include "os/os_mempool.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
 #include <string.h>
 
 static const char *TAG = "sonya_ble";
 
+// NimBLE's NVS-backed key store (store/config); ESP-IDF ships no header for it.
+void ble_store_config_init(void);
+
 /* SONYA 128-bit UUIDs */
 static const ble_uuid128_t sonya_svc_uuid =
     BLE_UUID128_INIT(SONYA_SVC_UUID);
@@ -31,21 +40,169 @@ static const ble_uuid128_t sonya_tx_uuid =
 
 static uint16_t tx_val_handle;
 static uint16_t conn_handle = BLE_HS_CONN_HANDLE_NONE;
-static bool s_conn_power_save = true;
 static sonya_ble_rx_cb_t rx_cb;
 static void *rx_arg;
+static sonya_ble_sub_cb_t sub_cb;
+static void *sub_arg;
 static char device_name[32];
 static uint16_t tx_seq;
-static uint8_t tx_queue[256];
+static volatile bool s_hdr_v2;             // v2 TX header (SESS), back to v1 on connect
+static volatile bool s_hdr_crc;
+static uint32_t s_sid_seq[PROTO_SID_COUNT];
+// v2: held from taking a stream's seq until the frame is queued, so producers on one
+// stream take seqs in queue order and a frame that never got queued gives its seq back.
+static SemaphoreHandle_t s_sid_lock[PROTO_SID_COUNT];
+static uint32_t s_sid_mark[PROTO_SID_COUNT];
+static volatile uint16_t s_att_mtu = BLE_ATT_MTU_DFLT;
+static sonya_ble_link_info_t s_link;
+static bool s_fast_link_requested;
 static uint8_t s_own_addr_type;
+static sonya_ble_beacon_t s_beacon = { .batt_pct = 0xFF };
+
+/*
+ * Reconnect advertising: after a link drop, fast undirected advertising for
+ * CONFIG_BLE_RECONNECT_FAST_MS, then the slow idle interval. A clean disconnect
+ * (either side terminating) goes straight to slow. There is no directed stage: phones
+ * reconnect from resolvable private addresses, which directed advertising at the
+ * stored identity address cannot reach without controller privacy.
+ */
+typedef enum {
+    ADV_SLOW = 0,
+    ADV_FAST,
+} adv_stage_t;
+
+static const char *const s_adv_stage_name[] = { "slow", "fast" };
+
+static adv_stage_t s_adv_stage = ADV_SLOW;
+static adv_stage_t s_adv_stage_started = ADV_SLOW;
+static int64_t s_disc_us;                // when the last link dropped (0 = none pending)
+static portMUX_TYPE s_beacon_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t s_status[PROTO_STATUS_LEN];   // value of a TX read (EVT_STATUS payload)
+static uint16_t s_status_len;
+static portMUX_TYPE s_status_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Payload segments per frame (frame header is added in front).
+#define FRAME_SEGS_MAX 4
+// ATT notification header: opcode (1) + attribute handle (2).
+#define ATT_NOTIFY_HDR 3
+// Largest LL payload (Core 4.2+) and its airtime on 1M PHY: (251 + 14) * 8 us.
+#define LL_TX_OCTETS_MAX 251
+#define LL_TX_TIME_MAX   2120
+// Longest an audio producer blocks on a full class queue or on msys at the reserve.
+#define BLE_NOTIFY_TIMEOUT_MS 2000
+
+/*
+ * TX flow control: a notification is "in flight" from ble_gatts_notify_custom() until
+ * its head mbuf returns to the msys pool (the host has handed it to the controller).
+ * We hook the msys pools' put callback to see exactly that moment, so the sender
+ * wakes as soon as a slot frees instead of sleeping a fixed pace. A put callback
+ * already installed on a pool (by the port) is kept and called first.
+ */
+#define MSYS_POOLS_MAX 4
+
+static SemaphoreHandle_t s_tx_credits;          // free in-flight slots
+static int s_credits_parked;                     // held back by sonya_ble_set_tx_inflight()
+static SemaphoreHandle_t s_msys_freed;          // given on every msys block release
+static struct os_mempool_ext *s_msys_pools[MSYS_POOLS_MAX];
+static os_mempool_put_fn *s_msys_prev_cb[MSYS_POOLS_MAX];   // hook found on each pool, chained
+static int s_msys_pool_cnt;
+static void *s_inflight_om[CONFIG_BLE_TX_INFLIGHT_MAX];
+static portMUX_TYPE s_tx_mux = portMUX_INITIALIZER_UNLOCKED;
+static sonya_ble_tx_stats_t s_tx_stats;
+
+/*
+ * TX scheduler: callers never talk to the radio. They build the frame into an mbuf
+ * and enqueue it on a per-class queue; tx_task drains the queues strictly by class
+ * priority (CTRL > LIVE > BULK > TELEM), one in-flight credit at a time, and drops
+ * frames whose deadline passed while queued. So EVT_WAKE/REC_END and command
+ * replies never wait behind more than one bulk frame.
+ */
+#define TX_TASK_STACK 3072
+#define TX_TASK_PRIO  6
+
+typedef struct {
+    struct os_mbuf *om;
+    uint32_t enq_ms;
+} txq_item_t;
+
+typedef struct {
+    uint8_t  depth;
+    uint16_t deadline_ms;   // 0 = never expires
+    bool     drop_oldest;   // when full, replace the oldest frame instead of rejecting
+    bool     lossless;      // never dropped unless the phone recovers losses (NACK/XGET)
+} txq_policy_t;
+
+/*
+ * A lost LIVE or BULK frame is a hole the v1 phone only zero-pads, so those classes
+ * keep their frames (retried on ENOMEM, no deadline) until the phone has shown it
+ * recovers gaps by sending NACK or XGET on this connection.
+ */
+static const txq_policy_t s_txq_policy[SONYA_TX_CLASS_COUNT] = {
+    [SONYA_TX_CTRL]  = { 16, 5000, false, false },
+    [SONYA_TX_LIVE]  = { 4,  1000, false, true  },  // with NACK: stale live audio is re-requested
+    [SONYA_TX_BULK]  = { 6,  2000, false, true  },  // with XGET: the window is re-sent on timeout
+    [SONYA_TX_TELEM] = { 4,  500,  true,  false },  // only the latest status matters
+};
+static volatile bool s_loss_recovery;   // NACK/XGET seen on this connection
+
+static QueueHandle_t s_txq[SONYA_TX_CLASS_COUNT];
+// A frame the host refused with ENOMEM, sent again before its queue (tx_task only).
+static txq_item_t s_txq_retry[SONYA_TX_CLASS_COUNT];
+static TaskHandle_t s_tx_task;
+
+/*
+ * RX dispatch: gatt_access only copies the write into s_rxq and returns, so the host
+ * task keeps processing ACL completions while a handler reads the PMU over I2C or
+ * queues replies. rx_task runs the application callback.
+ */
+#define RX_TASK_STACK 5120    // a 512-byte write is on it twice: queue item and ASCII parse
+#define RX_TASK_PRIO  5
+
+typedef struct {
+    int64_t  rx_us;
+    uint16_t len;           // 0: TX subscribe event, not a command
+    uint8_t  data[SONYA_BLE_RX_MAX];
+} rxq_item_t;
+
+/*
+ * Connection profiles: one parameter set per pipeline phase (main/Kconfig). Only one
+ * update is outstanding at a time; a phase change that arrives meanwhile is applied
+ * when BLE_GAP_EVENT_CONN_UPDATE reports the previous one. LINGER decays to IDLE
+ * after CONFIG_BLE_CP_LINGER_MS.
+ */
+typedef struct {
+    uint16_t itvl_min, itvl_max;   // 1.25 ms units
+    uint16_t latency;
+    uint16_t timeout;              // 10 ms units
+} conn_profile_t;
 
-#define TX_QUEUE_MAX (sizeof(tx_queue) - PROTO_FRAME_HEADER_SIZE)
-// Pacing is important: back-to-back notifications can exhaust NimBLE mbufs on ESP32-S3,
-// causing ble_hs_mbuf_from_flat() to fail and the recording to end early.
-#define BLE_NOTIFY_PACE_MS 12
-// With audio, transient mbuf pressure is normal. Give NimBLE time to reclaim buffers.
-#define BLE_NOTIFY_RETRY_MAX 200
-#define BLE_NOTIFY_RETRY_DELAY_MS 10
+#define CP(P) { CONFIG_BLE_CP_##P##_ITVL_MIN, CONFIG_BLE_CP_##P##_ITVL_MAX, \
+                CONFIG_BLE_CP_##P##_LATENCY, CONFIG_BLE_CP_##P##_TIMEOUT }
+
+static const conn_profile_t s_cp_profile[SONYA_LINK_PHASE_COUNT] = {
+    [SONYA_LINK_IDLE]      = CP(IDLE),
+    [SONYA_LINK_ARMED]     = CP(ARMED),
+    [SONYA_LINK_STREAMING] = CP(STREAM),
+    [SONYA_LINK_BULK]      = CP(BULK),
+    [SONYA_LINK_LINGER]    = CP(LINGER),
+};
+
+static const char *const s_phase_name[SONYA_LINK_PHASE_COUNT] = {
+    "idle", "armed", "stream", "bulk", "linger",
+};
+
+static SemaphoreHandle_t s_cp_lock;
+static esp_timer_handle_t s_linger_timer;
+static sonya_link_phase_t s_phase = SONYA_LINK_IDLE;   // wanted
+static int s_cp_pending = -1;                          // phase of the outstanding request
+static int s_cp_applied = -1;                          // phase whose params are in effect
+static int64_t s_cp_req_us;
+static sonya_ble_conn_stats_t s_cp_stats;
+
+static QueueHandle_t s_rxq;
+static TaskHandle_t s_rx_task;
+static int64_t s_rx_cur_us;            // receive time of the command rx_task is running
+static sonya_ble_rx_stats_t s_rx_stats;
 
 static int gatt_access(uint16_t conn, uint16_t attr_handle,
                        struct ble_gatt_access_ctxt *ctxt, void *arg);
@@ -72,6 +229,38 @@ static const struct ble_gatt_svc_def sonya_svc_defs[] = {
     { 0 }
 };
 
+static void rx_enqueue(const rxq_item_t *it)
+{
+    // Never block the host task: a full queue means the phone is flooding us.
+    if (xQueueSend(s_rxq, it, 0) != pdTRUE) {
+        s_rx_stats.dropped++;
+        ESP_LOGW(TAG, "rx queue full, command dropped (%u bytes)", (unsigned)it->len);
+        return;
+    }
+    UBaseType_t depth = uxQueueMessagesWaiting(s_rxq);
+    if (depth > s_rx_stats.depth_max) s_rx_stats.depth_max = (uint16_t)depth;
+}
+
+static void rx_task(void *arg)
+{
+    (void)arg;
+    rxq_item_t it;
+    for (;;) {
+        if (xQueueReceive(s_rxq, &it, portMAX_DELAY) != pdTRUE) continue;
+        if (it.len == 0) {
+            if (sub_cb) sub_cb(sub_arg);
+            continue;
+        }
+        int64_t t0 = esp_timer_get_time();
+        uint32_t wait_us = (uint32_t)(t0 - it.rx_us);
+        s_rx_stats.cmds++;
+        if (wait_us > s_rx_stats.wait_max_us) s_rx_stats.wait_max_us = wait_us;
+        s_rx_cur_us = it.rx_us;
+        rx_cb(it.data, it.len, rx_arg);
+        s_rx_cur_us = 0;
+    }
+}
+
 static int gatt_access(uint16_t conn, uint16_t attr_handle,
                        struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
@@ -79,19 +268,29 @@ static int gatt_access(uint16_t conn, uint16_t attr_handle,
     case BLE_GATT_ACCESS_OP_WRITE_CHR:
         if (ble_uuid_cmp(ctxt->chr->uuid, &sonya_rx_uuid.u) == 0) {
             uint16_t len = OS_MBUF_PKTLEN(ctxt->om);
-            if (len > 0 && len <= 128 && rx_cb) {
-                uint8_t buf[128];
-                len = (uint16_t)(len > sizeof(buf) ? sizeof(buf) : len);
-                if (ble_hs_mbuf_to_flat(ctxt->om, buf, len, NULL) == 0) {
-                    rx_cb(buf, len, rx_arg);
-                }
+            if (len == 0 || len > SONYA_BLE_RX_MAX) {
+                ESP_LOGW(TAG, "rx write of %u bytes refused", (unsigned)len);
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            if (rx_cb && s_rxq) {
+                rxq_item_t it;
+                it.rx_us = esp_timer_get_time();
+                it.len = len;
+                if (ble_hs_mbuf_to_flat(ctxt->om, it.data, len, NULL) != 0) return BLE_ATT_ERR_UNLIKELY;
+                rx_enqueue(&it);
             }
         }
         return 0;
 
     case BLE_GATT_ACCESS_OP_READ_CHR:
         if (ble_uuid_cmp(ctxt->chr->uuid, &sonya_tx_uuid.u) == 0) {
-            return os_mbuf_append(ctxt->om, "", 0);
+            // Long reads come back here per ATT_READ_BLOB; NimBLE slices the full value.
+            uint8_t st[PROTO_STATUS_LEN];
+            portENTER_CRITICAL(&s_status_mux);
+            uint16_t n = s_status_len;
+            memcpy(st, s_status, n);
+            portEXIT_CRITICAL(&s_status_mux);
+            return os_mbuf_append(ctxt->om, st, n) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
         }
         return BLE_ATT_ERR_UNLIKELY;
 
@@ -101,31 +300,201 @@ static int gatt_access(uint16_t conn, uint16_t attr_handle,
 }
 
 static int start_advertising(void);
-static int apply_conn_params(bool power_save);
+static int apply_phase(void);
+static void cp_init(void);
+static void on_notify_tx(struct ble_gap_event *event);
+static void tx_flow_init(void);
+static void batch_init(void);
+static void tx_task(void *arg);
 
 static void on_connect(struct ble_gap_event *event, void *arg)
 {
+    if (event->connect.status != 0) {
+        // Directed advertising timed out or the connection failed to establish.
+        ESP_LOGW(TAG, "connect failed status=%d (%s adv)", event->connect.status,
+                 s_adv_stage_name[s_adv_stage_started]);
+        if (s_adv_stage > ADV_SLOW) s_adv_stage--;
+        start_advertising();
+        return;
+    }
     conn_handle = event->connect.conn_handle;
+    if (s_disc_us) {
+        uint32_t ms = (uint32_t)((esp_timer_get_time() - s_disc_us) / 1000);
+        s_disc_us = 0;
+        xSemaphoreTake(s_cp_lock, portMAX_DELAY);
+        s_cp_stats.reconnects++;
+        s_cp_stats.reconnect_ms = ms;
+        if (ms > s_cp_stats.reconnect_max_ms) s_cp_stats.reconnect_max_ms = ms;
+        xSemaphoreGive(s_cp_lock);
+        ESP_LOGI(TAG, "reconnect after %lu ms (%s adv)", (unsigned long)ms,
+                 s_adv_stage_name[s_adv_stage_started]);
+        sonya_diaglog_addf("ble", "reconnect ms=%lu adv=%s", (unsigned long)ms,
+                           s_adv_stage_name[s_adv_stage_started]);
+    }
+    s_adv_stage = ADV_SLOW;
+    s_att_mtu = ble_att_mtu(conn_handle);
+    sonya_ble_set_frame_format(false, false);
+    s_fast_link_requested = false;
+    memset(&s_link, 0, sizeof(s_link));
+    s_link.tx_phy = BLE_GAP_LE_PHY_1M;
+    s_link.rx_phy = BLE_GAP_LE_PHY_1M;
+    s_link.tx_octets = 27;
+    s_link.rx_octets = 27;
     ESP_LOGI(TAG, "BLE connected, conn_handle=%d", conn_handle);
     sonya_diaglog_addf("ble", "connect h=%d", (int)conn_handle);
-    (void)apply_conn_params(s_conn_power_save);
+    xSemaphoreTake(s_cp_lock, portMAX_DELAY);
+    s_cp_pending = -1;
+    s_cp_applied = -1;
+    xSemaphoreGive(s_cp_lock);
+    (void)apply_phase();
+#if CONFIG_BLE_BOND_ENABLE
+    // Bonded phone: re-encrypts with the stored LTK. New phone: Just Works pairing.
+    int rc = ble_gap_security_initiate(conn_handle);
+    if (rc != 0 && rc != BLE_HS_EALREADY) ESP_LOGW(TAG, "security_initiate rc=%d", rc);
+#endif
 }
 
 static void on_disconnect(struct ble_gap_event *event, void *arg)
 {
     conn_handle = BLE_HS_CONN_HANDLE_NONE;
-    ESP_LOGI(TAG, "BLE disconnected, reason=%d", event->disconnect.reason);
-    sonya_diaglog_addf("ble", "disconnect reason=%d", (int)event->disconnect.reason);
+    s_att_mtu = BLE_ATT_MTU_DFLT;
+    sonya_ble_set_batch(false);   // with no link the pending records are dropped
+    s_loss_recovery = false;
+    int reason = event->disconnect.reason;
+    bool clean = reason == BLE_HS_HCI_ERR(BLE_ERR_REM_USER_CONN_TERM) ||
+                 reason == BLE_HS_HCI_ERR(BLE_ERR_CONN_TERM_LOCAL);
+    s_disc_us = esp_timer_get_time();
+    s_adv_stage = clean ? ADV_SLOW : ADV_FAST;
+    ESP_LOGI(TAG, "BLE disconnected, reason=%d", reason);
+    sonya_diaglog_addf("ble", "disconnect reason=%d", reason);
     start_advertising();
 }
 
 static void on_adv_complete(struct ble_gap_event *event, void *arg)
 {
-    if (event->adv_complete.reason == BLE_HS_EDONE) {
-        start_advertising();
+    if (conn_handle != BLE_HS_CONN_HANDLE_NONE) return;
+    int reason = event->adv_complete.reason;
+    // ETIMEOUT: the fast stage ran out. Step down a stage; anything unexpected: go slow.
+    if (reason == BLE_HS_ETIMEOUT) {
+        if (s_adv_stage > ADV_SLOW) s_adv_stage--;
+    } else if (reason != BLE_HS_EDONE) {
+        s_adv_stage = ADV_SLOW;
+    }
+    start_advertising();
+}
+
+/* ---- bonding ---- */
+
+static void on_enc_change(struct ble_gap_event *event)
+{
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(event->enc_change.conn_handle, &desc) != 0) return;
+    if (event->enc_change.status != 0) {
+        ESP_LOGW(TAG, "encryption failed status=%d", event->enc_change.status);
+        return;
+    }
+    ESP_LOGI(TAG, "link encrypted bonded=%d", desc.sec_state.bonded ? 1 : 0);
+}
+
+static int on_repeat_pairing(struct ble_gap_event *event)
+{
+    // The phone forgot us but we still hold its old keys: drop them and pair again.
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(event->repeat_pairing.conn_handle, &desc) == 0) {
+        ble_store_util_delete_peer(&desc.peer_id_addr);
     }
+    ESP_LOGI(TAG, "repeat pairing: old bond deleted");
+    return BLE_GAP_REPEAT_PAIRING_RETRY;
+}
+
+static void on_mtu(struct ble_gap_event *event)
+{
+    if (event->mtu.conn_handle != conn_handle) return;
+    s_att_mtu = event->mtu.value;
+    ESP_LOGI(TAG, "ATT MTU=%u -> frame payload max=%u",
+             (unsigned)event->mtu.value, (unsigned)sonya_ble_max_payload());
+    sonya_diaglog_addf("ble", "mtu=%u", (unsigned)event->mtu.value);
 }
 
+static void on_conn_update(struct ble_gap_event *event)
+{
+    if (event->conn_update.conn_handle != conn_handle) return;
+    struct ble_gap_conn_desc desc;
+    bool have = ble_gap_conn_find(conn_handle, &desc) == 0;
+
+    xSemaphoreTake(s_cp_lock, portMAX_DELAY);
+    int asked = s_cp_pending;
+    uint32_t took_ms = asked >= 0 ? (uint32_t)((esp_timer_get_time() - s_cp_req_us) / 1000) : 0;
+    s_cp_pending = -1;
+    if (event->conn_update.status == 0) {
+        // asked < 0: the central changed the parameters on its own.
+        if (asked >= 0) s_cp_applied = asked;
+        s_cp_stats.updates_ok++;
+        s_cp_stats.switch_ms = took_ms;
+        if (took_ms > s_cp_stats.switch_max_ms) s_cp_stats.switch_max_ms = took_ms;
+        if (have) {
+            s_cp_stats.itvl_us = (uint32_t)desc.conn_itvl * 1250U;
+            s_cp_stats.latency = desc.conn_latency;
+            s_cp_stats.timeout_ms = (uint32_t)desc.supervision_timeout * 10U;
+        }
+    } else {
+        s_cp_stats.updates_failed++;
+    }
+    bool again = event->conn_update.status == 0 && s_cp_applied != (int)s_phase;
+    xSemaphoreGive(s_cp_lock);
+
+    if (event->conn_update.status == 0) {
+        ESP_LOGI(TAG, "conn params: %s itvl=%luus lat=%u to=%lums (%lums)",
+                 asked >= 0 ? s_phase_name[asked] : "peer",
+                 (unsigned long)s_cp_stats.itvl_us, (unsigned)s_cp_stats.latency,
+                 (unsigned long)s_cp_stats.timeout_ms, (unsigned long)took_ms);
+        sonya_diaglog_addf("ble", "cp %s itvl=%lu lat=%u",
+                           asked >= 0 ? s_phase_name[asked] : "peer",
+                           (unsigned long)s_cp_stats.itvl_us, (unsigned)s_cp_stats.latency);
+    } else {
+        ESP_LOGW(TAG, "conn params %s rejected status=%d",
+                 asked >= 0 ? s_phase_name[asked] : "peer", event->conn_update.status);
+    }
+    // The phase moved on while this update was in flight.
+    if (again) (void)apply_phase();
+}
+
+static void on_subscribe(struct ble_gap_event *event)
+{
+    if (event->subscribe.conn_handle != conn_handle || event->subscribe.attr_handle != tx_val_handle) return;
+    ESP_LOGI(TAG, "TX notify %s", event->subscribe.cur_notify ? "on" : "off");
+    if (!event->subscribe.cur_notify || event->subscribe.prev_notify || !s_rxq) return;
+    rxq_item_t it = { .rx_us = esp_timer_get_time(), .len = 0 };
+    rx_enqueue(&it);
+}
+
+static void on_phy_update(struct ble_gap_event *event)
+{
+    if (event->phy_updated.conn_handle != conn_handle) return;
+    if (event->phy_updated.status != 0) {
+        // Peer refused or does not support 2M; the link simply stays on its current PHY.
+        ESP_LOGW(TAG, "PHY update failed status=%d, staying on tx=%u rx=%u",
+                 event->phy_updated.status, (unsigned)s_link.tx_phy, (unsigned)s_link.rx_phy);
+        return;
+    }
+    s_link.tx_phy = event->phy_updated.tx_phy;
+    s_link.rx_phy = event->phy_updated.rx_phy;
+    ESP_LOGI(TAG, "PHY tx=%uM rx=%uM", (unsigned)s_link.tx_phy, (unsigned)s_link.rx_phy);
+    sonya_diaglog_addf("ble", "phy tx=%u rx=%u", (unsigned)s_link.tx_phy, (unsigned)s_link.rx_phy);
+}
+
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+static void on_data_len_chg(struct ble_gap_event *event)
+{
+    if (event->data_len_chg.conn_handle != conn_handle) return;
+    s_link.tx_octets = event->data_len_chg.max_tx_octets;
+    s_link.rx_octets = event->data_len_chg.max_rx_octets;
+    ESP_LOGI(TAG, "LL data length tx=%u/%uus rx=%u/%uus",
+             (unsigned)event->data_len_chg.max_tx_octets, (unsigned)event->data_len_chg.max_tx_time,
+             (unsigned)event->data_len_chg.max_rx_octets, (unsigned)event->data_len_chg.max_rx_time);
+}
+#endif
+
 static int gap_event(struct ble_gap_event *event, void *arg)
 {
     switch (event->type) {
@@ -138,12 +507,87 @@ static int gap_event(struct ble_gap_event *event, void *arg)
     case BLE_GAP_EVENT_ADV_COMPLETE:
         on_adv_complete(event, arg);
         break;
+    case BLE_GAP_EVENT_NOTIFY_TX:
+        on_notify_tx(event);
+        break;
+    case BLE_GAP_EVENT_MTU:
+        on_mtu(event);
+        break;
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        on_conn_update(event);
+        break;
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        on_subscribe(event);
+        break;
+    case BLE_GAP_EVENT_ENC_CHANGE:
+        on_enc_change(event);
+        break;
+    case BLE_GAP_EVENT_REPEAT_PAIRING:
+        return on_repeat_pairing(event);
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        on_phy_update(event);
+        break;
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+    case BLE_GAP_EVENT_DATA_LEN_CHG:
+        on_data_len_chg(event);
+        break;
+#endif
     default:
         break;
     }
     return 0;
 }
 
+#define BEACON_LEN (2 + 11)
+
+static void beacon_encode(uint8_t out[BEACON_LEN])
+{
+    sonya_ble_beacon_t b;
+    portENTER_CRITICAL(&s_beacon_mux);
+    b = s_beacon;
+    portEXIT_CRITICAL(&s_beacon_mux);
+    out[0]  = (uint8_t)(SONYA_BEACON_COMPANY_ID & 0xFF);
+    out[1]  = (uint8_t)(SONYA_BEACON_COMPANY_ID >> 8);
+    out[2]  = SONYA_BEACON_VERSION;
+    out[3]  = b.batt_pct;
+    out[4]  = b.flags;
+    out[5]  = b.rec_pending;
+    out[6]  = (uint8_t)(b.rec_bytes & 0xFF);
+    out[7]  = (uint8_t)((b.rec_bytes >> 8) & 0xFF);
+    out[8]  = (uint8_t)((b.rec_bytes >> 16) & 0xFF);
+    out[9]  = (uint8_t)((b.rec_bytes >> 24) & 0xFF);
+    out[10] = (uint8_t)(b.fw_build & 0xFF);
+    out[11] = (uint8_t)(b.fw_build >> 8);
+    out[12] = b.err_flags;
+}
+
+// Scan response = the beacon. Legacy PDUs: 15 of 31 bytes, readable by every phone.
+static int set_scan_rsp(void)
+{
+    uint8_t mfg[BEACON_LEN];
+    beacon_encode(mfg);
+    struct ble_hs_adv_fields rsp;
+    memset(&rsp, 0, sizeof(rsp));
+    rsp.mfg_data = mfg;
+    rsp.mfg_data_len = sizeof(mfg);
+    int rc = ble_gap_adv_rsp_set_fields(&rsp);
+    if (rc) ESP_LOGE(TAG, "adv_rsp_set_fields err %d", rc);
+    return rc;
+}
+
+void sonya_ble_set_beacon(const sonya_ble_beacon_t *b)
+{
+    if (!b) return;
+    portENTER_CRITICAL(&s_beacon_mux);
+    bool changed = s_beacon.batt_pct != b->batt_pct || s_beacon.flags != b->flags ||
+                   s_beacon.rec_pending != b->rec_pending || s_beacon.rec_bytes != b->rec_bytes ||
+                   s_beacon.fw_build != b->fw_build || s_beacon.err_flags != b->err_flags;
+    if (changed) s_beacon = *b;
+    portEXIT_CRITICAL(&s_beacon_mux);
+    // Not advertising (connected, or before sync): start_advertising() picks it up.
+    if (changed && ble_gap_adv_active()) (void)set_scan_rsp();
+}
+
 static int start_advertising(void)
 {
     struct ble_hs_adv_fields fields;
@@ -158,23 +602,38 @@ static int start_advertising(void)
         ESP_LOGE(TAG, "adv_set_fields err %d", rc);
         return rc;
     }
+    rc = set_scan_rsp();
+    if (rc) return rc;
 
     struct ble_gap_adv_params adv_params;
     memset(&adv_params, 0, sizeof(adv_params));
     adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
     adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
-    // Use moderately slow advertising while idle to reduce radio duty cycle.
-    // Units are 0.625ms -> 320..640 => 200..400ms.
-    adv_params.itvl_min = 320;
-    adv_params.itvl_max = 640;
+    int32_t duration = BLE_HS_FOREVER;
+    switch (s_adv_stage) {
+    case ADV_FAST:
+        // 20..30 ms: what phones' background reconnect scans pick up quickly.
+        adv_params.itvl_min = 32;
+        adv_params.itvl_max = 48;
+        duration = CONFIG_BLE_RECONNECT_FAST_MS;
+        break;
+    case ADV_SLOW:
+    default:
+        // Use moderately slow advertising while idle to reduce radio duty cycle.
+        // Units are 0.625ms -> 320..640 => 200..400ms.
+        adv_params.itvl_min = 320;
+        adv_params.itvl_max = 640;
+        break;
+    }
 
-    rc = ble_gap_adv_start(s_own_addr_type, NULL, BLE_HS_FOREVER,
+    rc = ble_gap_adv_start(s_own_addr_type, NULL, duration,
                            &adv_params, gap_event, NULL);
     if (rc) {
         ESP_LOGE(TAG, "adv start err %d", rc);
         return rc;
     }
-    ESP_LOGI(TAG, "BLE advertising started, name=%s", device_name);
+    s_adv_stage_started = s_adv_stage;
+    ESP_LOGI(TAG, "BLE advertising started (%s), name=%s", s_adv_stage_name[s_adv_stage], device_name);
     return 0;
 }
 
@@ -224,6 +683,18 @@ int sonya_ble_init(const char *name, sonya_ble_rx_cb_t cb, void *arg)
 
     ble_hs_cfg.sync_cb = on_sync;
     ble_hs_cfg.reset_cb = on_reset;
+#if CONFIG_BLE_BOND_ENABLE
+    // Just Works bonding (no display/keys). Distributing identity keys lets us
+    // resolve the phone's private address and it ours across reconnects.
+    ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
+    ble_hs_cfg.sm_io_cap = BLE_SM_IO_CAP_NO_IO;
+    ble_hs_cfg.sm_bonding = 1;
+    ble_hs_cfg.sm_mitm = 0;
+    ble_hs_cfg.sm_sc = 1;
+    ble_hs_cfg.sm_our_key_dist = BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+    ble_hs_cfg.sm_their_key_dist = BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+    ble_store_config_init();
+#endif
 
     ble_svc_gap_device_name_set(device_name);
     ble_svc_gap_init();
@@ -234,89 +705,421 @@ int sonya_ble_init(const char *name, sonya_ble_rx_cb_t cb, void *arg)
     rc = ble_gatts_add_svcs(sonya_svc_defs);
     if (rc) return rc;
 
+    tx_flow_init();
+    cp_init();
+    batch_init();
+    s_rxq = xQueueCreate(CONFIG_BLE_RX_QUEUE_LEN, sizeof(rxq_item_t));
+    if (!s_rxq || xTaskCreate(rx_task, "ble_rx", RX_TASK_STACK, NULL, RX_TASK_PRIO, &s_rx_task) != pdPASS) {
+        ESP_LOGE(TAG, "rx task create failed");
+        return -1;
+    }
+    rc = sonya_ble_coc_init();
+    if (rc) return rc;
     nimble_port_freertos_init(host_task);
 
     ESP_LOGI(TAG, "BLE init done");
     return 0;
 }
 
-static int apply_conn_params(bool power_save)
+/* ---- connection profiles ---- */
+
+static void linger_expired(void *arg)
+{
+    (void)arg;
+    xSemaphoreTake(s_cp_lock, portMAX_DELAY);
+    bool still = s_phase == SONYA_LINK_LINGER;
+    xSemaphoreGive(s_cp_lock);
+    if (still) (void)sonya_ble_set_link_phase(SONYA_LINK_IDLE);
+}
+
+static void cp_init(void)
+{
+    s_cp_lock = xSemaphoreCreateMutex();
+    const esp_timer_create_args_t targs = {
+        .callback = linger_expired,
+        .name = "ble_linger",
+    };
+    if (esp_timer_create(&targs, &s_linger_timer) != ESP_OK) {
+        ESP_LOGW(TAG, "linger timer create failed, linger lasts until the next phase");
+    }
+}
+
+static bool same_profile(int a, int b)
+{
+    if (a < 0 || b < 0) return false;
+    return memcmp(&s_cp_profile[a], &s_cp_profile[b], sizeof(conn_profile_t)) == 0;
+}
+
+static int apply_phase(void)
 {
     if (conn_handle == BLE_HS_CONN_HANDLE_NONE) return 0;
+    xSemaphoreTake(s_cp_lock, portMAX_DELAY);
+    sonya_link_phase_t phase = s_phase;
+    // One request at a time; on_conn_update re-applies if the phase moved meanwhile.
+    if (s_cp_pending >= 0 || same_profile(s_cp_applied, phase)) {
+        xSemaphoreGive(s_cp_lock);
+        return 0;
+    }
+    const conn_profile_t *cp = &s_cp_profile[phase];
     struct ble_gap_upd_params p;
     memset(&p, 0, sizeof(p));
-    if (power_save) {
-        // 60..90ms, latency 4 (skip up to 4 intervals), supervision 5s.
-        p.itvl_min = 48;
-        p.itvl_max = 72;
-        p.latency = 4;
-        p.supervision_timeout = 500;
+    p.itvl_min = cp->itvl_min;
+    p.itvl_max = cp->itvl_max;
+    p.latency = cp->latency;
+    p.supervision_timeout = cp->timeout;
+    int rc = ble_gap_update_params(conn_handle, &p);
+    if (rc == 0) {
+        s_cp_pending = phase;
+        s_cp_req_us = esp_timer_get_time();
+        s_cp_stats.requests++;
     } else {
-        // 15..30ms, no latency for responsive streaming/commands.
-        p.itvl_min = 12;
-        p.itvl_max = 24;
-        p.latency = 0;
-        p.supervision_timeout = 400;
+        s_cp_stats.updates_failed++;
     }
-    int rc = ble_gap_update_params(conn_handle, &p);
+    xSemaphoreGive(s_cp_lock);
+
     if (rc != 0) {
-        ESP_LOGW(TAG, "conn params update failed rc=%d ps=%d", rc, power_save ? 1 : 0);
+        ESP_LOGW(TAG, "conn params %s update failed rc=%d", s_phase_name[phase], rc);
         return -1;
     }
-    ESP_LOGI(TAG, "conn params update requested ps=%d", power_save ? 1 : 0);
+    ESP_LOGI(TAG, "conn params %s requested itvl=%u..%u lat=%u",
+             s_phase_name[phase], (unsigned)cp->itvl_min, (unsigned)cp->itvl_max, (unsigned)cp->latency);
     return 0;
 }
 
-static int send_notify(uint16_t conn, const uint8_t *data, uint16_t len)
+int sonya_ble_set_link_phase(sonya_link_phase_t phase)
 {
-    if (conn == BLE_HS_CONN_HANDLE_NONE) return -1;
-    int last_rc = 0;
-    bool had_om_alloc_fail = false;
-    for (int attempt = 0; attempt < BLE_NOTIFY_RETRY_MAX; attempt++) {
-        if (conn_handle == BLE_HS_CONN_HANDLE_NONE) return -1;
+    if ((unsigned)phase >= SONYA_LINK_PHASE_COUNT) return -1;
+    xSemaphoreTake(s_cp_lock, portMAX_DELAY);
+    bool changed = s_phase != phase;
+    s_phase = phase;
+    xSemaphoreGive(s_cp_lock);
+    if (!changed) return 0;
 
-        struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
-        if (!om) {
-            had_om_alloc_fail = true;
-            vTaskDelay(pdMS_TO_TICKS(BLE_NOTIFY_RETRY_DELAY_MS));
-            continue;
+    if (s_linger_timer) {
+        esp_timer_stop(s_linger_timer);
+        if (phase == SONYA_LINK_LINGER) {
+            esp_timer_start_once(s_linger_timer, (uint64_t)CONFIG_BLE_CP_LINGER_MS * 1000U);
         }
+    }
+    return apply_phase();
+}
+
+sonya_link_phase_t sonya_ble_get_link_phase(void)
+{
+    return s_phase;
+}
 
-        // ble_gatts_notify_custom consumes om regardless of success/failure.
-        // Do NOT free om after this call.
-        int rc = ble_gatts_notify_custom(conn, tx_val_handle, om);
-        if (rc == 0) return 0;
+void sonya_ble_get_conn_stats(sonya_ble_conn_stats_t *out)
+{
+    if (!out) return;
+    xSemaphoreTake(s_cp_lock, portMAX_DELAY);
+    *out = s_cp_stats;
+    out->phase = (uint8_t)s_phase;
+    out->applied = (uint8_t)(s_cp_applied >= 0 ? s_cp_applied : SONYA_LINK_PHASE_COUNT);
+    xSemaphoreGive(s_cp_lock);
+}
 
-        if (rc == BLE_HS_ENOMEM || rc == BLE_HS_EBUSY) {
-            last_rc = rc;
-            vTaskDelay(pdMS_TO_TICKS(BLE_NOTIFY_RETRY_DELAY_MS));
-            continue;
+/* ---- TX flow control ---- */
+
+static void give_from_any(SemaphoreHandle_t sem)
+{
+    if (xPortInIsrContext()) {
+        BaseType_t woken = pdFALSE;
+        xSemaphoreGiveFromISR(sem, &woken);
+        if (woken) portYIELD_FROM_ISR();
+    } else {
+        xSemaphoreGive(sem);
+    }
+}
+
+static os_error_t msys_put_cb(struct os_mempool_ext *mpe, void *block, void *arg)
+{
+    // mpe_put_arg is left as found, so arg belongs to the previous hook. That hook
+    // returns the block to the pool; without one we do it.
+    os_mempool_put_fn *prev = NULL;
+    for (int i = 0; i < s_msys_pool_cnt; i++) {
+        if (s_msys_pools[i] == mpe) prev = s_msys_prev_cb[i];
+    }
+    os_error_t rc = prev ? prev(mpe, block, arg) : os_memblock_put_from_cb(&mpe->mpe_mp, block);
+
+    bool ours = false;
+    portENTER_CRITICAL_SAFE(&s_tx_mux);
+    for (int i = 0; i < CONFIG_BLE_TX_INFLIGHT_MAX; i++) {
+        if (s_inflight_om[i] == block) {
+            s_inflight_om[i] = NULL;
+            ours = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&s_tx_mux);
+
+    if (ours) give_from_any(s_tx_credits);
+    give_from_any(s_msys_freed);
+    return rc;
+}
+
+static void tx_flow_init(void)
+{
+    for (int c = 0; c < SONYA_TX_CLASS_COUNT; c++) {
+        s_txq[c] = xQueueCreate(s_txq_policy[c].depth, sizeof(txq_item_t));
+    }
+    for (int i = 0; i < PROTO_SID_COUNT; i++) s_sid_lock[i] = xSemaphoreCreateMutex();
+    if (xTaskCreate(tx_task, "ble_tx", TX_TASK_STACK, NULL, TX_TASK_PRIO, &s_tx_task) != pdPASS) {
+        ESP_LOGE(TAG, "tx task create failed");
+    }
+    s_tx_credits = xSemaphoreCreateCounting(CONFIG_BLE_TX_INFLIGHT_MAX, CONFIG_BLE_TX_INFLIGHT_MAX);
+    s_msys_freed = xSemaphoreCreateBinary();
+
+    struct os_mempool_info omi;
+    struct os_mempool *mp = NULL;
+    while ((mp = os_mempool_info_get_next(mp, &omi)) != NULL) {
+        if (strncmp(omi.omi_name, "msys", 4) != 0) continue;
+        if (!(mp->mp_flags & OS_MEMPOOL_F_EXT) || s_msys_pool_cnt >= MSYS_POOLS_MAX) continue;
+        struct os_mempool_ext *mpe = (struct os_mempool_ext *)mp;
+        if (mpe->mpe_put_cb == msys_put_cb) continue;
+        os_mempool_put_fn *prev = mpe->mpe_put_cb;
+        s_msys_prev_cb[s_msys_pool_cnt] = prev;
+        s_msys_pools[s_msys_pool_cnt++] = mpe;
+        mpe->mpe_put_cb = msys_put_cb;   // one pointer store: a put sees the old hook or ours
+        ESP_LOGI(TAG, "tx flow: hooked %s blocks=%d size=%d%s",
+                 omi.omi_name, omi.omi_num_blocks, omi.omi_block_size, prev ? " (chained)" : "");
+    }
+    if (s_msys_pool_cnt == 0) {
+        ESP_LOGW(TAG, "tx flow: msys pools not found, slots free on NOTIFY_TX");
+    }
+    s_tx_stats.inflight_max = CONFIG_BLE_TX_INFLIGHT_MAX;
+    s_tx_stats.msys_free_min = 0xFFFF;
+}
+
+static uint16_t msys_min_free(void)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < s_msys_pool_cnt; i++) {
+        sum += s_msys_pools[i]->mpe_mp.mp_min_free;
+    }
+    return (uint16_t)sum;
+}
+
+static int claim_slot(void *om)
+{
+    portENTER_CRITICAL(&s_tx_mux);
+    for (int i = 0; i < CONFIG_BLE_TX_INFLIGHT_MAX; i++) {
+        if (!s_inflight_om[i]) {
+            s_inflight_om[i] = om;
+            portEXIT_CRITICAL(&s_tx_mux);
+            return i;
+        }
+    }
+    portEXIT_CRITICAL(&s_tx_mux);
+    return -1;
+}
+
+static void on_notify_tx(struct ble_gap_event *event)
+{
+    if (event->notify_tx.indication || event->notify_tx.attr_handle != tx_val_handle) return;
+    if (event->notify_tx.status == 0) s_tx_stats.frames_done++;
+    else s_tx_stats.frames_failed++;
+    // Without the msys hook, NOTIFY_TX (handed to the host) is the best completion we have.
+    if (s_msys_pool_cnt == 0) xSemaphoreGive(s_tx_credits);
+}
+
+/* ---- TX scheduler ---- */
+
+void sonya_ble_set_loss_recovery(void)
+{
+    if (!s_loss_recovery) ESP_LOGI(TAG, "loss recovery: LIVE/BULK deadlines on");
+    s_loss_recovery = true;
+}
+
+static uint32_t now_ms(void) { return (uint32_t)(esp_timer_get_time() / 1000); }
+
+static bool txq_has_work(void)
+{
+    for (int c = 0; c < SONYA_TX_CLASS_COUNT; c++) {
+        if (s_txq_retry[c].om || uxQueueMessagesWaiting(s_txq[c])) return true;
+    }
+    return false;
+}
+
+static uint16_t txq_deadline(int cls)
+{
+    if (s_txq_policy[cls].lossless && !s_loss_recovery) return 0;
+    return s_txq_policy[cls].deadline_ms;
+}
+
+// Drop queue heads whose deadline passed; runs while the sender waits for a credit.
+static void txq_expire(void)
+{
+    uint32_t now = now_ms();
+    for (int c = 0; c < SONYA_TX_CLASS_COUNT; c++) {
+        uint16_t dl = txq_deadline(c);
+        if (dl && s_txq_retry[c].om && now - s_txq_retry[c].enq_ms > dl) {
+            os_mbuf_free_chain(s_txq_retry[c].om);
+            s_txq_retry[c].om = NULL;
+            s_tx_stats.q_dropped[c]++;
+        }
+        txq_item_t it;
+        while (dl && xQueuePeek(s_txq[c], &it, 0) == pdTRUE && now - it.enq_ms > dl) {
+            if (xQueueReceive(s_txq[c], &it, 0) != pdTRUE) break;
+            os_mbuf_free_chain(it.om);
+            s_tx_stats.q_dropped[c]++;
         }
+    }
+}
+
+static int txq_pick(txq_item_t *out)
+{
+    for (int c = 0; c < SONYA_TX_CLASS_COUNT; c++) {
+        if (s_txq_retry[c].om) {
+            *out = s_txq_retry[c];
+            s_txq_retry[c].om = NULL;
+            return c;
+        }
+        if (xQueueReceive(s_txq[c], out, 0) == pdTRUE) return c;
+    }
+    return -1;
+}
+
+static void tx_notify(int cls, txq_item_t *it)
+{
+    // ble_gatts_notify_custom consumes om on success and failure alike, so keep a
+    // copy of control and audio frames to send again, ahead of their queue, on ENOMEM.
+    struct os_mbuf *keep = cls != SONYA_TX_TELEM ? os_mbuf_dup(it->om) : NULL;
+    if (cls != SONYA_TX_TELEM && !keep) {
+        // msys is too short even for the copy: hold the frame and try again once a block frees.
+        s_tx_stats.enomem++;
+        s_txq_retry[cls] = *it;
+        xSemaphoreGive(s_tx_credits);
+        xSemaphoreTake(s_msys_freed, pdMS_TO_TICKS(10));
+        return;
+    }
 
+    if (s_msys_pool_cnt) (void)claim_slot(it->om);
+    // From here the credit is returned by om reaching msys (hooked) or by NOTIFY_TX.
+    int rc = ble_gatts_notify_custom(conn_handle, tx_val_handle, it->om);
+    if (rc == 0) {
+        s_tx_stats.frames_sent++;
+        if (keep) os_mbuf_free_chain(keep);
+        return;
+    }
+    bool busy = rc == BLE_HS_ENOMEM || rc == BLE_HS_EBUSY;
+    if (busy) {
+        s_tx_stats.enomem++;
+        xSemaphoreTake(s_msys_freed, pdMS_TO_TICKS(10));
+    } else {
         ESP_LOGE(TAG, "notify err %d", rc);
-        return rc;
     }
-    ESP_LOGE(TAG, "notify retry exceeded (om_fail=%d last_rc=%d)", had_om_alloc_fail ? 1 : 0, last_rc);
-    return -2;
+    if (keep && busy) {
+        // The slot is outside the queue, so a producer refilling it cannot crowd the retry out.
+        s_txq_retry[cls] = (txq_item_t){ keep, it->enq_ms };
+    } else {
+        if (keep) os_mbuf_free_chain(keep);
+        s_tx_stats.q_dropped[cls]++;
+    }
+}
+
+static void tx_service_one(void)
+{
+    bool credit = xSemaphoreTake(s_tx_credits, 0) == pdTRUE;
+    if (!credit) s_tx_stats.credit_waits++;
+    while (!credit && conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+        txq_expire();
+        if (!txq_has_work()) return;
+        credit = xSemaphoreTake(s_tx_credits, pdMS_TO_TICKS(20)) == pdTRUE;
+    }
+
+    txq_item_t it;
+    int cls = txq_pick(&it);
+    if (cls < 0) {
+        if (credit) xSemaphoreGive(s_tx_credits);
+        return;
+    }
+    uint32_t age = now_ms() - it.enq_ms;
+    if (age > s_tx_stats.q_wait_max_ms[cls]) s_tx_stats.q_wait_max_ms[cls] = (uint16_t)(age > 0xFFFF ? 0xFFFF : age);
+    uint16_t dl = txq_deadline(cls);
+    if (!credit || conn_handle == BLE_HS_CONN_HANDLE_NONE || (dl && age > dl)) {
+        os_mbuf_free_chain(it.om);
+        s_tx_stats.q_dropped[cls]++;
+        if (credit) xSemaphoreGive(s_tx_credits);
+        return;
+    }
+    tx_notify(cls, &it);
+}
+
+static void tx_task(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+        while (txq_has_work()) tx_service_one();
+    }
+}
+
+/*
+ * Build the notification straight into an ATT mbuf from the caller's segments:
+ * the frame header comes from a 5-byte stack array and the payload (e.g. PCM in
+ * rec_store blocks) is appended once, with no intermediate flat buffer.
+ * Data classes wait (up to wait_ms) while msys is down to the reserve; control
+ * frames may use the reserve.
+ */
+static struct os_mbuf *build_om(sonya_tx_class_t cls, const sonya_ble_seg_t *segs, int nseg,
+                                uint32_t wait_ms)
+{
+    int64_t deadline = esp_timer_get_time() + (int64_t)wait_ms * 1000;
+    for (;;) {
+        int free_blocks = os_msys_num_free();
+        if (free_blocks < s_tx_stats.msys_free_min) s_tx_stats.msys_free_min = (uint16_t)free_blocks;
+        if (cls == SONYA_TX_CTRL || free_blocks > CONFIG_BLE_TX_MSYS_RESERVE) {
+            struct os_mbuf *om = ble_hs_mbuf_att_pkt();
+            bool ok = om != NULL;
+            for (int i = 0; ok && i < nseg; i++) {
+                if (segs[i].len) ok = os_mbuf_append(om, segs[i].data, segs[i].len) == 0;
+            }
+            if (ok) return om;
+            if (om) os_mbuf_free_chain(om);
+        }
+        if (esp_timer_get_time() >= deadline) return NULL;
+        s_tx_stats.mbuf_waits++;
+        xSemaphoreTake(s_msys_freed, pdMS_TO_TICKS(10));
+    }
+}
+
+static int txq_enqueue(sonya_tx_class_t cls, struct os_mbuf *om, uint32_t wait_ms)
+{
+    txq_item_t it = { om, now_ms() };
+    bool queued = xQueueSend(s_txq[cls], &it, 0) == pdTRUE;
+    if (!queued && s_txq_policy[cls].drop_oldest) {
+        txq_item_t old;
+        if (xQueueReceive(s_txq[cls], &old, 0) == pdTRUE) {
+            os_mbuf_free_chain(old.om);
+            s_tx_stats.q_dropped[cls]++;
+        }
+        queued = xQueueSend(s_txq[cls], &it, 0) == pdTRUE;
+    } else if (!queued && wait_ms) {
+        queued = xQueueSend(s_txq[cls], &it, pdMS_TO_TICKS(wait_ms)) == pdTRUE;
+    }
+    if (!queued) {
+        os_mbuf_free_chain(om);
+        s_tx_stats.q_full[cls]++;
+        return -2;
+    }
+    xTaskNotifyGive(s_tx_task);
+    return 0;
 }
 
 int sonya_ble_tx_send(const uint8_t *data, size_t len)
 {
     if (!data || len == 0) return -1;
-    uint16_t chunk_max = CONFIG_CHUNK_SIZE;
-    if (chunk_max > 180) chunk_max = 180;
-
     size_t offset = 0;
     while (offset < len && conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+        // Re-read every chunk: the MTU exchange may complete mid-transfer.
+        uint16_t chunk_max = sonya_ble_max_payload();
+        if (chunk_max > CONFIG_CHUNK_SIZE) chunk_max = CONFIG_CHUNK_SIZE;
         uint16_t chunk_len = (uint16_t)((len - offset) > chunk_max ? chunk_max : (len - offset));
-        size_t frame_size = proto_build_frame(tx_queue, sizeof(tx_queue),
-                                               PROTO_AUDIO_CHUNK, tx_seq++,
-                                               data + offset, (uint16_t)chunk_len);
-        if (frame_size == 0) return -2;
-        int rc = send_notify(conn_handle, tx_queue, (uint16_t)frame_size);
+        sonya_ble_seg_t seg = { data + offset, chunk_len };
+        int rc = sonya_ble_send_frame_segs(SONYA_TX_LIVE, PROTO_AUDIO_CHUNK, &seg, 1);
         if (rc) return rc;
         offset += chunk_len;
-        vTaskDelay(pdMS_TO_TICKS(BLE_NOTIFY_PACE_MS));
     }
     if (offset != len) {
         // Disconnected mid-transfer. Tell the caller so it can abort recording cleanly.
@@ -325,21 +1128,203 @@ int sonya_ble_tx_send(const uint8_t *data, size_t len)
     return 0;
 }
 
+static int send_segs(sonya_tx_class_t cls, uint8_t type, const sonya_ble_seg_t *segs, int nseg,
+                     sonya_ble_unpin_cb_t unpin, void *arg)
+{
+    uint32_t plen = 0;
+    bool bad = (unsigned)cls >= SONYA_TX_CLASS_COUNT || nseg < 0 || nseg > FRAME_SEGS_MAX ||
+               (nseg && !segs) || conn_handle == BLE_HS_CONN_HANDLE_NONE;
+    for (int i = 0; !bad && i < nseg; i++) plen += segs[i].len;
+    // A notification longer than ATT_MTU-3 is silently truncated by the host,
+    // so refuse frames that do not fit the negotiated MTU.
+    if (!bad && plen > sonya_ble_max_payload()) {
+        ESP_LOGW(TAG, "frame 0x%02x payload %lu > max %u", type, (unsigned long)plen,
+                 (unsigned)sonya_ble_max_payload());
+        bad = true;
+    }
+    if (bad) {
+        if (unpin) unpin(arg);
+        return -1;
+    }
+    // Audio producers block for backpressure; control and telemetry never wait.
+    uint32_t wait_ms = (cls == SONYA_TX_LIVE || cls == SONYA_TX_BULK) ? BLE_NOTIFY_TIMEOUT_MS : 0;
+
+    uint8_t hdr[PROTO_V2_HEADER_SIZE + 1];
+    sonya_ble_seg_t all[1 + FRAME_SEGS_MAX];
+    sonya_ble_stream_lock((uint8_t)cls);
+    all[0].data = hdr;
+    all[0].len = (uint16_t)sonya_ble_frame_hdr(hdr, type, (uint8_t)cls, &tx_seq, (uint16_t)plen);
+    for (int i = 0; i < nseg; i++) all[1 + i] = segs[i];
+
+    struct os_mbuf *om = build_om(cls, all, 1 + nseg, unpin ? 0 : wait_ms);
+    // The payload is in om now; pinned source memory is not needed past this point.
+    if (unpin) unpin(arg);
+    int rc = -2;
+    if (om) rc = txq_enqueue(cls, om, wait_ms);
+    else s_tx_stats.q_full[cls]++;
+    sonya_ble_stream_unlock((uint8_t)cls, rc == 0);
+    return rc;
+}
+
+int sonya_ble_send_frame_segs(sonya_tx_class_t cls, uint8_t type,
+                              const sonya_ble_seg_t *segs, int nseg)
+{
+    return send_segs(cls, type, segs, nseg, NULL, NULL);
+}
+
+int sonya_ble_send_frame_segs_pinned(sonya_tx_class_t cls, uint8_t type,
+                                     const sonya_ble_seg_t *segs, int nseg,
+                                     sonya_ble_unpin_cb_t unpin, void *arg)
+{
+    return send_segs(cls, type, segs, nseg, unpin, arg);
+}
+
+int sonya_ble_tx_wait_room(uint32_t wait_ms)
+{
+    int64_t deadline = esp_timer_get_time() + (int64_t)wait_ms * 1000;
+    while (conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+        if (os_msys_num_free() > CONFIG_BLE_TX_MSYS_RESERVE) return 0;
+        if (esp_timer_get_time() >= deadline) return -2;
+        s_tx_stats.mbuf_waits++;
+        xSemaphoreTake(s_msys_freed, pdMS_TO_TICKS(10));
+    }
+    return -1;
+}
+
+static sonya_tx_class_t class_for_type(uint8_t type)
+{
+    switch (type) {
+    case PROTO_AUDIO_CHUNK: return SONYA_TX_LIVE;
+    case PROTO_AUDIO_DATA:
+    case PROTO_AUDIO_WIN:   return SONYA_TX_BULK;
+    default:                return SONYA_TX_CTRL;
+    }
+}
+
+/*
+ * Event batching (SESS flag PROTO_SESS_F_BATCH): small CTRL and TELEM frames collect as
+ * [type][len][value] records and go out as one EVT_BATCH when CONFIG_BLE_BATCH_WINDOW_MS
+ * expires or the next record would not fit the notification. An urgent event joins the
+ * batch and flushes it at once, so records keep their order. A lone record goes out
+ * as a plain frame. The container takes CTRL priority if any record is CTRL.
+ */
+#define BATCH_REC_HDR 2
+#define BATCH_VAL_MAX 255
+
+static volatile bool s_batch_on;
+static SemaphoreHandle_t s_batch_lock;
+static esp_timer_handle_t s_batch_timer;
+static uint8_t  s_batch_buf[SONYA_BLE_PAYLOAD_MAX];
+static uint16_t s_batch_len;
+static uint8_t  s_batch_n;
+static bool     s_batch_ctrl;
+
+static bool batch_urgent(uint8_t type)
+{
+    switch (type) {
+    case PROTO_EVT_WAKE:
+    case PROTO_EVT_REC_START:
+    case PROTO_EVT_REC_END:
+    case PROTO_EVT_REC_INFO:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int batch_flush_locked(void)
+{
+    if (s_batch_timer) esp_timer_stop(s_batch_timer);
+    if (s_batch_n == 0) return 0;
+    sonya_tx_class_t cls = s_batch_ctrl ? SONYA_TX_CTRL : SONYA_TX_TELEM;
+    int rc;
+    if (s_batch_n == 1) {
+        sonya_ble_seg_t seg = { s_batch_buf + BATCH_REC_HDR, s_batch_buf[1] };
+        rc = sonya_ble_send_frame_segs(cls, s_batch_buf[0], &seg, seg.len ? 1 : 0);
+    } else {
+        sonya_ble_seg_t seg = { s_batch_buf, s_batch_len };
+        rc = sonya_ble_send_frame_segs(cls, PROTO_EVT_BATCH, &seg, 1);
+        s_tx_stats.batches++;
+        s_tx_stats.batched += s_batch_n;
+    }
+    s_batch_len = 0;
+    s_batch_n = 0;
+    s_batch_ctrl = false;
+    return rc;
+}
+
+static void batch_expired(void *arg)
+{
+    (void)arg;
+    xSemaphoreTake(s_batch_lock, portMAX_DELAY);
+    batch_flush_locked();
+    xSemaphoreGive(s_batch_lock);
+}
+
+static void batch_init(void)
+{
+    s_batch_lock = xSemaphoreCreateMutex();
+    const esp_timer_create_args_t targs = {
+        .callback = batch_expired,
+        .name = "ble_batch",
+    };
+    if (!s_batch_lock || esp_timer_create(&targs, &s_batch_timer) != ESP_OK) {
+        ESP_LOGW(TAG, "batch timer create failed, events go out one per frame");
+        s_batch_timer = NULL;
+    }
+}
+
+/* A CTRL or TELEM frame: into the open batch when batching is on, else straight out. */
+static int send_small(sonya_tx_class_t cls, uint8_t type, const uint8_t *payload, uint16_t plen)
+{
+    sonya_ble_seg_t seg = { payload, plen };
+    if (!s_batch_on || !s_batch_timer) return sonya_ble_send_frame_segs(cls, type, &seg, plen ? 1 : 0);
+
+    xSemaphoreTake(s_batch_lock, portMAX_DELAY);
+    uint16_t room = sonya_ble_max_payload();
+    if (room > sizeof(s_batch_buf)) room = sizeof(s_batch_buf);
+    int rc = 0;
+    if (plen > BATCH_VAL_MAX || BATCH_REC_HDR + plen > room) {
+        batch_flush_locked();
+        rc = sonya_ble_send_frame_segs(cls, type, &seg, plen ? 1 : 0);
+    } else {
+        if (s_batch_len + BATCH_REC_HDR + plen > room) batch_flush_locked();
+        bool first = s_batch_n == 0;
+        s_batch_buf[s_batch_len] = type;
+        s_batch_buf[s_batch_len + 1] = (uint8_t)plen;
+        if (plen) memcpy(s_batch_buf + s_batch_len + BATCH_REC_HDR, payload, plen);
+        s_batch_len += BATCH_REC_HDR + plen;
+        s_batch_n++;
+        if (cls == SONYA_TX_CTRL) s_batch_ctrl = true;
+        if (batch_urgent(type)) {
+            rc = batch_flush_locked();
+        } else if (first) {
+            esp_timer_start_once(s_batch_timer, (uint64_t)CONFIG_BLE_BATCH_WINDOW_MS * 1000);
+        }
+    }
+    xSemaphoreGive(s_batch_lock);
+    return rc;
+}
+
+void sonya_ble_set_batch(bool on)
+{
+    if (!s_batch_lock) return;
+    xSemaphoreTake(s_batch_lock, portMAX_DELAY);
+    if (!on) batch_flush_locked();
+    s_batch_on = on;
+    xSemaphoreGive(s_batch_lock);
+}
+
 static int send_frame(uint8_t type, const uint8_t *payload, uint16_t plen)
 {
-    // Must fit any single-frame payload we send.
-    // With ATT_MTU=256, max notify value len is 253 bytes. Our frame header is 5 bytes,
-    // so max payload is 248 bytes.
-    uint8_t buf[PROTO_FRAME_HEADER_SIZE + 248];
-    size_t sz = proto_build_frame(buf, sizeof(buf), type, tx_seq++, payload, plen);
-    if (sz == 0) return -1;
-    return send_notify(conn_handle, buf, (uint16_t)sz);
+    sonya_tx_class_t cls = class_for_type(type);
+    if (cls == SONYA_TX_CTRL) return send_small(cls, type, payload, plen);
+    sonya_ble_seg_t seg = { payload, plen };
+    return sonya_ble_send_frame_segs(cls, type, &seg, plen ? 1 : 0);
 }
 
 int sonya_ble_send_frame(uint8_t type, const uint8_t *payload, uint16_t plen)
 {
-    // For large payloads caller should use dedicated data path; keep this simple.
-    if (plen > 248) return -1;
     return send_frame(type, payload, plen);
 }
 
@@ -348,9 +1333,21 @@ int sonya_ble_send_evt_wake(void)
     return send_frame(PROTO_EVT_WAKE, NULL, 0);
 }
 
-int sonya_ble_send_evt_rec_start(void)
+int sonya_ble_send_evt_rec_start(const proto_session_t *sess)
 {
-    return send_frame(PROTO_EVT_REC_START, NULL, 0);
+    // [max_payload:u16][att_mtu:u16][codec:u8] so the phone can size its buffers and windows,
+    // then [ver:u8][frame:u16][mode:u8] echoing the session once the phone sent SESS.
+    uint16_t max = sonya_ble_max_payload();
+    uint16_t mtu = s_att_mtu;
+    uint8_t meta[9] = {
+        (uint8_t)(max & 0xFF), (uint8_t)(max >> 8),
+        (uint8_t)(mtu & 0xFF), (uint8_t)(mtu >> 8),
+        sess->codec,
+        sess->ver,
+        (uint8_t)(sess->frame & 0xFF), (uint8_t)(sess->frame >> 8),
+        sess->mode,
+    };
+    return send_frame(PROTO_EVT_REC_START, meta, (uint16_t)(sess->ver ? 9 : 5));
 }
 
 int sonya_ble_send_evt_rec_end(void)
@@ -358,6 +1355,31 @@ int sonya_ble_send_evt_rec_end(void)
     return send_frame(PROTO_EVT_REC_END, NULL, 0);
 }
 
+int sonya_ble_send_telemetry(const char *msg)
+{
+    if (!msg) return -1;
+    size_t len = strlen(msg);
+    if (len > 96) len = 96;
+    return send_small(SONYA_TX_TELEM, PROTO_EVT_ERROR, (const uint8_t *)msg, (uint16_t)len);
+}
+
+void sonya_ble_set_status(const uint8_t *p, uint16_t len)
+{
+    if (!p) return;
+    if (len > sizeof(s_status)) len = sizeof(s_status);
+    portENTER_CRITICAL(&s_status_mux);
+    memcpy(s_status, p, len);
+    s_status_len = len;
+    portEXIT_CRITICAL(&s_status_mux);
+}
+
+int sonya_ble_send_status(sonya_tx_class_t cls, const uint8_t *p, uint16_t len)
+{
+    if (!p || len > PROTO_STATUS_LEN) return -1;
+    sonya_ble_set_status(p, len);
+    return send_small(cls, PROTO_EVT_STATUS, p, len);
+}
+
 int sonya_ble_send_evt_error(const char *msg)
 {
     if (!msg) return -1;
@@ -373,6 +1395,164 @@ bool sonya_ble_is_connected(void)
 
 int sonya_ble_set_conn_power_save(bool enable)
 {
-    s_conn_power_save = enable;
-    return apply_conn_params(enable);
+    return sonya_ble_set_link_phase(enable ? SONYA_LINK_IDLE : SONYA_LINK_STREAMING);
+}
+
+void sonya_ble_get_tx_stats(sonya_ble_tx_stats_t *out)
+{
+    if (!out) return;
+    *out = s_tx_stats;
+    if (s_msys_pool_cnt) out->msys_free_min = msys_min_free();
+}
+
+void sonya_ble_reset_tx_stats(void)
+{
+    uint16_t inflight_max = s_tx_stats.inflight_max;
+    uint32_t batches = s_tx_stats.batches, batched = s_tx_stats.batched;
+    memset(&s_tx_stats, 0, sizeof(s_tx_stats));
+    s_tx_stats.inflight_max = inflight_max;
+    s_tx_stats.batches = batches;
+    s_tx_stats.batched = batched;
+    s_tx_stats.msys_free_min = 0xFFFF;
+    for (int i = 0; i < s_msys_pool_cnt; i++) {
+        s_msys_pools[i]->mpe_mp.mp_min_free = s_msys_pools[i]->mpe_mp.mp_num_free;
+    }
+}
+
+int sonya_ble_tx_queue_depth(sonya_tx_class_t cls)
+{
+    if ((unsigned)cls >= SONYA_TX_CLASS_COUNT || !s_txq[cls]) return 0;
+    return (int)uxQueueMessagesWaiting(s_txq[cls]);
+}
+
+int sonya_ble_set_tx_inflight(int n)
+{
+    if (n <= 0 || n > CONFIG_BLE_TX_INFLIGHT_MAX) n = CONFIG_BLE_TX_INFLIGHT_MAX;
+    int park = CONFIG_BLE_TX_INFLIGHT_MAX - n;
+    while (s_credits_parked > park) {
+        xSemaphoreGive(s_tx_credits);
+        s_credits_parked--;
+    }
+    // Parking waits for in-flight notifications to complete and hand their credit back.
+    while (s_credits_parked < park &&
+           xSemaphoreTake(s_tx_credits, pdMS_TO_TICKS(BLE_NOTIFY_TIMEOUT_MS)) == pdTRUE) {
+        s_credits_parked++;
+    }
+    s_tx_stats.inflight_max = (uint16_t)(CONFIG_BLE_TX_INFLIGHT_MAX - s_credits_parked);
+    return s_tx_stats.inflight_max;
+}
+
+uint32_t sonya_ble_conn_itvl_us(void)
+{
+    struct ble_gap_conn_desc desc;
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE) return 0;
+    if (ble_gap_conn_find(conn_handle, &desc) != 0) return 0;
+    return (uint32_t)desc.conn_itvl * 1250U;
+}
+
+uint16_t sonya_ble_att_mtu(void)
+{
+    return s_att_mtu;
+}
+
+void sonya_ble_set_frame_format(bool v2, bool hcrc)
+{
+    // Not while a frame is between its seq and the queue.
+    for (int i = 0; i < PROTO_SID_COUNT; i++) sonya_ble_stream_lock((uint8_t)i);
+    memset(s_sid_seq, 0, sizeof(s_sid_seq));
+    s_hdr_crc = v2 && hcrc;
+    s_hdr_v2 = v2;
+    for (int i = PROTO_SID_COUNT - 1; i >= 0; i--) sonya_ble_stream_unlock((uint8_t)i, true);
+}
+
+void sonya_ble_stream_lock(uint8_t sid)
+{
+    if (sid >= PROTO_SID_COUNT || !s_sid_lock[sid]) return;
+    xSemaphoreTake(s_sid_lock[sid], portMAX_DELAY);
+    s_sid_mark[sid] = s_sid_seq[sid];
+}
+
+void sonya_ble_stream_unlock(uint8_t sid, bool queued)
+{
+    if (sid >= PROTO_SID_COUNT || !s_sid_lock[sid]) return;
+    // A seq that never reached the queue would read as a lost frame on the phone.
+    if (!queued) s_sid_seq[sid] = s_sid_mark[sid];
+    xSemaphoreGive(s_sid_lock[sid]);
+}
+
+uint16_t sonya_ble_frame_hdr_size(void)
+{
+    return s_hdr_v2 ? (uint16_t)(PROTO_V2_HEADER_SIZE + (s_hdr_crc ? 1 : 0)) : PROTO_FRAME_HEADER_SIZE;
+}
+
+uint32_t sonya_ble_stream_seq(uint8_t sid)
+{
+    return sid < PROTO_SID_COUNT ? s_sid_seq[sid] : 0;
+}
+
+size_t sonya_ble_frame_hdr(uint8_t *hdr, uint8_t type, uint8_t sid, uint16_t *v1_seq, uint16_t plen)
+{
+    if (s_hdr_v2 && sid < PROTO_SID_COUNT) {
+        return proto_build_header_v2(hdr, PROTO_V2_HEADER_SIZE + 1, type, sid, s_sid_seq[sid]++,
+                                     plen, s_hdr_crc);
+    }
+    uint16_t seq = (*v1_seq)++;
+    hdr[0] = type;
+    hdr[1] = (uint8_t)(seq & 0xFF);
+    hdr[2] = (uint8_t)(seq >> 8);
+    hdr[3] = (uint8_t)(plen & 0xFF);
+    hdr[4] = (uint8_t)(plen >> 8);
+    return PROTO_FRAME_HEADER_SIZE;
+}
+
+uint16_t sonya_ble_max_payload(void)
+{
+    uint16_t mtu = s_att_mtu;
+    if (mtu < BLE_ATT_MTU_DFLT) mtu = BLE_ATT_MTU_DFLT;
+    uint16_t max = (uint16_t)(mtu - ATT_NOTIFY_HDR - sonya_ble_frame_hdr_size());
+    return max > SONYA_BLE_PAYLOAD_MAX ? SONYA_BLE_PAYLOAD_MAX : max;
+}
+
+void sonya_ble_request_fast_link(void)
+{
+    uint16_t conn = conn_handle;
+    if (conn == BLE_HS_CONN_HANDLE_NONE || s_fast_link_requested) return;
+    s_fast_link_requested = true;
+
+    // Both are requests to the controller; the outcome arrives as GAP events, and a
+    // peer that refuses leaves the link on 1M / 27 octets, which still works.
+    int rc = ble_gap_set_data_len(conn, LL_TX_OCTETS_MAX, LL_TX_TIME_MAX);
+    if (rc != 0) ESP_LOGW(TAG, "set_data_len rc=%d", rc);
+#if CONFIG_BT_NIMBLE_LL_CFG_FEAT_LE_2M_PHY
+    rc = ble_gap_set_prefered_le_phy(conn, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_2M_MASK,
+                                     BLE_GAP_LE_PHY_CODED_ANY);
+    if (rc != 0) ESP_LOGW(TAG, "set_prefered_le_phy rc=%d, staying on 1M", rc);
+#endif
+    ESP_LOGI(TAG, "fast link requested (2M PHY, %u octets)", (unsigned)LL_TX_OCTETS_MAX);
+}
+
+void sonya_ble_get_link_info(sonya_ble_link_info_t *out)
+{
+    if (!out) return;
+    *out = s_link;
+    out->att_mtu = s_att_mtu;
+    out->itvl_us = sonya_ble_conn_itvl_us();
+}
+
+void sonya_ble_set_subscribe_cb(sonya_ble_sub_cb_t cb, void *arg)
+{
+    sub_arg = arg;
+    sub_cb = cb;
+}
+
+int64_t sonya_ble_rx_time_us(void)
+{
+    return xTaskGetCurrentTaskHandle() == s_rx_task ? s_rx_cur_us : 0;
+}
+
+void sonya_ble_get_rx_stats(sonya_ble_rx_stats_t *out)
+{
+    if (!out) return;
+    *out = s_rx_stats;
+    out->queued = s_rxq ? (uint16_t)uxQueueMessagesWaiting(s_rxq) : 0;
 }
@@ -0,0 +1,234 @@
+/**
+ * @file sonya_ble_coc.c
+ * @brief Optional L2CAP CoC (LE credit-based) bulk channel for audio
+ *
+ * The phone connects to CONFIG_BLE_COC_PSM after the GATT link is up. While the
+ * channel is open, pull_stream sends AUDIO_DATA frames as one SDU each; GATT RX/TX
+ * stays the control path. Flow control comes from L2CAP credits: a send that
+ * exhausts them returns ESTALLED and the next one waits for TX_UNSTALLED.
+ */
+
+#include "sonya_ble.h"
+#include "sonya_ble_coc.h"
+#include "protocol.h"
+#include "esp_log.h"
+#include "sonya_diaglog.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "host/ble_hs.h"
+#include "os/os_mbuf.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include <string.h>
+
+static const char *TAG = "sonya_coc";
+
+#if CONFIG_BLE_COC_ENABLE
+
+#if !defined(CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM) || CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM < 1
+#error "BLE_COC_ENABLE needs BT_NIMBLE_L2CAP_COC_MAX_NUM >= 1"
+#endif
+
+#define COC_SEND_TIMEOUT_MS 2000
+
+static struct ble_l2cap_chan *volatile s_chan;
+static uint16_t s_peer_sdu;
+static uint16_t s_seq;
+static SemaphoreHandle_t s_unstalled;
+static volatile bool s_stalled;
+
+static int coc_give_rx_buf(struct ble_l2cap_chan *chan)
+{
+    struct os_mbuf *sdu = os_msys_get_pkthdr(CONFIG_BLE_COC_SDU_MAX, 0);
+    if (!sdu) return BLE_HS_ENOMEM;
+    int rc = ble_l2cap_recv_ready(chan, sdu);
+    if (rc) os_mbuf_free_chain(sdu);
+    return rc;
+}
+
+static int coc_event(struct ble_l2cap_event *event, void *arg)
+{
+    (void)arg;
+    switch (event->type) {
+    case BLE_L2CAP_EVENT_COC_ACCEPT:
+        if (s_chan) return BLE_HS_EALREADY;
+        return coc_give_rx_buf(event->accept.chan);
+
+    case BLE_L2CAP_EVENT_COC_CONNECTED: {
+        if (event->connect.status) {
+            ESP_LOGW(TAG, "CoC connect failed status=%d", event->connect.status);
+            return 0;
+        }
+        struct ble_l2cap_chan_info info;
+        uint16_t peer_sdu = 0;
+        if (ble_l2cap_get_chan_info(event->connect.chan, &info) == 0) peer_sdu = info.peer_coc_mtu;
+        s_peer_sdu = peer_sdu < CONFIG_BLE_COC_SDU_MAX ? peer_sdu : CONFIG_BLE_COC_SDU_MAX;
+        s_seq = 0;
+        s_stalled = false;
+        xSemaphoreTake(s_unstalled, 0);
+        s_chan = event->connect.chan;
+        ESP_LOGI(TAG, "CoC open psm=0x%02x peer_sdu=%u sdu=%u",
+                 CONFIG_BLE_COC_PSM, (unsigned)peer_sdu, (unsigned)s_peer_sdu);
+        sonya_diaglog_addf("ble", "coc open sdu=%u", (unsigned)s_peer_sdu);
+        return 0;
+    }
+
+    case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+        s_chan = NULL;
+        s_peer_sdu = 0;
+        xSemaphoreGive(s_unstalled);   // wake a sender blocked on credits
+        ESP_LOGI(TAG, "CoC closed");
+        return 0;
+
+    case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+        // Control stays on GATT; anything the phone writes here is dropped.
+        if (event->receive.sdu_rx) os_mbuf_free_chain(event->receive.sdu_rx);
+        return coc_give_rx_buf(event->receive.chan);
+
+    case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+        s_stalled = false;
+        xSemaphoreGive(s_unstalled);
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+int sonya_ble_coc_init(void)
+{
+    s_unstalled = xSemaphoreCreateBinary();
+    if (!s_unstalled) return -1;
+    int rc = ble_l2cap_create_server(CONFIG_BLE_COC_PSM, CONFIG_BLE_COC_SDU_MAX, coc_event, NULL);
+    if (rc) {
+        ESP_LOGE(TAG, "create_server psm=0x%02x rc=%d", CONFIG_BLE_COC_PSM, rc);
+        return rc;
+    }
+    ESP_LOGI(TAG, "CoC server psm=0x%02x sdu=%d", CONFIG_BLE_COC_PSM, CONFIG_BLE_COC_SDU_MAX);
+    return 0;
+}
+
+bool sonya_ble_coc_is_open(void)
+{
+    return s_chan != NULL;
+}
+
+uint16_t sonya_ble_coc_max_payload(void)
+{
+    uint16_t hdr = sonya_ble_frame_hdr_size();
+    return s_chan && s_peer_sdu > hdr ? (uint16_t)(s_peer_sdu - hdr) : 0;
+}
+
+/* Copy header and segments into one SDU, unpin, then wait for credits and queue it. */
+static int coc_queue(struct ble_l2cap_chan *chan, const uint8_t *fh, size_t fhlen, uint32_t plen,
+                     const sonya_ble_seg_t *segs, int nseg, sonya_ble_unpin_cb_t unpin, void *arg,
+                     int64_t deadline)
+{
+    // Copy first: pinned segments are released before any wait on credits.
+    struct os_mbuf *om = NULL;
+    while (!om && s_chan == chan) {
+        om = os_msys_get_pkthdr((uint16_t)(fhlen + plen), 0);
+        if (om || unpin || esp_timer_get_time() >= deadline) break;
+        vTaskDelay(1);
+    }
+    bool ok = om != NULL && os_mbuf_append(om, fh, (uint16_t)fhlen) == 0;
+    for (int i = 0; ok && i < nseg; i++) {
+        if (segs[i].len) ok = os_mbuf_append(om, segs[i].data, segs[i].len) == 0;
+    }
+    if (unpin) unpin(arg);
+    if (!ok) {
+        if (om) os_mbuf_free_chain(om);
+        return s_chan == chan ? -2 : -1;
+    }
+
+    if (s_stalled && xSemaphoreTake(s_unstalled, pdMS_TO_TICKS(COC_SEND_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "send: no credits in %d ms", COC_SEND_TIMEOUT_MS);
+        os_mbuf_free_chain(om);
+        return -2;
+    }
+
+    for (;;) {
+        if (s_chan != chan) {
+            os_mbuf_free_chain(om);
+            return -1;
+        }
+        int rc = ble_l2cap_send(chan, om);
+        if (rc == 0 || rc == BLE_HS_ESTALLED) {
+            // ESTALLED: the SDU is queued but used the last credit; hold off the next one.
+            if (rc == BLE_HS_ESTALLED) s_stalled = true;
+            return 0;
+        }
+        if (rc == BLE_HS_EBUSY && esp_timer_get_time() < deadline) {
+            // Previous SDU still draining; om was not consumed.
+            xSemaphoreTake(s_unstalled, pdMS_TO_TICKS(20));
+            continue;
+        }
+        ESP_LOGE(TAG, "l2cap_send rc=%d", rc);
+        os_mbuf_free_chain(om);
+        return -2;
+    }
+}
+
+static int coc_send(uint8_t type, const sonya_ble_seg_t *segs, int nseg,
+                    sonya_ble_unpin_cb_t unpin, void *arg)
+{
+    struct ble_l2cap_chan *chan = s_chan;
+    uint32_t plen = 0;
+    bool bad = !chan || nseg < 0 || (nseg && !segs);
+    for (int i = 0; !bad && i < nseg; i++) plen += segs[i].len;
+    if (bad || plen > sonya_ble_coc_max_payload()) {
+        if (unpin) unpin(arg);
+        return -1;
+    }
+
+    int64_t deadline = esp_timer_get_time() + (int64_t)COC_SEND_TIMEOUT_MS * 1000;
+    // The seq is committed only once the SDU is queued: v1 through s_seq, v2 by the stream lock.
+    uint8_t fh[PROTO_V2_HEADER_SIZE + 1];
+    sonya_ble_stream_lock(PROTO_SID_COC);
+    uint16_t seq = s_seq;
+    size_t fhlen = sonya_ble_frame_hdr(fh, type, PROTO_SID_COC, &seq, (uint16_t)plen);
+    int rc = coc_queue(chan, fh, fhlen, plen, segs, nseg, unpin, arg, deadline);
+    if (rc == 0) s_seq = seq;
+    sonya_ble_stream_unlock(PROTO_SID_COC, rc == 0);
+    return rc;
+}
+
+int sonya_ble_coc_send_frame_segs(uint8_t type, const sonya_ble_seg_t *segs, int nseg)
+{
+    return coc_send(type, segs, nseg, NULL, NULL);
+}
+
+int sonya_ble_coc_send_frame_segs_pinned(uint8_t type, const sonya_ble_seg_t *segs, int nseg,
+                                         sonya_ble_unpin_cb_t unpin, void *arg)
+{
+    return coc_send(type, segs, nseg, unpin, arg);
+}
+
+#else /* !CONFIG_BLE_COC_ENABLE */
+
+int sonya_ble_coc_init(void)
+{
+    ESP_LOGI(TAG, "CoC disabled");
+    return 0;
+}
+
+bool sonya_ble_coc_is_open(void) { return false; }
+
+uint16_t sonya_ble_coc_max_payload(void) { return 0; }
+
+int sonya_ble_coc_send_frame_segs(uint8_t type, const sonya_ble_seg_t *segs, int nseg)
+{
+    (void)type; (void)segs; (void)nseg;
+    return -1;
+}
+
+int sonya_ble_coc_send_frame_segs_pinned(uint8_t type, const sonya_ble_seg_t *segs, int nseg,
+                                         sonya_ble_unpin_cb_t unpin, void *arg)
+{
+    (void)type; (void)segs; (void)nseg;
+    if (unpin) unpin(arg);
+    return -1;
+}
+
+#endif
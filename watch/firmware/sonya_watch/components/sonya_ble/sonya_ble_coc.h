@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Internal: L2CAP CoC server registration for sonya_ble.
+ * Called from sonya_ble_init() after the host is initialized, before it runs.
+ */
+
+int sonya_ble_coc_init(void);
+
+/*
+ * Internal: write the header of one TX frame in the current format (v1, or v2 after
+ * sonya_ble_set_frame_format). v1 takes *v1_seq++, v2 the next seq of stream sid.
+ * hdr needs PROTO_V2_HEADER_SIZE + 1 bytes. Returns the header size.
+ */
+size_t sonya_ble_frame_hdr(uint8_t *hdr, uint8_t type, uint8_t sid, uint16_t *v1_seq, uint16_t plen);
+
+/*
+ * Internal: hold stream sid from sonya_ble_frame_hdr() until the frame is queued.
+ * unlock with queued = false returns the seqs taken under the lock, so a failed send
+ * leaves no gap in the stream.
+ */
+void sonya_ble_stream_lock(uint8_t sid);
+void sonya_ble_stream_unlock(uint8_t sid, bool queued);
@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "sonya_ble.h"
@@ -25,10 +26,11 @@
 #include "sdkconfig.h"
 #include "sonya_board.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 
 static const char *TAG = "main";
 
-#define REC_MAX_SEC 30
+#define REC_MAX_SEC CONFIG_REC_MAX_SEC
 
 static int s_rec_seconds = CONFIG_REC_SECONDS;
 static volatile bool s_is_recording = false;
@@ -38,17 +40,133 @@ static bool s_audio_initialized = false;
 static bool s_audio_streaming = false;
 static TickType_t s_last_pwrmon_tick = 0;
 static int s_last_pwrmon_bmv = -1;
+static sonya_ble_beacon_t s_beacon = { .batt_pct = 0xFF, .fw_build = CONFIG_FW_BUILD };
+
+/* Refresh recording/error state and push the beacon (no-op unless something changed). */
+static void beacon_publish(void)
+{
+    int total = rec_store_total_bytes();
+    bool committed = rec_store_is_committed() && total > 0;
+    s_beacon.flags &= (uint8_t)~(SONYA_BEACON_F_RECORDING | SONYA_BEACON_F_COMMITTED);
+    if (s_is_recording) s_beacon.flags |= SONYA_BEACON_F_RECORDING;
+    if (committed) s_beacon.flags |= SONYA_BEACON_F_COMMITTED;
+    s_beacon.rec_pending = committed ? 1 : 0;
+    s_beacon.rec_bytes = total > 0 ? (uint32_t)total : 0;
+    if (s_no_mic_mode) s_beacon.err_flags |= SONYA_BEACON_E_NOMIC;
+    sonya_ble_set_beacon(&s_beacon);
+}
+
+/* Last successful PMU read, shared by BATT/EVT_STATUS and the power monitor. */
+typedef struct {
+    int      pct;
+    uint16_t bmv;
+    uint16_t vbus_mv;
+    bool     charging;
+    bool     vbus_in;
+    bool     bat_present;
+    bool     err;            // the most recent read failed; the fields above are older
+} pmu_sample_t;
+
+static pmu_sample_t s_pmu = { .pct = -1 };
+static TickType_t s_last_status_tick = 0;
+
+static esp_err_t pmu_sample(void)
+{
+    pmu_sample_t p = { .pct = -1 };
+    esp_err_t err = sonya_board_pmu_read_status(&p.pct, &p.bmv, &p.vbus_mv, &p.charging, &p.vbus_in, &p.bat_present);
+    if (err != ESP_OK) {
+        s_pmu.err = true;
+        return err;
+    }
+    s_pmu = p;
+    return ESP_OK;
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v & 0xFF);
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, (uint16_t)(v & 0xFFFF));
+    put_le16(p + 2, (uint16_t)(v >> 16));
+}
+
+/* EVT_STATUS payload (layout in protocol.h) from the cached PMU sample and live counters. */
+static void status_build(uint8_t p[PROTO_STATUS_LEN])
+{
+    uint8_t flags = 0;
+    if (s_pmu.charging) flags |= PROTO_STATUS_F_CHARGING;
+    if (s_pmu.vbus_in) flags |= PROTO_STATUS_F_VBUS;
+    if (s_pmu.bat_present) flags |= PROTO_STATUS_F_BATTERY;
+    if (s_is_recording) flags |= PROTO_STATUS_F_RECORDING;
+    if (s_audio_streaming) flags |= PROTO_STATUS_F_MIC;
+    if (s_pmu.err) flags |= PROTO_STATUS_F_PMU_ERR;
+    if (s_no_mic_mode) flags |= PROTO_STATUS_F_NO_MIC;
+
+    sonya_ble_link_info_t link = {0};
+    if (sonya_ble_is_connected()) sonya_ble_get_link_info(&link);
+    sonya_ble_tx_stats_t tx;
+    sonya_ble_get_tx_stats(&tx);
+    uint32_t dropped = 0;
+    for (int c = 0; c < SONYA_TX_CLASS_COUNT; c++) dropped += tx.q_dropped[c];
+    rec_store_pool_stats_t pool;
+    rec_store_pool_stats(&pool);
+    int rec_bytes = rec_store_total_bytes();
+
+    p[0] = PROTO_STATUS_VERSION;
+    p[1] = flags;
+    p[2] = (s_pmu.pct >= 0 && s_pmu.pct <= 100) ? (uint8_t)s_pmu.pct : 0xFF;
+    p[3] = link.tx_phy;
+    put_le16(p + 4, s_pmu.bmv);
+    put_le16(p + 6, s_pmu.vbus_mv);
+    put_le32(p + 8, (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    put_le32(p + 12, (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    put_le32(p + 16, (uint32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    put_le32(p + 20, rec_bytes > 0 ? (uint32_t)rec_bytes : 0);
+    put_le16(p + 24, pool.blocks_free);
+    put_le16(p + 26, pool.blocks_total);
+    put_le16(p + 28, link.att_mtu);
+    put_le16(p + 30, (uint16_t)(link.itvl_us / 1250));
+    for (int c = 0; c < SONYA_TX_CLASS_COUNT; c++) {
+        int d = sonya_ble_tx_queue_depth((sonya_tx_class_t)c);
+        p[32 + c] = (uint8_t)(d < 0 ? 0 : (d > 0xFF ? 0xFF : d));
+    }
+    put_le32(p + 36, tx.frames_failed);
+    put_le32(p + 40, dropped);
+    put_le32(p + 44, (uint32_t)(esp_timer_get_time() / 1000000));
+}
+
+/* Keep the TX read value current; cheap (no PMU access), called from the main loop. */
+static void status_refresh(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    if (s_last_status_tick != 0 && (now - s_last_status_tick) < pdMS_TO_TICKS(1000)) return;
+    uint8_t p[PROTO_STATUS_LEN];
+    status_build(p);
+    sonya_ble_set_status(p, sizeof(p));
+    s_last_status_tick = now;
+}
 
 static void send_batt_status(const char *reason)
 {
     if (!sonya_ble_is_connected()) return;
-    int batt_pct = -1;
-    uint16_t batt_mv = 0;
-    uint16_t vbus_mv = 0;
-    bool charging = false;
-    bool vbus_in = false;
-    bool battery_present = false;
-    esp_err_t err = sonya_board_pmu_read_status(&batt_pct, &batt_mv, &vbus_mv, &charging, &vbus_in, &battery_present);
+    // Replies to PING/BATT are control traffic; the periodic report is telemetry.
+    bool periodic = reason && strcmp(reason, "periodic") == 0;
+    esp_err_t err = pmu_sample();
+    proto_session_t sess;
+    pull_stream_get_session(&sess);
+    if (sess.mode & PROTO_SESS_F_STATUS) {
+        if (err != ESP_OK) ESP_LOGW(TAG, "BATT read fail: %d", (int)err);
+        uint8_t p[PROTO_STATUS_LEN];
+        status_build(p);
+        sonya_ble_send_status(periodic ? SONYA_TX_TELEM : SONYA_TX_CTRL, p, sizeof(p));
+        s_last_status_tick = xTaskGetTickCount();
+        s_last_batt_sent_tick = s_last_status_tick;
+        return;
+    }
     if (err != ESP_OK) {
         ESP_LOGW(TAG, "BATT read fail: %d", (int)err);
         sonya_ble_send_evt_error("BATT:err=pmu_read");
@@ -56,9 +174,11 @@ static void send_batt_status(const char *reason)
     }
     char msg[96];
     snprintf(msg, sizeof(msg), "BATT:pct=%d,bmv=%u,vbus=%u,chg=%d,in=%d,bat=%d",
-             batt_pct, (unsigned)batt_mv, (unsigned)vbus_mv, charging ? 1 : 0, vbus_in ? 1 : 0, battery_present ? 1 : 0);
+             s_pmu.pct, (unsigned)s_pmu.bmv, (unsigned)s_pmu.vbus_mv,
+             s_pmu.charging ? 1 : 0, s_pmu.vbus_in ? 1 : 0, s_pmu.bat_present ? 1 : 0);
     ESP_LOGI(TAG, "TX %s (%s)", msg, reason ? reason : "n/a");
-    sonya_ble_send_evt_error(msg);
+    if (periodic) sonya_ble_send_telemetry(msg);
+    else sonya_ble_send_evt_error(msg);
     s_last_batt_sent_tick = xTaskGetTickCount();
 }
 
@@ -70,17 +190,23 @@ static void pwrmon_tick(void)
         return;
     }
 
-    int batt_pct = -1;
-    uint16_t batt_mv = 0;
-    uint16_t vbus_mv = 0;
-    bool charging = false;
-    bool vbus_in = false;
-    bool battery_present = false;
-    esp_err_t err = sonya_board_pmu_read_status(&batt_pct, &batt_mv, &vbus_mv, &charging, &vbus_in, &battery_present);
+    esp_err_t err = pmu_sample();
     if (err != ESP_OK) {
         ESP_LOGW(TAG, "PWRMON read fail: %d", (int)err);
+        s_beacon.err_flags |= SONYA_BEACON_E_PMU;
         return;
     }
+    int batt_pct = s_pmu.pct;
+    uint16_t batt_mv = s_pmu.bmv;
+    uint16_t vbus_mv = s_pmu.vbus_mv;
+    bool charging = s_pmu.charging;
+    bool vbus_in = s_pmu.vbus_in;
+    bool battery_present = s_pmu.bat_present;
+    s_beacon.err_flags &= (uint8_t)~SONYA_BEACON_E_PMU;
+    s_beacon.batt_pct = (batt_pct >= 0 && batt_pct <= 100) ? (uint8_t)batt_pct : 0xFF;
+    s_beacon.flags &= (uint8_t)~(SONYA_BEACON_F_CHARGING | SONYA_BEACON_F_VBUS);
+    if (charging) s_beacon.flags |= SONYA_BEACON_F_CHARGING;
+    if (vbus_in) s_beacon.flags |= SONYA_BEACON_F_VBUS;
 
     int dmv = 0;
     int mv_per_min = 0;
@@ -177,60 +303,262 @@ static bool btn_released_stable_ms(int stable_ms)
 
 /* ---- BLE RX handler ---- */
 
-static void on_ble_rx(const uint8_t *data, uint16_t len, void *arg)
+/* ---- per-command latency: receive on the host task -> replies queued ---- */
+
+typedef struct {
+    uint32_t n;
+    uint32_t max_us;
+    uint64_t sum_us;
+} cmd_lat_t;
+
+static cmd_lat_t s_cmd_lat[PROTO_CMD_COUNT];
+
+static const char *const s_cmd_name[PROTO_CMD_COUNT] = {
+    [PROTO_CMD_NONE]   = "?",
+    [PROTO_CMD_PING]   = "PING",
+    [PROTO_CMD_REC]    = "REC",
+    [PROTO_CMD_SETREC] = "SETREC",
+    [PROTO_CMD_BATT]   = "BATT",
+    [PROTO_CMD_GET]    = "GET",
+    [PROTO_CMD_DONE]   = "DONE",
+    [PROTO_CMD_XGET]   = "XGET",
+    [PROTO_CMD_XACK]   = "XACK",
+    [PROTO_CMD_STATS]  = "STATS",
+    [PROTO_CMD_RESUME] = "RESUME",
+    [PROTO_CMD_BENCH]  = "BENCH",
+    [PROTO_CMD_CODEC]  = "CODEC",
+    [PROTO_CMD_HELLO]  = "HELLO",
+    [PROTO_CMD_SESS]   = "SESS",
+    [PROTO_CMD_NACK]   = "NACK",
+    [PROTO_CMD_FEC]    = "FEC",
+};
+
+static void cmd_lat_record(proto_cmd_t cmd)
+{
+    int64_t rx_us = sonya_ble_rx_time_us();
+    if (rx_us == 0 || (unsigned)cmd >= PROTO_CMD_COUNT) return;
+    uint32_t us = (uint32_t)(esp_timer_get_time() - rx_us);
+    cmd_lat_t *l = &s_cmd_lat[cmd];
+    l->n++;
+    l->sum_us += us;
+    if (us > l->max_us) l->max_us = us;
+}
+
+static void send_cmd_stats(void)
+{
+    if (!sonya_ble_is_connected()) return;
+    sonya_ble_rx_stats_t rs;
+    sonya_ble_get_rx_stats(&rs);
+    char msg[64];
+    snprintf(msg, sizeof(msg), "RXQ:n=%lu,drop=%lu,hw=%u,wait=%luus",
+             (unsigned long)rs.cmds, (unsigned long)rs.dropped,
+             (unsigned)rs.depth_max, (unsigned long)rs.wait_max_us);
+    sonya_ble_send_evt_error(msg);
+    sonya_ble_conn_stats_t cs;
+    sonya_ble_get_conn_stats(&cs);
+    snprintf(msg, sizeof(msg), "CP:ph=%u/%u,itvl=%luus,lat=%u,sw=%lu/%lums,fail=%lu",
+             (unsigned)cs.phase, (unsigned)cs.applied, (unsigned long)cs.itvl_us,
+             (unsigned)cs.latency, (unsigned long)cs.switch_ms,
+             (unsigned long)cs.switch_max_ms, (unsigned long)cs.updates_failed);
+    sonya_ble_send_evt_error(msg);
+    snprintf(msg, sizeof(msg), "RECONN:n=%lu,last=%lums,max=%lums",
+             (unsigned long)cs.reconnects, (unsigned long)cs.reconnect_ms,
+             (unsigned long)cs.reconnect_max_ms);
+    sonya_ble_send_evt_error(msg);
+    for (int c = 0; c < PROTO_CMD_COUNT; c++) {
+        const cmd_lat_t *l = &s_cmd_lat[c];
+        if (l->n == 0) continue;
+        snprintf(msg, sizeof(msg), "LAT:%s,n=%lu,avg=%lu,max=%luus", s_cmd_name[c],
+                 (unsigned long)l->n, (unsigned long)(l->sum_us / l->n), (unsigned long)l->max_us);
+        sonya_ble_send_evt_error(msg);
+    }
+}
+
+/* Where a command came from: an ASCII write, or a binary frame whose reply goes in EVT_REPLY. */
+typedef struct {
+    bool     bin;
+    uint16_t req;   // binary: request id (frame seq)
+    uint8_t  op;    // binary: frame type
+} cmd_src_t;
+
+static const char *const s_st_name[] = {
+    [PROTO_ST_OK]          = NULL,
+    [PROTO_ST_UNKNOWN]     = "UNKNOWN",
+    [PROTO_ST_NO_REC]      = "NO_REC",
+    [PROTO_ST_EOF]         = "EOF",
+    [PROTO_ST_BUSY]        = "REC_BUSY",
+    [PROTO_ST_UNSUPPORTED] = "UNSUPPORTED",
+};
+
+/*
+ * Answer a command. ASCII commands get `text` (or the status name on failure) as
+ * EVT_ERROR, and nothing on a silent success; binary ones always get one EVT_REPLY.
+ */
+static void cmd_reply(const cmd_src_t *src, int status, const char *text)
+{
+    if (!sonya_ble_is_connected()) return;
+    if (!text && status > PROTO_ST_OK && status <= PROTO_ST_UNSUPPORTED) text = s_st_name[status];
+    if (!src->bin) {
+        if (text) sonya_ble_send_evt_error(text);
+        return;
+    }
+    uint8_t p[4 + 48] = {
+        (uint8_t)(src->req & 0xFF), (uint8_t)(src->req >> 8), src->op, (uint8_t)status,
+    };
+    size_t n = text ? strnlen(text, sizeof(p) - 4) : 0;
+    if (n) memcpy(p + 4, text, n);
+    sonya_ble_send_frame(PROTO_EVT_REPLY, p, (uint16_t)(4 + n));
+}
+
+static void run_cmd(proto_cmd_t cmd, const proto_rx_args_t *arg, const cmd_src_t *src)
 {
-    int setrec_val = 0;
-    uint16_t rec_id = 0;
-    uint32_t off = 0;
-    uint16_t want_len = 0;
-    proto_cmd_t cmd = proto_parse_rx_cmd(data, len, &setrec_val, &rec_id, &off, &want_len);
+    proto_rx_args_t a = *arg;
+    char msg[40];
 
     switch (cmd) {
     case PROTO_CMD_PING:
         ESP_LOGI(TAG, "RX: PING");
         if (sonya_ble_is_connected()) {
-            sonya_ble_send_evt_error("PONG");
+            cmd_reply(src, PROTO_ST_OK, "PONG");
             send_batt_status("ping");
         }
         break;
     case PROTO_CMD_BATT:
         ESP_LOGI(TAG, "RX: BATT");
         send_batt_status("cmd");
+        cmd_reply(src, PROTO_ST_OK, NULL);
         break;
     case PROTO_CMD_REC:
         ESP_LOGI(TAG, "RX: REC (rec_seconds=%d)", s_rec_seconds);
         if (s_no_mic_mode) {
-            if (sonya_ble_is_connected()) {
-                sonya_ble_send_evt_error("NO_MIC:REC_DISABLED");
-            }
+            cmd_reply(src, PROTO_ST_UNSUPPORTED, "NO_MIC:REC_DISABLED");
             break;
         }
         wake_on_rx_cmd("REC");
+        cmd_reply(src, PROTO_ST_OK, NULL);
         break;
     case PROTO_CMD_SETREC:
-        s_rec_seconds = setrec_val;
+        s_rec_seconds = a.rec_sec;
         ESP_LOGI(TAG, "RX: SETREC -> %d sec", s_rec_seconds);
-        if (sonya_ble_is_connected()) {
-            char msg[32];
-            snprintf(msg, sizeof(msg), "REC_SEC=%d", s_rec_seconds);
-            sonya_ble_send_evt_error(msg);
-        }
+        snprintf(msg, sizeof(msg), "REC_SEC=%d", s_rec_seconds);
+        cmd_reply(src, PROTO_ST_OK, msg);
         break;
     case PROTO_CMD_GET:
-        pull_stream_handle_get(rec_id, off, want_len);
+        cmd_reply(src, pull_stream_handle_get(a.rec_id, a.offset, a.len), NULL);
+        break;
+    case PROTO_CMD_XGET:
+        cmd_reply(src, pull_stream_handle_xget(a.rec_id, a.offset), NULL);
+        break;
+    case PROTO_CMD_XACK:
+        // Sent every few frames during XGET; acknowledging it would double the RX traffic.
+        pull_stream_handle_xack(a.rec_id, a.ack_cum, a.ack_sack);
+        break;
+    case PROTO_CMD_RESUME:
+        cmd_reply(src, pull_stream_handle_resume(a.rec_id, a.offset), NULL);
+        break;
+    case PROTO_CMD_NACK:
+        cmd_reply(src, pull_stream_handle_nack(a.rec_id, a.ranges, a.n_ranges), NULL);
+        break;
+    case PROTO_CMD_FEC:
+        snprintf(msg, sizeof(msg), "FEC=%u", (unsigned)pull_stream_set_fec(a.fec_mode, a.loss_ppm));
+        cmd_reply(src, PROTO_ST_OK, msg);
         break;
+    case PROTO_CMD_CODEC: {
+        pull_stream_set_codec(a.codec);
+        ESP_LOGI(TAG, "RX: CODEC -> %u", (unsigned)a.codec);
+        uint8_t codec = pull_stream_codec();
+        int st = codec == a.codec ? PROTO_ST_OK : PROTO_ST_UNSUPPORTED;
+        switch (codec) {
+        case PROTO_CODEC_IMA_ADPCM: cmd_reply(src, st, "CODEC=ADPCM"); break;
+        case PROTO_CODEC_OPUS:      cmd_reply(src, st, "CODEC=OPUS"); break;
+        case PROTO_CODEC_LOSSLESS:  cmd_reply(src, st, "CODEC=LOSSLESS"); break;
+        default:                    cmd_reply(src, st, "CODEC=PCM"); break;
+        }
+        break;
+    }
+    case PROTO_CMD_HELLO:
+        pull_stream_send_caps(a.ver);
+        if (src->bin) cmd_reply(src, PROTO_ST_OK, NULL);
+        break;
+    case PROTO_CMD_SESS: {
+        proto_session_t req = { .ver = PROTO_VERSION, .codec = a.codec, .frame = a.frame, .mode = a.mode };
+        if (!pull_stream_set_session(&req)) {
+            cmd_reply(src, PROTO_ST_UNSUPPORTED, "SESS_UNSUPPORTED");
+            break;
+        }
+        proto_session_t sess;
+        pull_stream_get_session(&sess);
+        snprintf(msg, sizeof(msg), "SESS=%u:%u:%u", (unsigned)sess.codec, (unsigned)sess.frame,
+                 (unsigned)sess.mode);
+        cmd_reply(src, PROTO_ST_OK, msg);
+        break;
+    }
+    case PROTO_CMD_BENCH: {
+        pull_stream_bench_t b = {
+            .sec = a.bench_sec, .bytes = a.bench_bytes, .frame = a.bench_frame,
+            .gap_ms = a.bench_gap_ms, .inflight = a.bench_inflight,
+        };
+        int st = pull_stream_handle_bench(&b);
+        cmd_reply(src, st, st == PROTO_ST_BUSY ? "BUSY" : NULL);
+        break;
+    }
     case PROTO_CMD_DONE:
-        if (rec_id == rec_store_cur_id()) {
-            pull_stream_handle_done(rec_id);
+        if (a.rec_id == rec_store_cur_id()) {
+            pull_stream_handle_done(a.rec_id);
             status_ui_show_ok(900);
         } else {
-            pull_stream_handle_done(rec_id);
+            pull_stream_handle_done(a.rec_id);
         }
+        cmd_reply(src, PROTO_ST_OK, NULL);
+        break;
+    case PROTO_CMD_STATS:
+        send_cmd_stats();
+        cmd_reply(src, PROTO_ST_OK, NULL);
         break;
     default:
-        ESP_LOGW(TAG, "RX: unknown cmd (%d bytes)", len);
+        if (src->bin) {
+            ESP_LOGW(TAG, "RX: bad binary cmd op=0x%02x req=%u", (unsigned)src->op, (unsigned)src->req);
+            cmd_reply(src, PROTO_ST_UNKNOWN, NULL);
+        }
         break;
     }
+    cmd_lat_record(cmd);
+}
+
+/* Runs on the sonya_ble "ble_rx" worker task; blocking here does not stall the host. */
+static void on_ble_rx(const uint8_t *data, uint16_t len, void *arg)
+{
+    proto_rx_args_t a;
+
+    if (len > 0 && data[0] >= PROTO_BCMD_BASE) {
+        // Binary: one or more frames back to back, run in order.
+        size_t pos = 0;
+        while (pos < len) {
+            cmd_src_t src = { .bin = true, .op = data[pos] };
+            size_t used = 0;
+            proto_cmd_t cmd = proto_parse_rx_bin(data + pos, len - pos, &a, &src.req, &used);
+            if (used == 0) {
+                ESP_LOGW(TAG, "RX: truncated binary cmd at %u/%u", (unsigned)pos, (unsigned)len);
+                break;
+            }
+            run_cmd(cmd, &a, &src);
+            pos += used;
+        }
+        return;
+    }
+
+    proto_cmd_t cmd = proto_parse_rx_cmd(data, len, &a);
+    if (cmd == PROTO_CMD_NONE) ESP_LOGW(TAG, "RX: unknown cmd (%d bytes)", len);
+    cmd_src_t src = { .bin = false };
+    run_cmd(cmd, &a, &src);
+}
+
+/* TX notifications just enabled: tell the phone what it may still be missing. */
+static void on_ble_subscribe(void *arg)
+{
+    (void)arg;
+    pull_stream_reset_session();   // a new session starts in PCM, live, until CODEC or SESS
+    pull_stream_announce();
 }
 
 /* ---- send REC_END meta ---- */
@@ -242,7 +570,11 @@ static void send_rec_end_meta(void)
     uint32_t crc   = rec_store_crc32();
     uint16_t sr16  = (uint16_t)CONFIG_AUDIO_SR;
 
-    uint8_t meta[2 + 4 + 4 + 2];
+    proto_session_t sess;
+    pull_stream_get_session(&sess);
+    uint8_t codec  = sess.codec;
+
+    uint8_t meta[2 + 4 + 4 + 2 + 1];
     meta[0]  = (uint8_t)(rid   & 0xFF);
     meta[1]  = (uint8_t)(rid   >> 8);
     meta[2]  = (uint8_t)(total & 0xFF);
@@ -255,7 +587,10 @@ static void send_rec_end_meta(void)
     meta[9]  = (uint8_t)((crc  >> 24) & 0xFF);
     meta[10] = (uint8_t)(sr16  & 0xFF);
     meta[11] = (uint8_t)(sr16  >> 8);
-    sonya_ble_send_frame(PROTO_EVT_REC_END, meta, (uint16_t)sizeof(meta));
+    meta[12] = codec;
+    // Pre-HELLO PCM sessions keep the 12-byte REC_END older apps expect; CODEC or SESS adds the codec byte.
+    bool with_codec = sess.ver || codec != PROTO_CODEC_PCM16;
+    sonya_ble_send_frame(PROTO_EVT_REC_END, meta, (uint16_t)(with_codec ? 13 : 12));
 }
 
 /* ---- recording (BUTTON mode) ---- */
@@ -332,6 +667,7 @@ static void record_button(int want)
                 alloc_failed = true;
                 ESP_LOGE(TAG, "REC_END reason: no mem got=%d", got);
                 status_ui_set_error(true);
+                s_beacon.err_flags |= SONYA_BEACON_E_NOMEM;
                 if (sonya_ble_is_connected())
                     sonya_ble_send_evt_error("no mem");
                 break;
@@ -346,6 +682,7 @@ static void record_button(int want)
         if (r < 0) {
             ESP_LOGE(TAG, "REC_END reason: audio_cap_read fail %d (got=%d)", r, got);
             status_ui_set_error(true);
+            s_beacon.err_flags |= SONYA_BEACON_E_AUDIO;
             if (sonya_ble_is_connected())
                 sonya_ble_send_evt_error("audio read fail");
             break;
@@ -398,6 +735,7 @@ static void record_cmd(int cap_sec, int want)
             if (!rec_store_alloc_block()) {
                 ESP_LOGE(TAG, "REC_END reason: no mem got=%d", got);
                 status_ui_set_error(true);
+                s_beacon.err_flags |= SONYA_BEACON_E_NOMEM;
                 if (sonya_ble_is_connected())
                     sonya_ble_send_evt_error("no mem");
                 break;
@@ -413,6 +751,7 @@ static void record_cmd(int cap_sec, int want)
         if (r < 0) {
             ESP_LOGE(TAG, "REC_END reason: audio_cap_read fail %d (got=%d)", r, got);
             status_ui_set_error(true);
+            s_beacon.err_flags |= SONYA_BEACON_E_AUDIO;
             if (sonya_ble_is_connected())
                 sonya_ble_send_evt_error("audio read fail");
             break;
@@ -492,17 +831,25 @@ void app_main(void)
     sonya_diaglog_addf("sys", "boot rr=%s(%d)", reset_reason_str(rr), (int)rr);
     sonya_diaglog_dump(120);
 
+    // Reserve recording memory before BLE/LVGL start carving up PSRAM.
+    err = rec_store_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "rec_store_init fail %d", (int)err);
+        return;
+    }
+
     err = sonya_board_pmu_init();
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "pmu_init fail %d", (int)err);
     }
 
+    sonya_ble_set_subscribe_cb(on_ble_subscribe, NULL);
     err = sonya_ble_init(CONFIG_DEVICE_NAME, on_ble_rx, NULL);
     if (err) {
         ESP_LOGE(TAG, "ble_init fail %d", err);
         return;
     }
-    (void)sonya_ble_set_conn_power_save(true);
+    (void)sonya_ble_set_link_phase(SONYA_LINK_IDLE);
     ESP_LOGI(TAG, "BLE up");
     esp_log_level_set("NimBLE", ESP_LOG_WARN);
 
@@ -588,6 +935,8 @@ void app_main(void)
 
     for (;;) {
         pwrmon_tick();
+        beacon_publish();
+        status_refresh();
         TickType_t loop_now = xTaskGetTickCount();
         if (sonya_ble_is_connected() &&
             (s_last_batt_sent_tick == 0 || (loop_now - s_last_batt_sent_tick) >= pdMS_TO_TICKS(60000))) {
@@ -612,6 +961,9 @@ void app_main(void)
             continue;
         }
         s_is_recording = true;
+        // Ask for the fast interval now: the update takes a few connection events,
+        // and capture setup below (EVT_WAKE, audio start) hides most of that.
+        (void)sonya_ble_set_link_phase(SONYA_LINK_ARMED);
 
         if (!s_audio_initialized) {
             ESP_LOGW(TAG, "wake ignored: NO_MIC mode");
@@ -620,6 +972,7 @@ void app_main(void)
                 sonya_ble_send_evt_wake();
                 sonya_ble_send_evt_error("NO_MIC:REC_DISABLED");
             }
+            (void)sonya_ble_set_link_phase(SONYA_LINK_IDLE);
             s_is_recording = false;
             continue;
         }
@@ -647,6 +1000,7 @@ void app_main(void)
             ESP_LOGW(TAG, "button trigger but BLE not connected -> ignore");
             status_ui_set_error(true);
             status_ui_set_recording(false);
+            (void)sonya_ble_set_link_phase(SONYA_LINK_IDLE);
             s_is_recording = false;
             continue;
         }
@@ -683,15 +1037,19 @@ void app_main(void)
         ESP_LOGI(TAG, "ui: recording on (src_btn=%d)", by_btn ? 1 : 0);
         status_ui_set_recording(true);
         status_ui_set_error(false);
-        (void)sonya_ble_set_conn_power_save(false);
+        s_beacon.err_flags &= (uint8_t)~(SONYA_BEACON_E_NOMEM | SONYA_BEACON_E_AUDIO);
+        beacon_publish();
+        (void)sonya_ble_set_link_phase(SONYA_LINK_STREAMING);
 
         if (!s_audio_streaming) {
             err = audio_cap_start();
             if (err) {
                 ESP_LOGE(TAG, "audio_cap_start (on-demand) fail %d", err);
                 if (sonya_ble_is_connected()) sonya_ble_send_evt_error("audio start fail");
+                s_beacon.err_flags |= SONYA_BEACON_E_AUDIO;
                 status_ui_set_error(true);
                 status_ui_set_recording(false);
+                (void)sonya_ble_set_link_phase(SONYA_LINK_IDLE);
                 s_is_recording = false;
                 continue;
             }
@@ -704,8 +1062,10 @@ void app_main(void)
         uint16_t rid = rec_store_begin();
 
         if (sonya_ble_is_connected()) {
-            sonya_ble_send_evt_rec_start();
-            pull_stream_start_live(rid);
+            proto_session_t sess;
+            pull_stream_get_session(&sess);
+            sonya_ble_send_evt_rec_start(&sess);
+            if ((sess.mode & PROTO_SESS_MODE_MASK) == PROTO_SESS_LIVE) pull_stream_start_live(rid);
         }
 
 #if defined(CONFIG_WAKE_MODE_BUTTON)
@@ -736,6 +1096,13 @@ void app_main(void)
 
         pull_stream_stop_live();
         rec_store_commit();
+        {
+            rec_store_pool_stats_t ps;
+            rec_store_pool_stats(&ps);
+            ESP_LOGI(TAG, "rec pool: free=%u/%u min_free=%u fail=%lu",
+                     (unsigned)ps.blocks_free, (unsigned)ps.blocks_total,
+                     (unsigned)ps.blocks_min_free, (unsigned long)ps.alloc_fail);
+        }
 
         status_ui_set_recording(false);
 
@@ -759,7 +1126,8 @@ void app_main(void)
             audio_cap_stop();
             s_audio_streaming = false;
         }
-        (void)sonya_ble_set_conn_power_save(true);
+        // The phone usually pulls right after REC_END; linger decays to idle by itself.
+        (void)sonya_ble_set_link_phase(SONYA_LINK_LINGER);
 
         s_is_recording = false;
     }
@@ -0,0 +1,198 @@
+"""
+IMA-ADPCM for AUDIO_ADPCM frames (0x14): decoder, reference encoder, round-trip bench.
+
+Frame payload: [rec_id:u16][off:u32][pred:s16][index:u8][flags:u8][nibbles]
+Sample 0 is pred itself; the nibbles (low nibble first) code samples 1..N-1,
+N = 1 + 2 * len(nibbles) - (flags & 1). off is the PCM byte offset of sample 0, so
+frames decode on their own and land at their place in the recording.
+
+The encoder mirrors components/adpcm/adpcm.c and pull_stream's framing (step index
+from a 32-sample warm-up before each frame), so the bench measures what the watch sends:
+
+    python ima_adpcm.py                       # synthetic speech-like test signal
+    python ima_adpcm.py --wav in.wav --payload 244 --link-kbps 60
+"""
+
+import argparse
+import math
+import random
+import struct
+import sys
+import time
+import wave
+from array import array
+from typing import List, Tuple
+
+STEP = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+]
+INDEX_ADJ = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+AUDIO_ADPCM = 0x14
+HDR = 10
+F_PAD = 0x01
+WARMUP = 32
+NIB_MAX = 512
+
+
+def _clamp16(v: int) -> int:
+    return 32767 if v > 32767 else -32768 if v < -32768 else v
+
+
+def _step(pred: int, index: int, code: int) -> Tuple[int, int]:
+    step = STEP[index]
+    delta = step >> 3
+    if code & 4:
+        delta += step
+    if code & 2:
+        delta += step >> 1
+    if code & 1:
+        delta += step >> 2
+    pred = _clamp16(pred - delta if code & 8 else pred + delta)
+    index = min(88, max(0, index + INDEX_ADJ[code & 7]))
+    return pred, index
+
+
+def decode_nibbles(pred: int, index: int, nib: bytes, n: int, out: List[int]) -> None:
+    """Append n samples decoded from nib to out, starting from state (pred, index)."""
+    for i in range(n):
+        b = nib[i >> 1]
+        code = (b >> 4) if i & 1 else (b & 0x0F)
+        pred, index = _step(pred, index, code)
+        out.append(pred)
+
+
+def decode_frame(payload: bytes) -> Tuple[int, int, List[int]]:
+    """AUDIO_ADPCM payload -> (rec_id, pcm_byte_offset, samples)."""
+    rec_id, off, pred, index, flags = struct.unpack_from("<HIhBB", payload, 0)
+    nib = payload[HDR:]
+    n = 2 * len(nib) - (flags & F_PAD)
+    samples = [pred]
+    decode_nibbles(pred, index, nib, n, samples)
+    return rec_id, off, samples
+
+
+def _encode_one(pred: int, index: int, s: int) -> Tuple[int, int, int]:
+    step = STEP[index]
+    diff = s - pred
+    code = 0
+    if diff < 0:
+        code = 8
+        diff = -diff
+    if diff >= step:
+        code |= 4
+        diff -= step
+    step >>= 1
+    if diff >= step:
+        code |= 2
+        diff -= step
+    step >>= 1
+    if diff >= step:
+        code |= 1
+    pred, index = _step(pred, index, code)
+    return code, pred, index
+
+
+def encode_frame(pcm: array, rec_id: int, s0: int, n: int) -> bytes:
+    """AUDIO_ADPCM payload for samples [s0, s0 + n), as pull_stream builds it."""
+    w = min(s0, WARMUP)
+    index = 0
+    if w:
+        pred = pcm[s0 - w]
+        for s in pcm[s0 - w + 1 : s0]:
+            _, pred, index = _encode_one(pred, index, s)
+    pred = pcm[s0]
+    codes = []
+    p, ix = pred, index
+    for s in pcm[s0 + 1 : s0 + n]:
+        c, p, ix = _encode_one(p, ix, s)
+        codes.append(c)
+    pad = len(codes) & 1
+    if pad:
+        codes.append(0)
+    nib = bytes(codes[i] | (codes[i + 1] << 4) for i in range(0, len(codes), 2))
+    return struct.pack("<HIhBB", rec_id, s0 * 2, pred, index, F_PAD if pad else 0) + nib
+
+
+def frame_samples(payload_max: int) -> int:
+    """Samples per AUDIO_ADPCM frame for a given max frame payload (ATT_MTU - 8)."""
+    nb = min(payload_max - HDR, NIB_MAX)
+    return 1 + 2 * nb if nb >= 0 else 0
+
+
+def snr_db(ref: array, got: List[int]) -> float:
+    sig = sum(x * x for x in ref)
+    err = sum((a - b) ** 2 for a, b in zip(ref, got))
+    return float("inf") if err == 0 else 10.0 * math.log10(sig / err) if sig else 0.0
+
+
+def test_signal(sr: int, sec: float) -> array:
+    """Speech-like: a few gliding harmonics with syllable-rate envelope plus noise."""
+    rnd = random.Random(1)
+    out = array("h")
+    phase = 0.0
+    for i in range(int(sr * sec)):
+        t = i / sr
+        phase += 2 * math.pi * (140 + 40 * math.sin(2 * math.pi * 0.7 * t)) / sr
+        env = 0.5 + 0.5 * math.sin(2 * math.pi * 4 * t) ** 2
+        v = sum(math.sin(k * phase) / k for k in (1, 2, 3, 5))
+        out.append(_clamp16(int(6000 * env * v + rnd.gauss(0, 300))))
+    return out
+
+
+def read_wav(path: str) -> Tuple[array, int]:
+    with wave.open(path, "rb") as w:
+        if w.getsampwidth() != 2:
+            raise SystemExit("need 16-bit PCM")
+        ch, sr = w.getnchannels(), w.getframerate()
+        pcm = array("h", w.readframes(w.getnframes()))
+    if sys.byteorder != "little":
+        pcm.byteswap()
+    return (pcm[::ch] if ch > 1 else pcm), sr
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description="IMA-ADPCM round trip: SNR and transfer size")
+    ap.add_argument("--wav", help="16-bit PCM WAV (default: synthetic 10 s at 16 kHz)")
+    ap.add_argument("--payload", type=int, default=244, help="Frame payload limit, ATT_MTU - 8 (247 -> 239)")
+    ap.add_argument("--link-kbps", type=float, default=0.0,
+                    help="Goodput of the link in kB/s (e.g. from ble_bench) to estimate transfer time")
+    args = ap.parse_args()
+
+    pcm, sr = read_wav(args.wav) if args.wav else (test_signal(16000, 10.0), 16000)
+    per = frame_samples(args.payload)
+    if per <= 1:
+        raise SystemExit("payload too small for an ADPCM frame")
+
+    t0 = time.perf_counter()
+    frames = [encode_frame(pcm, 1, s0, min(per, len(pcm) - s0)) for s0 in range(0, len(pcm), per)]
+    t_enc = time.perf_counter() - t0
+
+    t0 = time.perf_counter()
+    out = [0] * len(pcm)
+    for f in frames:
+        _, off, samples = decode_frame(f)
+        out[off // 2 : off // 2 + len(samples)] = samples
+    t_dec = time.perf_counter() - t0
+
+    pcm_bytes = 2 * len(pcm)
+    adpcm_bytes = sum(len(f) + 5 for f in frames)        # + frame header
+    pcm_frames = -(-pcm_bytes // ((args.payload - 6) & ~1))
+    pcm_wire = pcm_bytes + pcm_frames * (6 + 5)
+    dur = len(pcm) / sr
+    print(f"signal   {dur:.1f} s @ {sr} Hz, {len(frames)} frames x {per} samples")
+    print(f"snr      {snr_db(pcm, out):.1f} dB")
+    print(f"wire     pcm={pcm_wire} B  adpcm={adpcm_bytes} B  ratio={pcm_wire / adpcm_bytes:.2f}x")
+    print(f"host     encode={len(pcm) / t_enc / 1e3:.0f} ksamples/s  decode={len(pcm) / t_dec / 1e3:.0f} ksamples/s")
+    if args.link_kbps > 0:
+        r = args.link_kbps * 1000
+        print(f"transfer pcm={pcm_wire / r:.2f} s  adpcm={adpcm_bytes / r:.2f} s")
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -0,0 +1,140 @@
+"""
+Radio-path baseline: run BENCH on the watch and verify the synthetic stream.
+
+The watch sends BENCH_DATA frames (0x1F) built and queued exactly like GET audio,
+but filled with a fixed pattern instead of rec_store PCM. This script checks every
+frame against the pattern, counts missing frames from the bench sequence numbers,
+and prints host-side goodput next to the watch's own report (EVT_ERROR `BENCH:...`).
+
+    python ble_bench.py --sec 10
+    python ble_bench.py --sec 10 --frame 100 --gap 5 --inflight 2
+"""
+
+import argparse
+import asyncio
+import struct
+import time
+
+from bleak import BleakClient, BleakScanner
+
+RX_UUID = "f0debc9a-7956-3412-7856-341278563412"
+TX_UUID = "f0debc9a-7a56-3412-7856-341278563412"
+
+EVT_ERROR = 0x11
+BENCH_DATA = 0x1F
+BENCH_PERIOD = 251  # PROTO_BENCH_PERIOD: pattern byte at stream offset x is x % 251
+
+
+def parse_frames(buf: bytes):
+    """Yield (type, payload) for each complete frame in buf."""
+    pos = 0
+    while pos + 5 <= len(buf):
+        t = buf[pos]
+        ln = buf[pos + 3] | (buf[pos + 4] << 8)
+        if pos + 5 + ln > len(buf):
+            break
+        yield t, buf[pos + 5 : pos + 5 + ln]
+        pos += 5 + ln
+
+
+def pattern(off: int, n: int) -> bytes:
+    return bytes((off + i) % BENCH_PERIOD for i in range(n))
+
+
+class Sink:
+    def __init__(self) -> None:
+        self.frames = 0
+        self.nbytes = 0
+        self.bad = 0
+        self.lost = 0
+        self.next_seq = 0
+        self.t_first = 0.0
+        self.t_last = 0.0
+        self.report: list = []
+        self.done = asyncio.Event()
+
+    def on_frame(self, t: int, payload: bytes) -> None:
+        if t == EVT_ERROR:
+            txt = payload.decode("utf-8", errors="replace")
+            if txt.startswith("BENCH:"):
+                self.report.append(txt)
+                if txt.startswith("BENCH:retry="):
+                    self.done.set()
+            else:
+                print("<< EVT_ERROR", txt)
+            return
+        if t != BENCH_DATA or len(payload) < 8:
+            return
+        bseq, off = struct.unpack_from("<II", payload, 0)
+        data = payload[8:]
+        now = time.perf_counter()
+        if not self.frames:
+            self.t_first = now
+        self.t_last = now
+        if bseq > self.next_seq:
+            self.lost += bseq - self.next_seq
+        self.next_seq = max(self.next_seq, bseq + 1)
+        self.frames += 1
+        self.nbytes += len(data)
+        if data != pattern(off, len(data)):
+            self.bad += 1
+
+    def on_notify(self, _: int, data: bytearray) -> None:
+        for t, p in parse_frames(bytes(data)):
+            self.on_frame(t, p)
+
+    def line(self) -> str:
+        dt = self.t_last - self.t_first
+        bps = self.nbytes / dt if dt > 0 else 0.0
+        fps = (self.frames - 1) / dt if dt > 0 else 0.0
+        return (f"host  frames={self.frames} bytes={self.nbytes} lost={self.lost} bad={self.bad} "
+                f"t={dt:.2f}s fps={fps:.0f} goodput={bps / 1000:.1f} kB/s")
+
+
+async def pick_device(name: str, timeout: float) -> str:
+    for d in await BleakScanner.discover(timeout=timeout):
+        if d.name and name.lower() in d.name.lower():
+            return d.address
+    raise RuntimeError(f"{name!r} not found")
+
+
+async def run(args: argparse.Namespace) -> int:
+    address = args.address or await pick_device(args.name, args.scan_timeout)
+    print(f"Connecting to {address} ...")
+    async with BleakClient(address) as client:
+        sink = Sink()
+        await client.start_notify(TX_UUID, sink.on_notify)
+        await asyncio.sleep(0.5)
+        cmd = f"BENCH:{args.sec}:{args.bytes}:{args.frame}:{args.gap}:{args.inflight}"
+        print(f">> {cmd}")
+        await client.write_gatt_char(RX_UUID, cmd.encode(), response=False)
+        limit = args.sec + 30.0 if args.sec or not args.bytes else 600.0
+        try:
+            await asyncio.wait_for(sink.done.wait(), timeout=limit)
+        except asyncio.TimeoutError:
+            print("no BENCH report from the watch")
+        # The report travels on the control queue and may overtake the last data frames.
+        await asyncio.sleep(1.0)
+
+        print()
+        for r in sink.report:
+            print("watch", r[len("BENCH:"):])
+        print(sink.line())
+    return 0 if sink.frames and not sink.bad and not sink.lost else 1
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description="BLE notify-path benchmark (BENCH command)")
+    ap.add_argument("--address", help="BLE address (if omitted: scan by name)")
+    ap.add_argument("--name", default="SONYA-WATCH")
+    ap.add_argument("--scan-timeout", type=float, default=6.0)
+    ap.add_argument("--sec", type=int, default=10, help="Duration, 0 = until --bytes")
+    ap.add_argument("--bytes", type=int, default=0, help="Pattern bytes to send, 0 = until --sec")
+    ap.add_argument("--frame", type=int, default=0, help="Pattern bytes per frame, 0 = max for the MTU")
+    ap.add_argument("--gap", type=int, default=0, help="Pacing between frames, ms")
+    ap.add_argument("--inflight", type=int, default=0, help="Notifications in flight, 0 = firmware max")
+    return asyncio.run(run(ap.parse_args()))
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -1,10 +1,11 @@
 import argparse
 import asyncio
 import binascii
+import struct
 import sys
 import time
 from dataclasses import dataclass
-from typing import Optional
+from typing import List, Optional
 
 from bleak import BleakClient, BleakScanner
 
@@ -24,6 +25,45 @@ class Frame:
     seq: int
     length: int
     payload: bytes
+    sid: Optional[int] = None   # v2 only
+
+
+def crc8(data: bytes) -> int:
+    """CRC-8, poly 0x07, init 0 (v2 header check byte)."""
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def parse_frame_v2(data: bytes, hcrc: bool) -> Optional[Frame]:
+    """[sid:3|type:5][seq:u32][len:u16]([crc8])[payload]; None if short or the CRC fails."""
+    hlen = 8 if hcrc else 7
+    if len(data) < hlen or (hcrc and crc8(data[:7]) != data[7]):
+        return None
+    seq, ln = struct.unpack_from("<IH", data, 1)
+    if len(data) < hlen + ln:
+        return None
+    return Frame(type=data[0] & 0x1F, seq=seq, length=ln, payload=data[hlen : hlen + ln], sid=data[0] >> 5)
+
+
+class StreamAnchors:
+    """v2: PCM offset of AUDIO_DATA frames from the last EVT_STREAM on the same stream."""
+
+    def __init__(self) -> None:
+        self.anchor = {}   # sid -> (rec_id, base, seq0, frame)
+
+    def on_stream(self, sid: int, payload: bytes) -> None:
+        self.anchor[sid] = struct.unpack_from("<HIIH", payload, 0)
+
+    def place(self, f: Frame) -> Optional[tuple]:
+        a = self.anchor.get(f.sid)
+        if a is None or f.seq < a[2]:
+            return None
+        rec_id, base, seq0, frame = a
+        return rec_id, base + (f.seq - seq0) * frame
 
 
 def parse_frame(data: bytes) -> Optional[Frame]:
@@ -38,13 +78,106 @@ def parse_frame(data: bytes) -> Optional[Frame]:
     return Frame(type=t, seq=seq, length=ln, payload=payload)
 
 
-def describe_frame(f: Frame) -> str:
+# Binary RX commands: op = 0x80 + command number, payload layout (struct format) per op.
+BIN_CMDS = {
+    "PING": (0x81, ""), "REC": (0x82, ""), "SETREC": (0x83, "<B"), "BATT": (0x84, ""),
+    "GET": (0x85, "<HII"), "DONE": (0x86, "<H"), "XGET": (0x87, "<HI"), "XACK": (0x88, "<HHI"),
+    "STATS": (0x89, ""), "RESUME": (0x8A, "<HI"), "BENCH": (0x8B, "<HIHHB"), "CODEC": (0x8C, "<B"),
+    "HELLO": (0x8D, "<B"), "SESS": (0x8E, "<BHB"), "NACK": (0x8F, "<HB"),
+    "FEC": (0x90, "<BI"),
+}
+CODEC_IDS = {"PCM": 0, "ADPCM": 1, "OPUS": 2, "LOSSLESS": 3}
+REPLY_STATUS = {0: "OK", 1: "UNKNOWN", 2: "NO_REC", 3: "EOF", 4: "BUSY", 5: "UNSUPPORTED"}
+
+
+def encode_bin_cmd(text: str, req: int) -> bytes:
+    """'GET:1:0:100000' -> one binary command frame with request id req (XACK sack in hex).
+
+    NACK takes the ASCII range list, 'NACK:1:0+960,48000+480', and sends it as [off:u32][len:u32] pairs.
+    """
+    name, *fields = text.strip().split(":")
+    op, fmt = BIN_CMDS[name.upper()]
+    if name.upper() == "NACK":
+        payload = struct.pack(fmt, int(fields[0], 0), 0)
+        for r in fields[1].split(","):
+            off, ln = r.split("+")
+            payload += struct.pack("<II", int(off, 0), int(ln, 0))
+        return struct.pack("<BHH", op, req & 0xFFFF, len(payload)) + payload
+    vals = []
+    for i, v in enumerate(fields):
+        if name.upper() == "CODEC":
+            vals.append(CODEC_IDS[v.upper()])
+        elif name.upper() == "XACK" and i == 2:
+            vals.append(int(v, 16))
+        else:
+            vals.append(int(v, 0))
+    nargs = len(fmt) - 1 if fmt else 0
+    vals += [0] * (nargs - len(vals))
+    if name.upper() == "HELLO" and not fields:
+        vals = [1]
+    payload = struct.pack(fmt, *vals) if fmt else b""
+    return struct.pack("<BHH", op, req & 0xFFFF, len(payload)) + payload
+
+
+def unbatch(f: Frame) -> List[Frame]:
+    """EVT_BATCH (0x08) -> its [type][len][payload] records as frames; anything else -> [f]."""
+    if f.type != 0x08:
+        return [f]
+    out, pos = [], 0
+    while pos + 2 <= f.length:
+        t, ln = f.payload[pos], f.payload[pos + 1]
+        out.append(Frame(type=t, seq=f.seq, length=ln, payload=f.payload[pos + 2 : pos + 2 + ln], sid=f.sid))
+        pos += 2 + ln
+    return out
+
+
+STATUS_FLAGS = ((0x01, "chg"), (0x02, "vbus"), (0x04, "bat"), (0x08, "rec"), (0x10, "mic"),
+                (0x20, "pmu_err"), (0x40, "nomic"))
+
+
+def describe_status(p: bytes) -> str:
+    """EVT_STATUS payload / TX read value (layout in protocol.h, PROTO_EVT_STATUS)."""
+    if len(p) < 48:
+        return f"status? {len(p)} bytes {_hexdump(p)}"
+    (ver, flags, pct, phy, bmv, vbus, heap, heap_min, psram, rec_bytes, pool_free, pool_total,
+     mtu, itvl, q0, q1, q2, q3, failed, dropped, up) = struct.unpack_from("<BBBBHHIIIIHHHHBBBBIII", p, 0)
+    bits = [n for b, n in STATUS_FLAGS if flags & b]
+    batt = "?" if pct == 0xFF else f"{pct}%"
+    return (f"v{ver} batt={batt} bmv={bmv} vbus={vbus} [{','.join(bits)}] heap={heap} min={heap_min} "
+            f"psram={psram} rec={rec_bytes} pool={pool_free}/{pool_total} mtu={mtu} itvl={itvl * 1.25:g}ms "
+            f"phy={phy} txq={q0}/{q1}/{q2}/{q3} failed={failed} dropped={dropped} up={up}s")
+
+
+def describe_frame(f: Frame, anchors: Optional[StreamAnchors] = None) -> str:
     if f.type == 0x01:
         return f"EVT_WAKE seq={f.seq}"
     if f.type == 0x02:
+        if f.length >= 4:
+            max_pl = f.payload[0] | (f.payload[1] << 8)
+            mtu = f.payload[2] | (f.payload[3] << 8)
+            extra = f" codec={f.payload[4]}" if f.length >= 5 else ""
+            if f.length >= 9:
+                ver, frame, mode = struct.unpack_from("<BHB", f.payload, 5)
+                extra += f" ver={ver} frame={frame} mode={'pull' if mode & 0x0F else 'live'}"
+            return f"EVT_REC_START seq={f.seq} max_payload={max_pl} mtu={mtu}{extra}"
         return f"EVT_REC_START seq={f.seq}"
     if f.type == 0x03:
         return f"EVT_REC_END seq={f.seq}"
+    if f.type == 0x04 and f.length >= 13:
+        rec_id, total, crc, flags, sr = struct.unpack_from("<HIIBH", f.payload, 0)
+        bits = [n for b, n in ((0x01, "committed"), (0x02, "live")) if flags & b]
+        return (f"EVT_REC_INFO seq={f.seq} rec={rec_id} total={total} crc=0x{crc:08x} "
+                f"sr={sr} [{','.join(bits)}]")
+    if f.type == 0x05 and f.length >= 16:
+        ver, codecs, max_pl, mtu, coc, store, feat, sr = struct.unpack_from("<BBHHHIHH", f.payload, 0)
+        return (f"EVT_CAPS seq={f.seq} ver={ver} codecs=0x{codecs:02x} max_payload={max_pl} mtu={mtu} "
+                f"coc={coc} store={store} features=0x{feat:04x} sr={sr}")
+    if f.type == 0x06 and f.length >= 4:
+        req, op, st = struct.unpack_from("<HBB", f.payload, 0)
+        txt = f.payload[4:].decode("utf-8", errors="replace")
+        return f'EVT_REPLY seq={f.seq} req={req} op=0x{op:02x} {REPLY_STATUS.get(st, st)} "{txt}"'
+    if f.type == 0x09:
+        return f"EVT_STATUS seq={f.seq} {describe_status(f.payload)}"
     if f.type == 0x10:
         return f"AUDIO_CHUNK seq={f.seq} bytes={f.length}"
     if f.type == 0x11:
@@ -53,20 +186,113 @@ def describe_frame(f: Frame) -> str:
         except Exception:
             txt = repr(f.payload)
         return f'EVT_ERROR seq={f.seq} "{txt}"'
+    if f.type == 0x07 and f.length >= 12:
+        rec_id, base, seq0, frame = struct.unpack_from("<HIIH", f.payload, 0)
+        if anchors is not None:
+            anchors.on_stream(f.sid, f.payload)
+        return f"EVT_STREAM sid={f.sid} seq={f.seq} rec={rec_id} base={base} seq0={seq0} frame={frame}"
+    if f.type == 0x12 and f.sid is not None:
+        at = anchors.place(f) if anchors is not None else None
+        where = f"rec={at[0]} off={at[1]}" if at else "off=?"
+        return f"AUDIO_DATA sid={f.sid} seq={f.seq} {where} bytes={f.length}"
+    if f.type == 0x12 and f.length >= 6:
+        rec_id = f.payload[0] | (f.payload[1] << 8)
+        off = int.from_bytes(f.payload[2:6], "little")
+        return f"AUDIO_DATA seq={f.seq} rec={rec_id} off={off} bytes={f.length - 6}"
+    if f.type == 0x14 and f.length >= 10:
+        rec_id, off, pred, index, flags = struct.unpack_from("<HIhBB", f.payload, 0)
+        n = 1 + 2 * (f.length - 10) - (flags & 1)
+        return f"AUDIO_ADPCM seq={f.seq} rec={rec_id} off={off} samples={n} pred={pred} index={index}"
+    if f.type == 0x15 and f.length >= 8:
+        rec_id, off, n = struct.unpack_from("<HIH", f.payload, 0)
+        return f"AUDIO_OPUS seq={f.seq} rec={rec_id} off={off} samples={n} packet={f.length - 8}B"
+    if f.type == 0x16 and f.length >= 12:
+        rec_id, off, n, blen, coff = struct.unpack_from("<HIHHH", f.payload, 0)
+        return (f"AUDIO_LOSSLESS seq={f.seq} rec={rec_id} off={off} samples={n} "
+                f"block={coff}+{f.length - 12}/{blen}B")
+    if f.type == 0x17 and f.length >= 9:
+        rec_id, off, frame, k = struct.unpack_from("<HIHB", f.payload, 0)
+        return f"AUDIO_FEC seq={f.seq} rec={rec_id} off={off} k={k}x{frame}B"
+    if f.type == 0x13 and f.length >= 8:
+        rec_id = f.payload[0] | (f.payload[1] << 8)
+        fseq = f.payload[2] | (f.payload[3] << 8)
+        off = int.from_bytes(f.payload[4:8], "little")
+        return f"AUDIO_WIN seq={f.seq} rec={rec_id} fseq={fseq} off={off} bytes={f.length - 8}"
     return f"TYPE=0x{f.type:02x} seq={f.seq} len={f.length}"
 
 
+BEACON_COMPANY_ID = 0xFFFF
+
+
+def describe_beacon(mfg: dict) -> Optional[str]:
+    """Decode the scan-response status beacon (see SONYA_BEACON_* in sonya_ble.h)."""
+    data = mfg.get(BEACON_COMPANY_ID)
+    if not data or len(data) < 11 or data[0] != 1:
+        return None
+    _, pct, flags, pending, rec_bytes, fw, err = struct.unpack_from("<BBBBIHB", data, 0)
+    bits = [n for b, n in ((0x01, "chg"), (0x02, "vbus"), (0x04, "rec"), (0x08, "committed")) if flags & b]
+    errs = [n for b, n in ((0x01, "pmu"), (0x02, "nomem"), (0x04, "audio"), (0x08, "nomic")) if err & b]
+    batt = "?" if pct == 0xFF else f"{pct}%"
+    return (f"batt={batt} flags={','.join(bits) or '-'} pending={pending} bytes={rec_bytes} "
+            f"fw={fw} err={','.join(errs) or '-'}")
+
+
 async def pick_device(name_substr: str, timeout: float) -> str:
     print(f"Scanning for BLE devices (timeout={timeout}s), name contains: {name_substr!r}")
-    devices = await BleakScanner.discover(timeout=timeout)
-    for d in devices:
-        if d.name and name_substr.lower() in d.name.lower():
-            print(f"Found: name={d.name!r} address={d.address}")
+    found = await BleakScanner.discover(timeout=timeout, return_adv=True)
+    for d, adv in found.values():
+        name = adv.local_name or d.name
+        if name and name_substr.lower() in name.lower():
+            print(f"Found: name={name!r} address={d.address}")
+            beacon = describe_beacon(adv.manufacturer_data)
+            if beacon:
+                print(f"Beacon: {beacon}")
             return d.address
     raise RuntimeError("Device not found. Make sure SONYA-WATCH is advertising and Bluetooth is enabled.")
 
 
-async def interactive_loop(client: BleakClient, rx_uuid: str) -> None:
+async def watch_beacons(name_substr: str, duration: float) -> int:
+    """Print status beacon changes without connecting."""
+    last = {}
+
+    def on_adv(d, adv) -> None:
+        name = adv.local_name or d.name
+        beacon = describe_beacon(adv.manufacturer_data)
+        if not beacon or (name and name_substr.lower() not in name.lower()):
+            return
+        if last.get(d.address) != beacon:
+            last[d.address] = beacon
+            print(f"[{time.strftime('%H:%M:%S')}] {d.address} rssi={adv.rssi} {beacon}")
+
+    async with BleakScanner(detection_callback=on_adv, scanning_mode="active"):
+        await asyncio.sleep(duration)
+    return 0
+
+
+class RxWriter:
+    """Sends RX commands as ASCII, or as binary frames with increasing request ids (--bin)."""
+
+    def __init__(self, client: BleakClient, rx_uuid: str, binary: bool) -> None:
+        self.client = client
+        self.rx_uuid = rx_uuid
+        self.binary = binary
+        self.req = 0
+
+    async def send(self, cmd: str) -> None:
+        if self.binary:
+            # ';' packs several commands into one write: "GET:1:0:8192;GET:1:65536:8192"
+            data = b""
+            for part in cmd.split(";"):
+                self.req += 1
+                data += encode_bin_cmd(part, self.req)
+            await self.client.write_gatt_char(self.rx_uuid, data, response=False)
+            print(f">> RX bin: {cmd!r} req<={self.req} {_hexdump(data)}")
+            return
+        await self.client.write_gatt_char(self.rx_uuid, cmd.encode("utf-8"), response=False)
+        print(f">> RX: {cmd!r}")
+
+
+async def interactive_loop(rx: RxWriter) -> None:
     loop = asyncio.get_running_loop()
     print("Enter commands for RX (e.g. PING / SETREC:2 / REC). Ctrl+C to exit.")
 
@@ -81,11 +307,20 @@ async def interactive_loop(client: BleakClient, rx_uuid: str) -> None:
         cmd = line.strip("\r\n")
         if not cmd:
             continue
-        await client.write_gatt_char(rx_uuid, cmd.encode("utf-8"), response=False)
-        print(f">> RX: {cmd!r}")
+        await rx.send(cmd)
+
+
+async def poll_status(client: BleakClient, tx_uuid: str, period: float) -> None:
+    """Read the TX characteristic (cached EVT_STATUS) every period seconds."""
+    while True:
+        data = bytes(await client.read_gatt_char(tx_uuid))
+        print(f"[{time.strftime('%H:%M:%S')}] == TX read {describe_status(data) if data else 'empty'}")
+        await asyncio.sleep(period)
 
 
 async def run(args: argparse.Namespace) -> int:
+    if args.beacon:
+        return await watch_beacons(args.name, args.beacon)
     address = args.address
     if not address:
         address = await pick_device(args.name, timeout=args.scan_timeout)
@@ -95,13 +330,18 @@ async def run(args: argparse.Namespace) -> int:
     last_rec_bytes = 0
     last_rec_chunks = 0
 
+    anchors = StreamAnchors()
+
     def on_notify(_: int, data: bytearray) -> None:
         nonlocal last_rec_bytes, last_rec_chunks
         b = bytes(data)
-        f = parse_frame(b)
+        # Replies before the SESS that switches to v2 still come in v1.
+        f = (parse_frame_v2(b, args.hcrc) or parse_frame(b)) if args.v2 else parse_frame(b)
         ts = time.strftime("%H:%M:%S")
-        if f:
-            msg = describe_frame(f)
+        if f and f.type == 0x08:
+            print(f"[{ts}] << TX EVT_BATCH seq={f.seq} records={len(unbatch(f))} bytes={f.length}")
+        for f in unbatch(f) if f else []:
+            msg = describe_frame(f, anchors)
             print(f"[{ts}] << TX {msg}")
             if f.type == 0x10:
                 last_rec_bytes += f.length
@@ -114,7 +354,7 @@ async def run(args: argparse.Namespace) -> int:
                     print(f"[{ts}]    total AUDIO_CHUNK: chunks={last_rec_chunks} bytes={last_rec_bytes}")
                 last_rec_bytes = 0
                 last_rec_chunks = 0
-        else:
+        if not f:
             print(f"[{ts}] << TX raw {len(b)} bytes hex={_hexdump(b)}")
 
     print(f"Connecting to {address} ...")
@@ -128,20 +368,23 @@ async def run(args: argparse.Namespace) -> int:
         await client.start_notify(args.tx_uuid, on_notify)
         print("TX notifications enabled.")
 
+        poller = asyncio.create_task(poll_status(client, args.tx_uuid, args.read)) if args.read else None
+
+        rx = RxWriter(client, args.rx_uuid, args.bin)
         # Optional one-shot commands
         for cmd in args.cmd:
-            await client.write_gatt_char(args.rx_uuid, cmd.encode("utf-8"), response=False)
-            print(f">> RX: {cmd!r}")
+            await rx.send(cmd)
             await asyncio.sleep(0.1)
 
-        if args.no_interactive:
-            # keep alive to receive notifications
-            await asyncio.sleep(args.keepalive)
-            return 0
-
         try:
-            await interactive_loop(client, args.rx_uuid)
+            if args.no_interactive:
+                # keep alive to receive notifications
+                await asyncio.sleep(args.keepalive)
+                return 0
+            await interactive_loop(rx)
         finally:
+            if poller:
+                poller.cancel()
             try:
                 await client.stop_notify(args.tx_uuid)
             except Exception:
@@ -157,7 +400,16 @@ def main() -> int:
     ap.add_argument("--svc-uuid", default=SVC_UUID, help="Service UUID (informational)")
     ap.add_argument("--rx-uuid", default=RX_UUID, help="RX characteristic UUID (write)")
     ap.add_argument("--tx-uuid", default=TX_UUID, help="TX characteristic UUID (notify)")
+    ap.add_argument("--beacon", type=float, metavar="SEC", default=0.0,
+                    help="Only scan for SEC seconds and print status beacon changes (no connect)")
     ap.add_argument("--cmd", action="append", default=[], help="Send command immediately (repeatable)")
+    ap.add_argument("--bin", action="store_true",
+                    help="Send commands as binary frames (same text syntax, ';' joins several into one write)")
+    ap.add_argument("--v2", action="store_true",
+                    help="Parse TX as v2 headers (after SESS with mode flag 0x80, e.g. --cmd SESS:0:0:128)")
+    ap.add_argument("--hcrc", action="store_true", help="With --v2: headers carry a CRC-8 (SESS mode flag 0x40)")
+    ap.add_argument("--read", type=float, metavar="SEC", default=0.0,
+                    help="Also read the TX characteristic (device status) every SEC seconds")
     ap.add_argument("--no-interactive", action="store_true", help="Do not read stdin; just send --cmd and wait")
     ap.add_argument("--keepalive", type=float, default=8.0, help="Seconds to keep connection in no-interactive mode")
     ap.add_argument("--audio-out", help="Append received AUDIO_CHUNK payloads to file (raw 16kHz s16le mono)")
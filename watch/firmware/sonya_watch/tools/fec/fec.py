@@ -0,0 +1,229 @@
+"""
+Live FEC (AUDIO_FEC, 0x17): parity decoder and a loss simulation against NACK-only recovery.
+
+After every k live AUDIO_DATA frames of the same size the watch sends
+    [rec_id:u16][off:u32][frame:u16][k:u8][xor of the k frames' PCM]
+covering PCM [off, off + k * frame). One lost frame of the group is rebuilt from
+the other k - 1 and the parity; two or more still need a NACK.
+
+    python fec.py                                  # auto k, loss 0..10 %
+    python fec.py --loss 0.02 --burst 3 --k 8,16   # bursty loss, fixed group sizes
+"""
+
+import argparse
+import os
+import random
+import struct
+from dataclasses import dataclass
+from typing import Dict, List, Optional, Tuple
+
+AUDIO_FEC = 0x17
+HDR = 9
+SR_BYTES = 32000          # 16 kHz mono PCM16
+K_MIN, K_AUTO_MIN, K_MAX = 2, 4, 32
+TARGET_PPM = 100_000      # pull_stream FEC_TARGET_PPM
+
+
+def auto_k(loss_ppm: int) -> int:
+    """Group size the firmware picks in FEC:1 mode (fec_k in pull_stream.c)."""
+    k = TARGET_PPM // loss_ppm if loss_ppm else K_MAX + 1
+    k = k - 1 if k > 1 else 0
+    return max(K_AUTO_MIN, min(K_MAX, k))
+
+
+def xor_into(acc: bytearray, data: bytes) -> None:
+    for i, b in enumerate(data):
+        acc[i] ^= b
+
+
+def build_parity(rec_id: int, off: int, frames: List[bytes]) -> bytes:
+    """AUDIO_FEC payload for consecutive equal-size frames starting at PCM offset off."""
+    frame = len(frames[0])
+    acc = bytearray(frame)
+    for f in frames:
+        xor_into(acc, f)
+    return struct.pack("<HIHB", rec_id, off, frame, len(frames)) + bytes(acc)
+
+
+class FecDecoder:
+    """Keeps recent live PCM frames by offset and rebuilds one missing frame per parity."""
+
+    def __init__(self, keep: int = 4 * K_MAX) -> None:
+        self.frames: Dict[Tuple[int, int], bytes] = {}
+        self.keep = keep
+        self.repaired = 0
+
+    def on_data(self, rec_id: int, off: int, pcm: bytes) -> None:
+        self.frames[(rec_id, off)] = pcm
+        if len(self.frames) > self.keep:
+            for key in sorted(self.frames)[: len(self.frames) - self.keep]:
+                del self.frames[key]
+
+    def on_parity(self, payload: bytes) -> Optional[Tuple[int, int, bytes]]:
+        """(rec_id, off, pcm) of the rebuilt frame, or None if none or too many are missing."""
+        if len(payload) < HDR:
+            return None
+        rec_id, off, frame, k = struct.unpack_from("<HIHB", payload, 0)
+        acc = bytearray(payload[HDR : HDR + frame])
+        missing = None
+        for i in range(k):
+            f = self.frames.get((rec_id, off + i * frame))
+            if f is None:
+                if missing is not None:
+                    return None
+                missing = off + i * frame
+            else:
+                xor_into(acc, f[:frame])
+        if missing is None:
+            return None
+        pcm = bytes(acc)
+        self.on_data(rec_id, missing, pcm)
+        self.repaired += 1
+        return rec_id, missing, pcm
+
+
+# ---- loss simulation ----
+
+class Channel:
+    """Gilbert-Elliott loss: mean rate `loss`, mean burst length `burst` (1 = independent)."""
+
+    def __init__(self, loss: float, burst: float, rng: random.Random) -> None:
+        self.rng = rng
+        self.loss = loss
+        self.to_good = 1.0 / max(burst, 1.0)
+        self.to_bad = loss * self.to_good / (1.0 - loss) if loss < 1.0 else 1.0
+        self.bad = False
+
+    def lost(self) -> bool:
+        if self.loss <= 0:
+            return False
+        self.bad = self.rng.random() < (1.0 - self.to_good if self.bad else self.to_bad)
+        return self.bad
+
+
+@dataclass
+class Stats:
+    frames: int = 0
+    lost: int = 0
+    fec_fixed: int = 0
+    nacked: int = 0
+    round_trips: int = 0
+    parity_bytes: int = 0
+    data_bytes: int = 0
+    lat: List[float] = None
+
+    def lat_mean(self) -> float:
+        return sum(self.lat) / len(self.lat) if self.lat else 0.0
+
+    def lat_p95(self) -> float:
+        if not self.lat:
+            return 0.0
+        s = sorted(self.lat)
+        return s[min(len(s) - 1, int(0.95 * len(s)))]
+
+
+def nack_recover(t_nack: float, ch: Channel, delay_ms: float, period_ms: float) -> Tuple[float, int]:
+    """Time a NACKed frame lands and the round trips it took; a lost request or resend is re-NACKed after an RTO."""
+    rto = 2 * delay_ms + 4 * period_ms
+    t, trips = t_nack, 0
+    while True:
+        trips += 1
+        if not ch.lost() and not ch.lost():   # request up, resend down
+            return t + 2 * delay_ms + period_ms / 2, trips
+        t += rto
+
+
+def simulate(seconds: float, frame: int, loss: float, burst: float, delay_ms: float,
+             k: Optional[int], seed: int) -> Stats:
+    """
+    One live stream. k None = NACK only; 0 = auto (the phone reports the loss it sees
+    with FEC:1:<ppm>); otherwise a fixed group size. Latency is how long a lost frame
+    arrives after it would have, ignoring the frames that were never lost.
+    """
+    rng = random.Random(seed)
+    ch = Channel(loss, burst, rng)
+    period = frame * 1000.0 / SR_BYTES
+    n = int(seconds * SR_BYTES) // frame
+    st = Stats(frames=n, lat=[])
+    dec = FecDecoder()
+    pcm_rng = random.Random(seed ^ 0x5A5A)
+    group_k = auto_k(int(loss * 1e6)) if k == 0 else k
+
+    i = 0
+    pending: List[Tuple[int, float]] = []   # (frame index, detect time) waiting for NACK
+    while i < n:
+        kk = min(group_k, n - i) if group_k else 1
+        frames = [pcm_rng.randbytes(frame) for _ in range(kk)]
+        got = []
+        for j in range(kk):
+            st.data_bytes += frame + 5 + 6
+            if ch.lost():
+                st.lost += 1
+                got.append(False)
+            else:
+                dec.on_data(1, (i + j) * frame, frames[j])
+                got.append(True)
+        t_last = (i + kk - 1) * period
+        if group_k and kk == group_k:
+            par = build_parity(1, i * frame, frames)
+            st.parity_bytes += len(par) + 5
+            if not ch.lost():
+                fixed = dec.on_parity(par)
+                if fixed is not None:
+                    j = fixed[1] // frame - i
+                    assert fixed[2] == frames[j], "parity rebuilt the wrong bytes"
+                    got[j] = True
+                    st.fec_fixed += 1
+                    st.lat.append(t_last + period - (i + j) * period)
+        for j in range(kk):
+            if got[j]:
+                continue
+            # NACK-only: the next frame that arrives shows the gap. With FEC the phone
+            # first waits for the group's parity (one frame period after the last frame).
+            t_detect = (i + j + 1) * period
+            if group_k:
+                t_detect = max(t_detect, t_last + 2 * period)
+            pending.append((i + j, t_detect + delay_ms))
+        i += kk
+
+    for idx, t in pending:
+        t_done, trips = nack_recover(t, ch, delay_ms, period)
+        st.nacked += 1
+        st.round_trips += trips
+        st.lat.append(t_done - (idx * period + delay_ms))
+    return st
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description="Live FEC vs NACK-only on a simulated lossy link")
+    ap.add_argument("--seconds", type=float, default=60.0)
+    ap.add_argument("--frame", type=int, default=230,
+                    help="PCM bytes per live frame (ATT_MTU 247 with FEC on: 247 - 3 - 5 - 9)")
+    ap.add_argument("--loss", default="0.005,0.01,0.02,0.05,0.1", help="Comma-separated loss rates")
+    ap.add_argument("--burst", type=float, default=1.0, help="Mean loss burst length in frames")
+    ap.add_argument("--delay-ms", type=float, default=40.0, help="One-way latency incl. conn interval")
+    ap.add_argument("--k", default="auto", help="Comma-separated group sizes, 'auto' for FEC:1")
+    ap.add_argument("--seed", type=int, default=int.from_bytes(os.urandom(2), "little"))
+    args = ap.parse_args()
+
+    ks = [0 if x == "auto" else int(x) for x in args.k.split(",") if x]
+    for x in ks:
+        if x and not K_MIN <= x <= K_MAX:
+            ap.error(f"k must be {K_MIN}..{K_MAX} or auto")
+    print(f"{args.seconds:.0f} s live, frame={args.frame} B, delay={args.delay_ms} ms, "
+          f"burst={args.burst}, seed={args.seed}")
+    print("lat = how late a lost frame becomes playable (ms); resid = lost frames that still needed a NACK")
+    print(f"{'loss':>6} {'mode':>8} | {'lost':>5} {'resid':>6} {'RTs':>5} {'ovh':>6} | {'lat avg':>8} {'lat p95':>8}")
+    for loss in [float(x) for x in args.loss.split(",") if x]:
+        for mode in [None] + ks:
+            st = simulate(args.seconds, args.frame, loss, args.burst, args.delay_ms, mode, args.seed)
+            name = "nack" if mode is None else (f"auto:{auto_k(int(loss * 1e6))}" if mode == 0 else f"k={mode}")
+            resid = 100.0 * st.nacked / st.frames
+            ovh = 100.0 * st.parity_bytes / st.data_bytes if st.data_bytes else 0.0
+            print(f"{loss:>6.3f} {name:>8} | {st.lost:>5} {resid:>5.2f}% {st.round_trips:>5} {ovh:>5.1f}% | "
+                  f"{st.lat_mean():>8.1f} {st.lat_p95():>8.1f}")
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -0,0 +1,236 @@
+"""
+Pull benchmark: GATT notifications vs L2CAP CoC for the same recording.
+
+Connects to the watch, waits for a recording (or triggers one with --rec), then
+pulls it with GET windows once per transport and reports bytes/s and host CPU.
+Watch-side CPU and link details are in the firmware log line
+`PULL link: via=coc|gatt ... cpu=NN%`.
+
+CoC needs Linux/BlueZ (LE L2CAP sockets); on other OSes only GATT runs.
+
+    python l2cap_bench.py --rec 10 --transport both
+"""
+
+import argparse
+import asyncio
+import ctypes
+import socket
+import struct
+import sys
+import time
+from dataclasses import dataclass
+from typing import Optional
+
+from bleak import BleakClient, BleakScanner
+
+RX_UUID = "f0debc9a-7956-3412-7856-341278563412"
+TX_UUID = "f0debc9a-7a56-3412-7856-341278563412"
+
+AUDIO_DATA = 0x12
+EVT_REC_END = 0x03
+EVT_ERROR = 0x11
+GET_WINDOW = 16384
+
+# <bluetooth/bluetooth.h>, <bluetooth/l2cap.h>
+BTPROTO_L2CAP = 0
+SOL_BLUETOOTH = 274
+BT_RCVMTU = 13
+BDADDR_LE_PUBLIC = 1
+BDADDR_LE_RANDOM = 2
+
+
+@dataclass
+class RecInfo:
+    rec_id: int
+    total: int
+
+
+@dataclass
+class Result:
+    transport: str
+    nbytes: int
+    wall_s: float
+    cpu_s: float
+    frames: int
+
+    def line(self) -> str:
+        bps = self.nbytes / self.wall_s if self.wall_s > 0 else 0.0
+        cpu = 100.0 * self.cpu_s / self.wall_s if self.wall_s > 0 else 0.0
+        return (f"{self.transport:5s} bytes={self.nbytes} frames={self.frames} "
+                f"avg_frame={self.nbytes // max(self.frames, 1)}B "
+                f"t={self.wall_s:.2f}s rate={bps / 1000:.1f} kB/s host_cpu={cpu:.1f}%")
+
+
+def parse_frames(buf: bytes):
+    """Yield (type, payload) for each complete frame in buf."""
+    pos = 0
+    while pos + 5 <= len(buf):
+        t = buf[pos]
+        ln = buf[pos + 3] | (buf[pos + 4] << 8)
+        if pos + 5 + ln > len(buf):
+            break
+        yield t, buf[pos + 5 : pos + 5 + ln]
+        pos += 5 + ln
+
+
+class SockaddrL2(ctypes.Structure):
+    _fields_ = [
+        ("l2_family", ctypes.c_ushort),
+        ("l2_psm", ctypes.c_ushort),
+        ("l2_bdaddr", ctypes.c_ubyte * 6),
+        ("l2_cid", ctypes.c_ushort),
+        ("l2_bdaddr_type", ctypes.c_ubyte),
+    ]
+
+
+def open_coc(address: str, psm: int, addr_type: int, mtu: int) -> socket.socket:
+    """Open an LE credit-based channel; Python's socket API cannot set l2_bdaddr_type."""
+    s = socket.socket(socket.AF_BLUETOOTH, socket.SOCK_SEQPACKET, BTPROTO_L2CAP)
+    s.setsockopt(SOL_BLUETOOTH, BT_RCVMTU, struct.pack("<H", mtu))
+    sa = SockaddrL2()
+    sa.l2_family = socket.AF_BLUETOOTH
+    sa.l2_psm = int.from_bytes(psm.to_bytes(2, "little"), sys.byteorder)  # kernel wants LE
+    sa.l2_bdaddr[:] = bytes.fromhex(address.replace(":", ""))[::-1]
+    sa.l2_bdaddr_type = addr_type
+    libc = ctypes.CDLL(None, use_errno=True)
+    if libc.connect(s.fileno(), ctypes.byref(sa), ctypes.sizeof(sa)) != 0:
+        err = ctypes.get_errno()
+        s.close()
+        raise OSError(err, f"L2CAP connect psm=0x{psm:02x}")
+    s.setblocking(False)
+    return s
+
+
+class Bench:
+    def __init__(self, client: BleakClient) -> None:
+        self.client = client
+        self.rec_end: asyncio.Future = asyncio.get_running_loop().create_future()
+        self.got = 0
+        self.frames = 0
+        self.window_done = asyncio.Event()
+        self.window_end = 0
+        self.rec_id = -1
+
+    def on_frame(self, t: int, payload: bytes) -> None:
+        if t == EVT_REC_END and len(payload) >= 6 and not self.rec_end.done():
+            rec_id, total = struct.unpack_from("<HI", payload, 0)
+            self.rec_end.set_result(RecInfo(rec_id, total))
+        elif t == EVT_ERROR:
+            print("<< EVT_ERROR", payload.decode("utf-8", errors="replace"))
+        elif t == AUDIO_DATA and len(payload) >= 6:
+            rec_id, off = struct.unpack_from("<HI", payload, 0)
+            if rec_id != self.rec_id:
+                return
+            end = off + len(payload) - 6
+            self.frames += 1
+            if end > self.got:
+                self.got = end
+            if self.got >= self.window_end:
+                self.window_done.set()
+
+    def on_notify(self, _: int, data: bytearray) -> None:
+        for t, p in parse_frames(bytes(data)):
+            self.on_frame(t, p)
+
+    async def pull(self, rec: RecInfo, transport: str, sock: Optional[socket.socket]) -> Result:
+        loop = asyncio.get_running_loop()
+        reader = None
+        if sock is not None:
+            def _drain() -> None:
+                while True:
+                    try:
+                        sdu = sock.recv(65535)
+                    except BlockingIOError:
+                        return
+                    for t, p in parse_frames(sdu):
+                        self.on_frame(t, p)
+            loop.add_reader(sock.fileno(), _drain)
+            reader = sock.fileno()
+
+        self.rec_id = rec.rec_id
+        self.got = 0
+        self.frames = 0
+        t0, c0 = time.perf_counter(), time.process_time()
+        try:
+            while self.got < rec.total:
+                want = min(GET_WINDOW, rec.total - self.got)
+                self.window_end = self.got + want
+                self.window_done.clear()
+                cmd = f"GET:{rec.rec_id}:{self.got}:{want}"
+                await self.client.write_gatt_char(RX_UUID, cmd.encode(), response=False)
+                try:
+                    await asyncio.wait_for(self.window_done.wait(), timeout=3.0)
+                except asyncio.TimeoutError:
+                    if not self.client.is_connected:
+                        raise RuntimeError("disconnected")
+                    print(f"   {transport}: window stalled at {self.got}, re-requesting")
+        finally:
+            if reader is not None:
+                loop.remove_reader(reader)
+        return Result(transport, self.got, time.perf_counter() - t0,
+                      time.process_time() - c0, self.frames)
+
+
+async def pick_device(name: str, timeout: float) -> str:
+    for d in await BleakScanner.discover(timeout=timeout):
+        if d.name and name.lower() in d.name.lower():
+            return d.address
+    raise RuntimeError(f"{name!r} not found")
+
+
+async def run(args: argparse.Namespace) -> int:
+    address = args.address or await pick_device(args.name, args.scan_timeout)
+    print(f"Connecting to {address} ...")
+    async with BleakClient(address) as client:
+        bench = Bench(client)
+        await client.start_notify(TX_UUID, bench.on_notify)
+        if args.rec:
+            for cmd in (f"SETREC:{args.rec}", "REC"):
+                await client.write_gatt_char(RX_UUID, cmd.encode(), response=False)
+            print(f"Recording {args.rec} s ...")
+        else:
+            print("Waiting for a recording (press the button on the watch) ...")
+        rec: RecInfo = await asyncio.wait_for(bench.rec_end, timeout=args.rec_timeout)
+        print(f"REC_END rec_id={rec.rec_id} total={rec.total} bytes")
+        await asyncio.sleep(0.5)
+
+        results = []
+        if args.transport in ("gatt", "both"):
+            results.append(await bench.pull(rec, "gatt", None))
+        if args.transport in ("coc", "both"):
+            if not sys.platform.startswith("linux"):
+                print("coc: skipped (needs Linux/BlueZ)")
+            else:
+                sock = open_coc(address, args.psm, args.addr_type, args.sdu)
+                try:
+                    await asyncio.sleep(0.3)  # let the watch see COC_CONNECTED
+                    results.append(await bench.pull(rec, "coc", sock))
+                finally:
+                    sock.close()
+
+        if args.done:
+            await client.write_gatt_char(RX_UUID, f"DONE:{rec.rec_id}".encode(), response=False)
+        print()
+        for r in results:
+            print(r.line())
+    return 0
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description="GATT vs L2CAP CoC pull benchmark")
+    ap.add_argument("--address", help="BLE address (if omitted: scan by name)")
+    ap.add_argument("--name", default="SONYA-WATCH")
+    ap.add_argument("--scan-timeout", type=float, default=6.0)
+    ap.add_argument("--rec", type=int, default=0, help="Trigger a recording of N seconds (SETREC + REC)")
+    ap.add_argument("--rec-timeout", type=float, default=120.0)
+    ap.add_argument("--transport", choices=("gatt", "coc", "both"), default="both")
+    ap.add_argument("--psm", type=lambda v: int(v, 0), default=0x80, help="CONFIG_BLE_COC_PSM")
+    ap.add_argument("--sdu", type=int, default=2048, help="Our CoC receive MTU")
+    ap.add_argument("--addr-type", type=int, default=BDADDR_LE_PUBLIC,
+                    help="1 = LE public, 2 = LE random")
+    ap.add_argument("--done", action="store_true", help="Send DONE afterwards (frees the recording)")
+    return asyncio.run(run(ap.parse_args()))
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -0,0 +1,324 @@
+"""
+Lossless AUDIO_LOSSLESS (0x16) transfer: block decoder, CRC check, bench and pull.
+
+Each 4096-sample block (components/lossless) is split over frames:
+    [rec_id:u16][off:u32][samples:u16][blk_len:u16][chunk_off:u16][block bytes...]
+off is the PCM byte offset of the block (a multiple of 8192), so blocks decode and
+land independently; a later copy of the same block replaces an earlier, shorter one.
+
+    python lossless.py                       # synthetic signal: ratio + round trip
+    python lossless.py --wav in.wav
+    python lossless.py --pull --rec 5        # record, GET with CODEC:LOSSLESS, check CRC32
+"""
+
+import argparse
+import asyncio
+import math
+import random
+import struct
+import sys
+import time
+import wave
+import zlib
+from array import array
+from typing import Dict, List, Optional, Tuple
+
+BLOCK = 4096
+PART = 256
+MAX_ORDER = 4
+ESCAPE = 31
+RAW_BITS = 21
+AUDIO_LOSSLESS = 0x16
+HDR = 12
+
+
+# ---- block coder ----
+
+def _res(x, i: int, o: int) -> int:
+    if o == 0:
+        return x[i]
+    if o == 1:
+        return x[i] - x[i - 1]
+    if o == 2:
+        return x[i] - 2 * x[i - 1] + x[i - 2]
+    if o == 3:
+        return x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3]
+    return x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4]
+
+
+def _pred(x, o: int) -> int:
+    """Prediction of the next sample from the tail of x (fixed polynomial of order o)."""
+    if o == 0:
+        return 0
+    if o == 1:
+        return x[-1]
+    if o == 2:
+        return 2 * x[-1] - x[-2]
+    if o == 3:
+        return 3 * x[-1] - 3 * x[-2] + x[-3]
+    return 4 * x[-1] - 6 * x[-2] + 4 * x[-3] - x[-4]
+
+
+def _zz(r: int) -> int:
+    return (r << 1) if r >= 0 else ((-r) << 1) - 1
+
+
+def _unzz(u: int) -> int:
+    return (u >> 1) if not u & 1 else -((u + 1) >> 1)
+
+
+class BitReader:
+    def __init__(self, data: bytes) -> None:
+        self.v = int.from_bytes(data, "big")
+        self.left = 8 * len(data)
+
+    def bits(self, n: int) -> int:
+        if n > self.left:
+            raise ValueError("block truncated")
+        self.left -= n
+        return (self.v >> self.left) & ((1 << n) - 1)
+
+    def unary(self) -> int:
+        q = 0
+        while not self.bits(1):
+            q += 1
+        return q
+
+
+def decode_block(blk: bytes, n: int) -> List[int]:
+    order = blk[0]
+    x = list(struct.unpack_from(f"<{order}h", blk, 1))
+    br = BitReader(blk[1 + 2 * order :])
+    for p0 in range(0, n, PART):
+        i0, i1 = max(p0, order), min(p0 + PART, n)
+        k = br.bits(5)
+        for i in range(i0, i1):
+            u = br.bits(RAW_BITS) if k == ESCAPE else (br.unary() << k) | br.bits(k)
+            x.append(_unzz(u) + _pred(x, order))
+    return x
+
+
+def encode_block(pcm, n: int) -> bytes:
+    """Reference encoder, bit-exact with components/lossless/lossless.c."""
+    x = pcm[:n]
+    best, best_sum = 0, None
+    for o in range(0, min(MAX_ORDER, n - 1) + 1):
+        s = sum(abs(_res(x, i, o)) for i in range(min(MAX_ORDER, n), n))
+        if best_sum is None or s < best_sum:
+            best, best_sum = o, s
+    order = best
+    out = bytearray([order]) + struct.pack(f"<{order}h", *x[:order])
+    acc, nacc = 0, 0
+
+    def put(v: int, nb: int) -> None:
+        nonlocal acc, nacc
+        acc = (acc << nb) | (v & ((1 << nb) - 1))
+        nacc += nb
+
+    for p0 in range(0, n, PART):
+        i0, i1 = max(p0, order), min(p0 + PART, n)
+        us = [_zz(_res(x, i, order)) for i in range(i0, i1)]
+        k0 = 0
+        if us:
+            mean = sum(us) // len(us)
+            while k0 < 20 and (1 << (k0 + 1)) <= mean:
+                k0 += 1
+        cost = lambda k: len(us) * (k + 1) + sum(u >> k for u in us)  # noqa: E731
+        k, c = k0, cost(k0)
+        for kk in (k0 - 1, k0 + 1):
+            if 0 <= kk <= 20 and cost(kk) < c:
+                k, c = kk, cost(kk)
+        if c > len(us) * RAW_BITS:
+            put(ESCAPE, 5)
+            for u in us:
+                put(u, RAW_BITS)
+            continue
+        put(k, 5)
+        for u in us:
+            q = u >> k
+            put(1, q + 1)
+            if k:
+                put(u, k)
+    if nacc % 8:
+        put(0, 8 - nacc % 8)
+    return bytes(out) + acc.to_bytes(nacc // 8, "big")
+
+
+# ---- frame reassembly ----
+
+class Assembler:
+    """Collects AUDIO_LOSSLESS chunks into blocks, keyed by PCM offset."""
+
+    def __init__(self) -> None:
+        self.parts: Dict[Tuple[int, int, int], Dict[int, bytes]] = {}
+        self.blocks: Dict[int, Tuple[int, List[int]]] = {}   # off -> (samples, pcm)
+
+    def on_frame(self, payload: bytes) -> Optional[int]:
+        """Feed one frame payload; returns the block offset once that block is complete."""
+        _, off, n, blen, coff = struct.unpack_from("<HIHHH", payload, 0)
+        key = (off, n, blen)
+        chunks = self.parts.setdefault(key, {})
+        chunks[coff] = payload[HDR:]
+        got = sum(len(c) for c in chunks.values())
+        if got < blen:
+            return None
+        blk = b"".join(chunks[o] for o in sorted(chunks))[:blen]
+        del self.parts[key]
+        if off not in self.blocks or self.blocks[off][0] <= n:
+            self.blocks[off] = (n, decode_block(blk, n))
+        return off
+
+    def pcm(self) -> bytes:
+        out = bytearray()
+        for off in sorted(self.blocks):
+            if off != len(out):
+                raise ValueError(f"gap at {len(out)} (next block at {off})")
+            out += array("h", self.blocks[off][1]).tobytes()
+        return bytes(out)
+
+
+# ---- offline bench ----
+
+def test_signal(sr: int, sec: float) -> array:
+    rnd = random.Random(1)
+    out = array("h")
+    phase = 0.0
+    for i in range(int(sr * sec)):
+        t = i / sr
+        phase += 2 * math.pi * (140 + 40 * math.sin(2 * math.pi * 0.7 * t)) / sr
+        env = 0.5 + 0.5 * math.sin(2 * math.pi * 4 * t) ** 2
+        v = sum(math.sin(k * phase) / k for k in (1, 2, 3, 5))
+        out.append(max(-32768, min(32767, int(6000 * env * v + rnd.gauss(0, 300)))))
+    return out
+
+
+def read_wav(path: str) -> array:
+    with wave.open(path, "rb") as w:
+        if w.getsampwidth() != 2:
+            raise SystemExit("need 16-bit PCM")
+        ch = w.getnchannels()
+        pcm = array("h", w.readframes(w.getnframes()))
+    return pcm[::ch] if ch > 1 else pcm
+
+
+def bench(pcm: array) -> int:
+    t0 = time.perf_counter()
+    blocks = [(s0, encode_block(pcm[s0 : s0 + BLOCK], min(BLOCK, len(pcm) - s0)))
+              for s0 in range(0, len(pcm), BLOCK)]
+    t_enc = time.perf_counter() - t0
+    asm = Assembler()
+    t0 = time.perf_counter()
+    for s0, blk in blocks:
+        asm.on_frame(struct.pack("<HIHHH", 1, 2 * s0, min(BLOCK, len(pcm) - s0), len(blk), 0) + blk)
+    out = asm.pcm()
+    t_dec = time.perf_counter() - t0
+    raw = pcm.tobytes()
+    size = sum(len(b) for _, b in blocks)
+    ok = out == raw
+    print(f"blocks   {len(blocks)} x {BLOCK} samples")
+    print(f"size     pcm={len(raw)} B  lossless={size} B  ({100.0 * size / len(raw):.1f}% of PCM)")
+    print(f"crc32    pcm=0x{zlib.crc32(raw):08x} decoded=0x{zlib.crc32(out):08x} {'OK' if ok else 'MISMATCH'}")
+    print(f"host     encode={len(pcm) / t_enc / 1e3:.0f} ksamples/s  decode={len(pcm) / t_dec / 1e3:.0f} ksamples/s")
+    return 0 if ok else 1
+
+
+# ---- pull from the watch ----
+
+RX_UUID = "f0debc9a-7956-3412-7856-341278563412"
+TX_UUID = "f0debc9a-7a56-3412-7856-341278563412"
+EVT_REC_END = 0x03
+EVT_ERROR = 0x11
+GET_WINDOW = 7 * 2 * BLOCK     # whole blocks; GET len is u16
+
+
+def parse_frames(buf: bytes):
+    pos = 0
+    while pos + 5 <= len(buf):
+        t = buf[pos]
+        ln = buf[pos + 3] | (buf[pos + 4] << 8)
+        if pos + 5 + ln > len(buf):
+            break
+        yield t, buf[pos + 5 : pos + 5 + ln]
+        pos += 5 + ln
+
+
+async def pull(args: argparse.Namespace) -> int:
+    from bleak import BleakClient, BleakScanner
+
+    address = args.address
+    if not address:
+        for d in await BleakScanner.discover(timeout=6.0):
+            if d.name and args.name.lower() in d.name.lower():
+                address = d.address
+                break
+        else:
+            raise SystemExit(f"{args.name!r} not found")
+
+    loop = asyncio.get_running_loop()
+    rec_end: asyncio.Future = loop.create_future()
+    asm = Assembler()
+    progress = asyncio.Event()
+
+    def on_notify(_: int, data: bytearray) -> None:
+        for t, p in parse_frames(bytes(data)):
+            if t == AUDIO_LOSSLESS and len(p) >= HDR:
+                if asm.on_frame(p) is not None:
+                    progress.set()
+            elif t == EVT_REC_END and len(p) >= 12 and not rec_end.done():
+                rec_end.set_result(struct.unpack_from("<HII", p, 0))
+            elif t == EVT_ERROR:
+                print("<< EVT_ERROR", p.decode("utf-8", errors="replace"))
+
+    async with BleakClient(address) as client:
+        await client.start_notify(TX_UUID, on_notify)
+        cmds = ["CODEC:LOSSLESS"] + ([f"SETREC:{args.rec}", "REC"] if args.rec else [])
+        for c in cmds:
+            await client.write_gatt_char(RX_UUID, c.encode(), response=False)
+        print("Waiting for REC_END ...")
+        rec_id, total, crc = await asyncio.wait_for(rec_end, timeout=120.0)
+        print(f"REC_END rec={rec_id} total={total} crc=0x{crc:08x}")
+        t0 = time.perf_counter()
+        wire = 0
+        while True:
+            have = sum(2 * n for n, _ in asm.blocks.values())
+            if have >= total:
+                break
+            off = have - have % (2 * BLOCK)
+            progress.clear()
+            await client.write_gatt_char(RX_UUID, f"GET:{rec_id}:{off}:{min(GET_WINDOW, total - off)}".encode(),
+                                         response=False)
+            try:
+                await asyncio.wait_for(progress.wait(), timeout=3.0)
+                await asyncio.sleep(0.2)
+            except asyncio.TimeoutError:
+                print(f"stalled at {off}, re-requesting")
+        dt = time.perf_counter() - t0
+        pcm = asm.pcm()[:total]
+        got = zlib.crc32(pcm)
+        print(f"pulled {len(pcm)} B in {dt:.2f}s, crc32 0x{got:08x} {'OK' if got == crc else 'MISMATCH'}")
+        if args.out:
+            with wave.open(args.out, "wb") as w:
+                w.setnchannels(1)
+                w.setsampwidth(2)
+                w.setframerate(16000)
+                w.writeframes(pcm)
+        await client.write_gatt_char(RX_UUID, f"DONE:{rec_id}".encode(), response=False)
+        return 0 if got == crc else 1
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description="Lossless (LPC + Rice) decoder and bench")
+    ap.add_argument("--wav", help="16-bit PCM WAV for the offline bench (default: synthetic)")
+    ap.add_argument("--pull", action="store_true", help="Pull a recording from the watch with CODEC:LOSSLESS")
+    ap.add_argument("--address", help="BLE address (if omitted: scan by name)")
+    ap.add_argument("--name", default="SONYA-WATCH")
+    ap.add_argument("--rec", type=int, default=0, help="Trigger a recording of N seconds first")
+    ap.add_argument("--out", help="Write the pulled recording as WAV")
+    args = ap.parse_args()
+    if args.pull:
+        return asyncio.run(pull(args))
+    return bench(read_wav(args.wav) if args.wav else test_signal(16000, 10.0))
+
+
+if __name__ == "__main__":
+    sys.exit(main())
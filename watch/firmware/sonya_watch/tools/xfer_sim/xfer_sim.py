@@ -0,0 +1,256 @@
+"""
+Lossy-link simulator: GET pull model vs XGET windowed selective repeat.
+
+Models the watch side as implemented in components/pull_stream and the phone side
+as implemented in the Android app (GET) or as described in README (XGET/XACK).
+No BLE hardware needed:
+
+    python xfer_sim.py --bytes 960000 --loss 0,0.01,0.03,0.05,0.1
+"""
+
+import argparse
+import heapq
+import random
+from dataclasses import dataclass, field
+from typing import Callable, List, Tuple
+
+
+@dataclass
+class Link:
+    loss: float
+    delay_ms: float
+    tx_ms: float  # air/pacing time per notification
+    rng: random.Random
+
+    def lost(self) -> bool:
+        return self.rng.random() < self.loss
+
+
+@dataclass(order=True)
+class Ev:
+    t: float
+    seq: int
+    fn: Callable = field(compare=False)
+
+
+class Sim:
+    def __init__(self) -> None:
+        self.t = 0.0
+        self._q: List[Ev] = []
+        self._n = 0
+
+    def at(self, t: float, fn: Callable) -> None:
+        self._n += 1
+        heapq.heappush(self._q, Ev(t, self._n, fn))
+
+    def run(self, until: float) -> None:
+        while self._q and self._q[0].t <= until:
+            ev = heapq.heappop(self._q)
+            self.t = ev.t
+            ev.fn()
+
+
+# ---------------- GET model ----------------
+
+def run_get(total: int, link: Link, frame: int = 242, window: int = 16 * 1024,
+            stall_ms: float = 1200.0, limit_ms: float = 600_000.0) -> Tuple[float, int]:
+    sim = Sim()
+    st = {"job": 0, "off": 0, "end": 0, "busy_until": 0.0, "got": 0,
+          "win_end": 0, "last_rx": 0.0, "frames": 0, "done_t": None}
+
+    def watch_send(job: int) -> None:
+        if job != st["job"] or st["off"] >= st["end"]:
+            return
+        off = st["off"]
+        n = min(frame, st["end"] - off)
+        st["off"] += n
+        st["frames"] += 1
+        if not link.lost():
+            sim.at(sim.t + link.delay_ms, lambda o=off, n=n: phone_rx(o, n))
+        sim.at(sim.t + link.tx_ms, lambda: watch_send(job))
+
+    def watch_get(off: int, ln: int) -> None:
+        st["job"] += 1  # newer GET cancels the running window (xQueueReset)
+        st["off"] = off
+        st["end"] = min(total, off + ln)
+        watch_send(st["job"])
+
+    def phone_get(off: int) -> None:
+        ln = min(window, total - off)
+        st["win_end"] = off + ln
+        st["last_rx"] = sim.t
+        if not link.lost():
+            sim.at(sim.t + link.delay_ms, lambda: watch_get(off, ln))
+        sim.at(sim.t + stall_ms, phone_timeout)
+
+    def phone_timeout() -> None:
+        if st["done_t"] is not None:
+            return
+        if sim.t - st["last_rx"] >= stall_ms - 100:
+            phone_get(st["got"])
+
+    def phone_rx(off: int, n: int) -> None:
+        if st["done_t"] is not None:
+            return
+        st["last_rx"] = sim.t
+        if off != st["got"]:
+            phone_get(st["got"])
+            return
+        st["got"] += n
+        if st["got"] >= total:
+            st["done_t"] = sim.t
+        elif st["got"] >= st["win_end"]:
+            phone_get(st["got"])
+
+    phone_get(0)
+    sim.run(limit_ms)
+    return (st["done_t"] or limit_ms), st["frames"]
+
+
+# ---------------- XGET model ----------------
+
+def run_xget(total: int, link: Link, frame: int = 240, win_init: int = 8, win_max: int = 32,
+             ack_every: int = 4, ack_delay_ms: float = 30.0, loss_backoff: float = 0.10, limit_ms: float = 600_000.0) -> Tuple[float, int]:
+    sim = Sim()
+    n_frames = (total + frame - 1) // frame
+    w = {"base": 0, "next": 0, "win": win_init, "ai": 0, "recover": 0, "stamp": 0,
+         "acked": set(), "lost": set(), "retx": set(), "tx_stamp": {}, "sent_t": {},
+         "srtt": 0.0, "rto": 300.0, "loss": 0.0, "frames": 0}
+    p = {"have": set(), "cum": 0, "since_ack": 0, "ack_armed": False, "done_t": None}
+
+    def send(f: int, retx: bool) -> None:
+        w["stamp"] += 1
+        w["tx_stamp"][f] = w["stamp"]
+        w["sent_t"][f] = sim.t
+        w["lost"].discard(f)
+        if retx:
+            w["retx"].add(f)
+        w["frames"] += 1
+        if not link.lost():
+            sim.at(sim.t + link.delay_ms, lambda: phone_rx(f))
+
+    def pick() -> Tuple[int, bool]:
+        for f in range(w["base"], w["next"]):
+            if f in w["acked"]:
+                continue
+            if f in w["lost"] or sim.t - w["sent_t"][f] >= w["rto"]:
+                if f not in w["lost"]:
+                    w["rto"] = min(2000.0, w["rto"] * 2)
+                    w["win"] = max(4, w["win"] // 2)
+                    w["recover"] = w["next"]
+                return f, True
+        if w["next"] < n_frames and w["next"] - w["base"] < w["win"]:
+            f = w["next"]
+            w["next"] += 1
+            return f, False
+        return -1, False
+
+    def watch_tick() -> None:
+        if w["base"] >= n_frames:
+            return
+        f, retx = pick()
+        if f >= 0:
+            send(f, retx)
+            sim.at(sim.t + link.tx_ms, watch_tick)
+        else:
+            sim.at(sim.t + 20.0, watch_tick)  # xQueuePeek(ack, 20ms)
+
+    def watch_ack(cum: int, sack: int) -> None:
+        cum = min(cum, w["next"])
+        newly = 0
+        for f in range(w["base"], cum):
+            if f in w["acked"]:
+                continue
+            if f not in w["retx"]:
+                rtt = sim.t - w["sent_t"][f]
+                w["srtt"] = rtt if not w["srtt"] else (w["srtt"] * 7 + rtt) / 8
+            w["acked"].add(f)
+            newly += 1
+        w["base"] = max(w["base"], cum)
+        newest = 0
+        for i in range(32):
+            if not (sack >> i) & 1:
+                continue
+            f = cum + 1 + i
+            if f >= w["next"]:
+                break
+            if f not in w["acked"]:
+                w["acked"].add(f)
+                newly += 1
+            newest = max(newest, w["tx_stamp"].get(f, 0))
+        lost = [f for f in range(w["base"], w["next"])
+                if f not in w["acked"] and f not in w["lost"] and w["tx_stamp"][f] < newest]
+        w["lost"].update(lost)
+        if newly or lost:
+            w["loss"] = (w["loss"] * 7 + len(lost) / (newly + len(lost))) / 8
+        if lost and lost[0] >= w["recover"] and w["loss"] > loss_backoff:
+            w["win"] = max(4, w["win"] - w["win"] // 4)
+            w["recover"] = w["next"]
+            w["ai"] = 0
+        elif not lost and newly:
+            w["ai"] += newly
+            if w["ai"] >= w["win"]:
+                w["ai"] = 0
+                w["win"] = min(win_max, w["win"] + 1)
+        if w["srtt"]:
+            w["rto"] = min(2000.0, max(60.0, w["srtt"] * 2 + 20))
+
+    def phone_send_ack() -> None:
+        p["ack_armed"] = False
+        p["since_ack"] = 0
+        cum = p["cum"]
+        sack = 0
+        for i in range(32):
+            if cum + 1 + i in p["have"]:
+                sack |= 1 << i
+        if not link.lost():
+            sim.at(sim.t + link.delay_ms, lambda: watch_ack(cum, sack))
+
+    def phone_rx(f: int) -> None:
+        p["have"].add(f)
+        while p["cum"] in p["have"]:
+            p["cum"] += 1
+        if p["cum"] >= n_frames and p["done_t"] is None:
+            p["done_t"] = sim.t
+        p["since_ack"] += 1
+        gap = p["cum"] != f + 1 and f >= p["cum"]
+        if p["since_ack"] >= ack_every or gap or p["cum"] >= n_frames:
+            phone_send_ack()
+        elif not p["ack_armed"]:
+            p["ack_armed"] = True
+            sim.at(sim.t + ack_delay_ms, lambda: p["ack_armed"] and phone_send_ack())
+
+    watch_tick()
+    sim.run(limit_ms)
+    return (p["done_t"] or limit_ms), w["frames"]
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description="GET vs XGET goodput on a simulated lossy link")
+    ap.add_argument("--bytes", type=int, default=960_000, help="Recording size (default: 30 s PCM)")
+    ap.add_argument("--loss", default="0,0.01,0.02,0.05,0.1", help="Comma-separated loss rates")
+    ap.add_argument("--delay-ms", type=float, default=40.0, help="One-way latency incl. conn interval")
+    ap.add_argument("--tx-ms", type=float, default=8.0, help="Sender time per notification")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--runs", type=int, default=5, help="Runs per loss rate (averaged)")
+    args = ap.parse_args()
+
+    print(f"bytes={args.bytes} delay={args.delay_ms}ms tx={args.tx_ms}ms runs={args.runs}")
+    print(f"{'loss':>6} | {'GET s':>8} {'GET kB/s':>9} {'GET tx':>7} | {'XGET s':>8} {'XGET kB/s':>9} {'XGET tx':>7}")
+    for loss in [float(x) for x in args.loss.split(",") if x]:
+        tg = fg = tx = fx = 0.0
+        for r in range(args.runs):
+            t, f = run_get(args.bytes, Link(loss, args.delay_ms, args.tx_ms, random.Random(args.seed + r)))
+            tg += t
+            fg += f
+            t, f = run_xget(args.bytes, Link(loss, args.delay_ms, args.tx_ms, random.Random(args.seed + r)))
+            tx += t
+            fx += f
+        tg, fg, tx, fx = tg / args.runs, fg / args.runs, tx / args.runs, fx / args.runs
+        print(f"{loss:>6.3f} | {tg / 1000:>8.2f} {args.bytes / tg:>9.1f} {fg:>7.0f} | "
+              f"{tx / 1000:>8.2f} {args.bytes / tx:>9.1f} {fx:>7.0f}")
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())